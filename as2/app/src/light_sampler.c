@@ -16,7 +16,11 @@
 #include <time.h>
 
 #include "hal/sampler.h"
+#include "hal/adc_hal.h"
 #include "hal/dips.h"
+#include "hal/udp_listener.h"
+#include "hal/metrics.h"
+#include "hal/periodTimer.h"
 
 #ifndef ARRAY_SIZE
 #define ARRAY_SIZE(x) (sizeof(x)/sizeof((x)[0]))
@@ -47,6 +51,8 @@ static prev_second_stats_t g_prev_stats;
 static pthread_mutex_t stats_lock;
 
 static DipConfig g_dip_cfg;
+// Persists across seconds, so dips straddling a rollover count once.
+static DipDetector g_dip_detector;
 
 // Hardware stubs
 static int pwm_set_stub(int freq_hz, int duty) {
@@ -90,30 +96,32 @@ static void* pwm_thread_fn(void *arg) {
 // Per-second rollover
 static void perform_second_rollover(void) {
     Sampler_moveCurrentDataToHistory();
-    double *samples = NULL;
-    double *avgs    = NULL;
-    int sz = 0;
-    Sampler_getHistoryWithAverages(&samples, &avgs, &sz);
+
+    // Borrow samples + per-sample averages (no copy, no recomputation)
+    Sampler_historyView_t hist;
+    Sampler_acquireHistory(&hist);
+    int sz = hist.size;
 
     prev_second_stats_t st = (prev_second_stats_t){0};
     st.sample_count = sz;
 
-    if (sz > 0 && samples && avgs) {
-        st.min_volts = samples[0];
-        st.max_volts = samples[0];
+    if (sz > 0) {
+        uint16_t min_code = hist.samples[0];
+        uint16_t max_code = hist.samples[0];
         for (int i = 0; i < sz; ++i) {
-            if (samples[i] < st.min_volts) st.min_volts = samples[i];
-            if (samples[i] > st.max_volts) st.max_volts = samples[i];
+            if (hist.samples[i] < min_code) min_code = hist.samples[i];
+            if (hist.samples[i] > max_code) max_code = hist.samples[i];
         }
-        st.dip_count = Dips_count(samples, avgs, sz, g_dip_cfg);
+        st.min_volts = ADC_rawToVolts(min_code);
+        st.max_volts = ADC_rawToVolts(max_code);
+        st.dip_count = DipDetector_pushBlock(&g_dip_detector, hist.samples, hist.avgs, sz);
     }
 
+    Sampler_releaseHistory(&hist);
+
     pthread_mutex_lock(&stats_lock);
     g_prev_stats = st;
     pthread_mutex_unlock(&stats_lock);
-
-    free(samples);
-    free(avgs);
 }
 
 // Status printing
@@ -145,19 +153,44 @@ static void handle_signal(int sig) {
 
 static void usage(const char *prog) {
     fprintf(stderr,
-        "Usage: %s [--trigger <V>] [--reset <V>]\n",
+        "Usage: %s [--trigger <V>] [--reset <V>] [--rate <Hz>] [--oversample <N>] [--realtime]\n"
+        "          [--adc spi|synth[:opts]|replay:<file>] [--record <file>] [--fast]\n"
+        "          [--metrics <port>] [--udp-batch <N>] [--no-rate-limit]\n",
         prog);
 }
 
 int main(int argc, char **argv) {
     double trigger_v = DEFAULT_DIP_THRESHOLD_TRIGGER;
     double reset_v   = DEFAULT_DIP_THRESHOLD_RESET;
+    Sampler_config_t sampler_cfg = Sampler_defaultConfig();
+    int metrics_port = 0;
 
     for (int i = 1; i < argc; ++i) {
         if (strcmp(argv[i], "--trigger") == 0 && i+1 < argc) {
             trigger_v = atof(argv[++i]);
         } else if (strcmp(argv[i], "--reset") == 0 && i+1 < argc) {
             reset_v = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--rate") == 0 && i+1 < argc) {
+            sampler_cfg.sampleRateHz = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--oversample") == 0 && i+1 < argc) {
+            sampler_cfg.oversample = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--adc") == 0 && i+1 < argc) {
+            if (ADC_setBackend(argv[++i]) != 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--record") == 0 && i+1 < argc) {
+            sampler_cfg.capturePath = argv[++i];
+        } else if (strcmp(argv[i], "--metrics") == 0 && i+1 < argc) {
+            metrics_port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--udp-batch") == 0 && i+1 < argc) {
+            UDP_setBatchSize(atoi(argv[++i]));    // for udp_loadgen runs
+        } else if (strcmp(argv[i], "--no-rate-limit") == 0) {
+            UDP_setRateLimiting(false);
+        } else if (strcmp(argv[i], "--fast") == 0) {
+            sampler_cfg.schedule = SAMPLER_SCHED_FREERUN;
+        } else if (strcmp(argv[i], "--realtime") == 0) {
+            sampler_cfg.realtime = true;
         } else if (strcmp(argv[i], "--help") == 0) {
             usage(argv[0]);
             return 0;
@@ -169,6 +202,7 @@ int main(int argc, char **argv) {
     }
 
     g_dip_cfg = DipConfig_make(trigger_v, reset_v);
+    DipDetector_init(&g_dip_detector, DipConfig_toRaw(g_dip_cfg));
 
     atomic_store(&blink_hz, DEFAULT_BLINK_HZ);
     atomic_store(&duty_percent, DEFAULT_DUTY_PERCENT);
@@ -178,8 +212,12 @@ int main(int argc, char **argv) {
     signal(SIGINT, handle_signal);
     signal(SIGTERM, handle_signal);
 
-    Sampler_init();
+    Period_init();  // before the sampler marks its first period
+    Sampler_init(&sampler_cfg);
     UDP_init(); // start UDP listener thread (port 12345)
+    if (metrics_port > 0) {
+        Metrics_init(metrics_port);
+    }
 
     pthread_t th_pwm;
     if (pthread_create(&th_pwm, NULL, pwm_thread_fn, NULL) != 0) {
@@ -204,8 +242,10 @@ int main(int argc, char **argv) {
     print_status_line();
 
     pthread_join(th_pwm, NULL);
+    Metrics_cleanup();
     UDP_cleanup();   // stop UDP thread and close socket
     Sampler_cleanup();
+    Period_cleanup();
     pthread_mutex_destroy(&stats_lock);
     printf("Exiting.\n");
     return 0;
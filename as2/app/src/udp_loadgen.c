@@ -0,0 +1,187 @@
+// udp_loadgen: how many commands per second the UDP listener answers.
+//
+// Several clients (a socket each, so each is its own session) keep a
+// number of commands in flight, sending another as each reply comes
+// back. A client that hears nothing for LOST_AFTER_MS counts what it had
+// in flight as lost and starts again, so shed or dropped datagrams don't
+// stall the run. Use a command with a one-datagram reply.
+//
+// The listener's rate limits cap a single address at UDP_SOURCE_RATE,
+// so run the server with them off, e.g. to compare unbatched and
+// batched I/O:
+//   light_sampler --adc synth --no-rate-limit --udp-batch 1
+//   light_sampler --adc synth --no-rate-limit          (batch of UDP_BATCH)
+//   udp_loadgen --clients 8 --inflight 16 --seconds 5
+// At the end it prints the server's "netstats" (packets per syscall).
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define DEFAULT_HOST     "127.0.0.1"
+#define DEFAULT_PORT     12345
+#define DEFAULT_CLIENTS  8
+#define DEFAULT_INFLIGHT 16
+#define DEFAULT_SECONDS  5
+#define DEFAULT_COMMAND  "count"
+#define MAX_CLIENTS      64
+#define LOST_AFTER_MS    200
+#define POLL_MS          10
+#define REPLY_SIZE       1500
+
+typedef struct {
+    int fd;
+    int inflight;
+    long long last_heard_ns;
+} client_t;
+
+static client_t clients[MAX_CLIENTS];
+static struct pollfd fds[MAX_CLIENTS];
+static long long num_sent = 0;
+static long long num_replies = 0;
+static long long num_lost = 0;
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int open_client(const struct sockaddr_in *server) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0 || connect(fd, (const struct sockaddr *)server, sizeof(*server)) < 0) {
+        perror("udp_loadgen: socket");
+        exit(1);
+    }
+    return fd;
+}
+
+// Send until the client has `inflight` commands outstanding (or its
+// socket is full: it tops up again on the next reply).
+static void top_up(client_t *c, const char *cmd, int inflight) {
+    size_t len = strlen(cmd);
+    while (c->inflight < inflight) {
+        if (send(c->fd, cmd, len, MSG_DONTWAIT) != (ssize_t)len) {
+            break;
+        }
+        c->inflight++;
+        num_sent++;
+    }
+}
+
+static void drain_replies(client_t *c, long long now) {
+    char buf[REPLY_SIZE];
+    while (recv(c->fd, buf, sizeof(buf), MSG_DONTWAIT) >= 0) {
+        num_replies++;
+        if (c->inflight > 0) {
+            c->inflight--;
+        }
+        c->last_heard_ns = now;
+    }
+}
+
+static void print_server_stats(const struct sockaddr_in *server) {
+    int fd = open_client(server);
+    char buf[REPLY_SIZE];
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    if (send(fd, "netstats", 8, 0) == 8 && poll(&pfd, 1, 500) == 1) {
+        ssize_t n = recv(fd, buf, sizeof(buf) - 1, 0);
+        if (n > 0) {
+            buf[n] = '\0';
+            printf("server:\n%s", buf);
+        }
+    } else {
+        printf("server: no reply to netstats\n");
+    }
+    close(fd);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [--host <ip>] [--port <p>] [--clients <N>] [--inflight <K>]\n"
+        "          [--seconds <S>] [--command <cmd>]\n",
+        prog);
+}
+
+int main(int argc, char **argv) {
+    const char *host = DEFAULT_HOST;
+    int port = DEFAULT_PORT;
+    int num_clients = DEFAULT_CLIENTS;
+    int inflight = DEFAULT_INFLIGHT;
+    double seconds = DEFAULT_SECONDS;
+    const char *cmd = DEFAULT_COMMAND;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--host") == 0 && i+1 < argc) {
+            host = argv[++i];
+        } else if (strcmp(argv[i], "--port") == 0 && i+1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--clients") == 0 && i+1 < argc) {
+            num_clients = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--inflight") == 0 && i+1 < argc) {
+            inflight = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seconds") == 0 && i+1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--command") == 0 && i+1 < argc) {
+            cmd = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    struct sockaddr_in server = { .sin_family = AF_INET, .sin_port = htons(port) };
+    if (num_clients < 1 || num_clients > MAX_CLIENTS || inflight < 1 || seconds <= 0
+        || inet_pton(AF_INET, host, &server.sin_addr) != 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    long long start = now_ns();
+    for (int i = 0; i < num_clients; i++) {
+        clients[i].fd = open_client(&server);
+        clients[i].last_heard_ns = start;
+        fds[i].fd = clients[i].fd;
+        fds[i].events = POLLIN;
+        top_up(&clients[i], cmd, inflight);
+    }
+
+    long long end = start + (long long)(seconds * 1e9);
+    long long now = start;
+    while (now < end) {
+        int ready = poll(fds, num_clients, POLL_MS);
+        if (ready < 0 && errno != EINTR) {
+            perror("udp_loadgen: poll");
+            return 1;
+        }
+        now = now_ns();
+        for (int i = 0; i < num_clients; i++) {
+            client_t *c = &clients[i];
+            if (fds[i].revents & POLLIN) {
+                drain_replies(c, now);
+            }
+            if (c->inflight > 0 && now - c->last_heard_ns > LOST_AFTER_MS * 1000000LL) {
+                num_lost += c->inflight;
+                c->inflight = 0;
+                c->last_heard_ns = now;
+            }
+            top_up(c, cmd, inflight);
+        }
+    }
+    double elapsed = (now - start) / 1e9;
+
+    printf("%d clients x %d in flight, '%s' for %.1f s:\n", num_clients, inflight, cmd, elapsed);
+    printf("  sent %lld, replies %lld, lost %lld\n", num_sent, num_replies, num_lost);
+    printf("  %.0f commands/s answered\n", num_replies / elapsed);
+    for (int i = 0; i < num_clients; i++) {
+        close(clients[i].fd);
+    }
+    print_server_stats(&server);
+    return 0;
+}
@@ -6,5 +6,14 @@
 int spi_init(const char *device, uint32_t speed_hz);
 int readADC(int fd, int channel, uint32_t speed_hz);
 
+// Largest batch readADCBatch() will issue as a single ioctl.
+#define SPI_MAX_BATCH 64
+
+// Read n MCP3208 conversions in one SPI_IOC_MESSAGE(n) ioctl, one
+// 3-byte transfer per entry of `channels` (repeat a channel to
+// oversample it). Raw 12-bit codes are stored in out[0..n-1].
+// Returns n, or -1 on error.
+int readADCBatch(int fd, const int *channels, int n, uint32_t speed_hz, uint16_t *out);
+
 #endif
 
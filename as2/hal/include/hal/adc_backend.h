@@ -0,0 +1,39 @@
+// adc_backend.h
+// Interface implemented by each source of ADC data. adc_hal.c forwards
+// ADC_* calls to the backend selected with ADC_setBackend().
+
+#ifndef _ADC_BACKEND_H_
+#define _ADC_BACKEND_H_
+
+#include <stdint.h>
+
+typedef struct {
+    const char *name;
+
+    // Open the source. `options` is the text after "name:" in the
+    // backend spec (empty string if none). Returns 0, or -1 on error.
+    int (*open)(const char *options);
+
+    // Read n conversions (n <= SPI_MAX_BATCH) and store raw 12-bit
+    // codes in out[0..n-1]. Returns n, or -1 on error.
+    int (*readBatch)(const int *channels, int n, uint16_t *out);
+
+    void (*close)(void);
+} ADC_backend_t;
+
+// MCP3208 on spidev. Options: device path (default /dev/spidev0.0).
+extern const ADC_backend_t ADC_spiBackend;
+
+// Synthetic light level. Options: comma separated key=value from
+//   dc=<V>      steady level (default 1.5)
+//   noise=<V>   uniform noise amplitude (default 0.01)
+//   depth=<V>   how far each dip drops (default 0.3)
+//   hz=<Hz>     dips per second; "pwm" follows PWM_getFrequency() (default)
+//   duty=<%>    share of each period spent dipped (default 50)
+extern const ADC_backend_t ADC_synthBackend;
+
+// Replays a capture file (hal/capture.h) or a plain file of
+// little-endian uint16 codes, looping at the end. Options: file path.
+extern const ADC_backend_t ADC_replayBackend;
+
+#endif
@@ -1,9 +1,35 @@
 #ifndef _ADC_HAL_H_
 #define _ADC_HAL_H_
 
+#include <stdint.h>
+
+// MCP3208: 12-bit codes against a 3.3V reference.
+#define ADC_MAX_CODE 4095
+#define ADC_VREF_VOLTS 3.3
+
+// Choose where samples come from, before ADC_init(). `spec` is
+// "name" or "name:options", e.g. "spi", "synth:dc=2.0,hz=25",
+// "replay:capture.raw" (see hal/adc_backend.h for the options).
+// If never called, ADC_init() uses $AS2_ADC, or "spi" if unset.
+// Returns 0, or -1 for an unknown backend.
+int ADC_setBackend(const char *spec);
+const char *ADC_getBackendName(void);
+
 void ADC_init(void);
 double ADC_read(int channel);
+// Read one raw 12-bit code. Returns -1 on error.
+int ADC_readRaw(int channel);
 void ADC_cleanup(void);
 
+// Read several conversions with a single SPI transaction (n <= SPI_MAX_BATCH).
+// Raw 12-bit codes are written to out[0..n-1]. Returns n, or -1 on error.
+int ADC_readRawBatch(const int *channels, int n, uint16_t *out);
+
+// Read n back-to-back conversions of one channel (for oversampling).
+int ADC_readRawRepeated(int channel, int n, uint16_t *out);
+
+// Convert a raw code (or an average of codes) to volts.
+double ADC_rawToVolts(double raw);
+
 #endif
 
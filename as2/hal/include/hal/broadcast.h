@@ -0,0 +1,41 @@
+// broadcast.h
+// Optional push of the reporter's per-second summary to many listeners
+// at once, so the board's work doesn't grow with the number of stations
+// watching it: one binary datagram a second (see "Per-second summary" in
+// hal/history_codec.h) sent to a multicast group, or to a short list of
+// unicast targets in a single sendmmsg() call.
+//
+// Targets are numeric "address:port" separated by commas, e.g.
+// "239.255.35.1:12346" (main() reads them from BROADCAST_ENV). Multicast
+// goes out with a TTL of 1, so it stays on the local network.
+
+#ifndef _BROADCAST_H_
+#define _BROADCAST_H_
+
+#include "hal/history_codec.h"
+#include <stdbool.h>
+
+#define BROADCAST_ENV "AS2_SUMMARY_TARGETS"
+#define BROADCAST_MAX_TARGETS 8
+
+// Parse `targets` and open the sending socket. Returns 0, or -1 (with a
+// message on stderr) if a target is malformed or the socket fails.
+int Broadcast_init(const char *targets);
+void Broadcast_cleanup(void);
+
+// True between a successful Broadcast_init() and Broadcast_cleanup().
+bool Broadcast_isActive(void);
+
+// Send one summary to every target. Sets pSummary->seq. Never blocks: a
+// datagram the socket can't take is counted as a failure and dropped.
+void Broadcast_sendSummary(History_summary_t *pSummary);
+
+typedef struct {
+    int targets;
+    long long summariesSent;
+    long long sendFailures;     // target datagrams not sent
+} Broadcast_stats_t;
+
+void Broadcast_getStats(Broadcast_stats_t *pStats);
+
+#endif
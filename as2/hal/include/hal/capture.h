@@ -0,0 +1,61 @@
+// capture.h
+// Compact binary recording of raw sample streams, so what the sampler
+// saw can be replayed later (see the "replay" ADC backend).
+//
+// File layout (little-endian):
+//   Capture_header_t
+//   Capture_blockHeader_t + blockSamples uint16 codes   (repeated)
+// Every block reserves room for blockSamples codes; only the last one
+// may be partly filled (its `count` says how many are valid). Each
+// block carries the CLOCK_MONOTONIC time of its first sample.
+//
+// The writer appends through a memory-mapped file that grows in large
+// steps, so writing a sample is a couple of stores (no syscalls).
+
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <stdint.h>
+
+#define CAPTURE_MAGIC "AS2CAP1"
+#define CAPTURE_VERSION 1
+#define CAPTURE_BLOCK_SAMPLES 1024
+
+typedef struct {
+    char magic[8];              // CAPTURE_MAGIC, NUL padded
+    uint32_t version;
+    uint32_t sampleRateHz;
+    uint64_t startTimeNs;       // CLOCK_MONOTONIC
+    uint32_t blockSamples;
+    uint32_t reserved;
+} Capture_header_t;
+
+typedef struct {
+    uint64_t timestampNs;       // CLOCK_MONOTONIC time of the first sample
+    uint32_t count;             // valid samples in this block
+    uint32_t reserved;
+} Capture_blockHeader_t;
+
+typedef struct Capture_writer Capture_writer_t;
+typedef struct Capture_reader Capture_reader_t;
+
+// Create (truncate) a capture file. Returns NULL on error.
+Capture_writer_t *Capture_openWriter(const char *path, int sampleRateHz);
+// Append one sample. Not thread-safe: call from one thread only.
+void Capture_writeSample(Capture_writer_t *pWriter, uint16_t code);
+// Trim the file to the samples written and close it.
+void Capture_closeWriter(Capture_writer_t *pWriter);
+
+// Open a capture file for reading. Returns NULL if it is not a capture.
+Capture_reader_t *Capture_openReader(const char *path);
+const Capture_header_t *Capture_getHeader(const Capture_reader_t *pReader);
+// Copy up to `max` samples into `out`. If pTimestampNs is not NULL, it
+// receives the time of the first copied sample. Returns the number of
+// samples copied (0 at end of file). A block the file ends partway
+// through, short of its count, is left out: reading stops before it.
+int Capture_read(Capture_reader_t *pReader, uint16_t *out, int max, uint64_t *pTimestampNs);
+// Start reading from the first sample again.
+void Capture_rewind(Capture_reader_t *pReader);
+void Capture_closeReader(Capture_reader_t *pReader);
+
+#endif
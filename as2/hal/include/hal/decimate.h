@@ -0,0 +1,38 @@
+// decimate.h
+// Downsampling of raw sample series for plotting, so a client that only
+// draws a few hundred points doesn't have to fetch every sample.
+//
+// The input is a list of segments read as one series (e.g. several
+// retained seconds back to back), so nothing has to be copied first.
+// Both methods are a single O(n) pass over the samples.
+
+#ifndef _DECIMATE_H_
+#define _DECIMATE_H_
+
+#include <stdint.h>
+
+typedef struct {
+    const uint16_t *samples;
+    int count;
+} Decimate_segment_t;
+
+// Total number of samples in the segments.
+long long Decimate_countSamples(const Decimate_segment_t *segs, int numSegs);
+
+// Min/max envelope: split the series into `buckets` equal runs (bucket b
+// covers samples [b*n/buckets, (b+1)*n/buckets)) and write each run's
+// smallest and largest sample. Returns the number of buckets written,
+// which is fewer than asked for if there are fewer samples.
+int Decimate_minMax(const Decimate_segment_t *segs, int numSegs, int buckets,
+                    uint16_t *mins, uint16_t *maxs);
+
+// Largest-Triangle-Three-Buckets: pick `points` samples (at least 3)
+// that keep the shape of the series: the first and last samples, and
+// from each bucket between them the one forming the largest triangle
+// with the previous pick and the next bucket's average. Writes each
+// pick's index within the series and its value. Returns the number of
+// points written (every sample, if there are no more than `points`).
+int Decimate_lttb(const Decimate_segment_t *segs, int numSegs, int points,
+                  uint32_t *indices, uint16_t *values);
+
+#endif
@@ -1,6 +1,9 @@
 #ifndef _DIPS_H_
 #define _DIPS_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+
 // Configuration for dip detection hysteresis:
 // trigger_drop_volts: magnitude below average required to trigger a dip (e.g. 0.10)
 // reset_drop_volts: magnitude below average which must be recovered to (e.g. 0.07)
@@ -26,4 +29,49 @@ static inline DipConfig DipConfig_make(double trigger_drop, double reset_drop)
 // Returns the number of dip events detected.
 int Dips_count(const double *samples, const double *avgs, int n, DipConfig cfg);
 
-#endif
\ No newline at end of file
+// Fixed-point form of DipConfig, for raw ADC data.
+// Samples are 12-bit codes; averages and thresholds are Q4 codes
+// (code * 16), which still fit in 16 bits.
+#define DIPS_Q4_SHIFT 4
+
+typedef struct {
+    uint16_t trigger_q4;
+    uint16_t reset_q4;
+} DipConfigRaw;
+
+// Convert a DipConfig in volts to Q4 codes (MCP3208, 3.3V reference).
+DipConfigRaw DipConfig_toRaw(DipConfig cfg);
+
+// Count dips over raw data, with the same hysteresis as Dips_count():
+// a dip triggers when (sample << 4) <= avg_q4 - trigger_q4, and re-arms
+// once (sample << 4) >= avg_q4 - reset_q4.
+// Uses NEON (aarch64) or AVX2/SSE2 (x86) when the build targets them.
+int Dips_countRaw(const uint16_t *samples, const uint16_t *avgs_q4, int n, DipConfigRaw cfg);
+
+// Plain scalar version of Dips_countRaw(), kept as the reference.
+int Dips_countRawScalar(const uint16_t *samples, const uint16_t *avgs_q4, int n, DipConfigRaw cfg);
+
+// Streaming dip detector over raw data (same thresholds as Dips_countRaw).
+// Unlike Dips_count*(), the hysteresis state persists between calls, so a
+// dip that straddles two windows (e.g. two seconds) is counted once, in
+// the window where it started. Feed every sample exactly once, either one
+// at a time or in blocks. Not thread-safe: use one detector per thread.
+typedef struct {
+    DipConfigRaw cfg;
+    bool armed;             // true: waiting for a dip; false: waiting for reset
+    long long totalDips;    // since DipDetector_init()
+    int windowDips;         // since the last DipDetector_takeWindow()
+} DipDetector;
+
+void DipDetector_init(DipDetector *pDet, DipConfigRaw cfg);
+
+// Feed one sample. Returns true if it starts a new dip.
+bool DipDetector_push(DipDetector *pDet, uint16_t sample, uint16_t avg_q4);
+
+// Feed n consecutive samples. Returns the number of dips they started.
+int DipDetector_pushBlock(DipDetector *pDet, const uint16_t *samples, const uint16_t *avgs_q4, int n);
+
+// Return the dips counted since the previous call, and start a new window.
+int DipDetector_takeWindow(DipDetector *pDet);
+
+#endif
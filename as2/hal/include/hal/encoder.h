@@ -5,10 +5,12 @@
 extern "C" {
 #endif
 
-// Initialize the encoder hardware and start the polling thread
+// Initialize the encoder hardware and start watching its edge events
+// (on the event loop if EventLoop_init() has been called, otherwise on
+// a thread)
 void Encoder_init(void);
 
-// Stop polling and clean up the encoder hardware
+// Stop watching and clean up the encoder hardware
 void Encoder_cleanup(void);
 
 // Set a callback function that will be called with each encoder delta
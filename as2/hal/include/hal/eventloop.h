@@ -0,0 +1,56 @@
+// eventloop.h
+// Single-threaded event loop (epoll) for everything except ADC sampling.
+//
+// Modules that would otherwise each run a thread (UDP listener, push
+// subscriptions, reporter, rotary encoder) register their file
+// descriptors here instead, if EventLoop_init() was called before their
+// own init function. Without it they keep their own threads, so programs
+// that don't want a loop (e.g. light_sampler) need no changes.
+//
+// Periodic work uses timerfds, signals arrive through a signalfd, and
+// EventLoop_stop() wakes the loop through an eventfd, so shutdown never
+// waits on a blocked read or a long sleep.
+//
+// Handlers run on the thread that calls EventLoop_run(), one at a time,
+// and must not block.
+
+#ifndef _EVENTLOOP_H_
+#define _EVENTLOOP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define EVENTLOOP_MAX_WATCHES 16
+
+typedef void (*EventLoop_handler_t)(void *arg);
+
+// Create the loop. Call first thing in main(): signals registered with
+// EventLoop_onSignal() must be blocked before any other thread starts.
+void EventLoop_init(void);
+void EventLoop_cleanup(void);
+
+// True between EventLoop_init() and EventLoop_cleanup().
+bool EventLoop_isActive(void);
+
+// Call `handler` whenever `fd` is readable. Returns 0, or -1 on error.
+int EventLoop_addFd(int fd, EventLoop_handler_t handler, void *arg);
+void EventLoop_removeFd(int fd);
+
+// Call `handler` every `periodNs` (first call one period from now).
+// Returns the timer's id (a timerfd) for EventLoop_removeTimer(), or -1.
+// Missed expirations are coalesced into one call.
+int EventLoop_addTimer(long long periodNs, EventLoop_handler_t handler, void *arg);
+void EventLoop_removeTimer(int timerId);
+
+// Call `handler` when signal `signo` arrives (instead of any signal
+// handler). Must be called from main() before other threads start.
+int EventLoop_onSignal(int signo, EventLoop_handler_t handler, void *arg);
+
+// Dispatch events until EventLoop_stop() is called.
+void EventLoop_run(void);
+
+// Make EventLoop_run() return after the handler it is running (if any).
+// Safe to call from any thread, or from a signal handler.
+void EventLoop_stop(void);
+
+#endif
@@ -0,0 +1,41 @@
+// histogram.h
+// Fixed-size log-linear histogram (in the style of HdrHistogram) for
+// latencies and periods, so percentiles can be read without keeping the
+// values: every power of two is split into HISTOGRAM_SUB_BUCKETS equal
+// buckets, which bounds the error of any reported value to about 3%
+// while the memory stays the same at any event rate.
+//
+// Histograms of different windows merge by adding counts, so a per
+// second histogram can be rolled up into longer ones.
+
+#ifndef _HISTOGRAM_H_
+#define _HISTOGRAM_H_
+
+#include <stdint.h>
+
+#define HISTOGRAM_SUB_BITS 5
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_MAX_BITS 40       // larger values count as 2^40 - 1 (ns: about 18 minutes)
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct {
+    uint64_t total;
+    long long min;              // exact, valid when total > 0
+    long long max;
+    uint64_t counts[HISTOGRAM_BUCKETS];
+} Histogram_t;
+
+void Histogram_clear(Histogram_t *pHist);
+
+// Count one value (negative values count as 0).
+void Histogram_record(Histogram_t *pHist, long long value);
+
+// Add the counts of `pFrom` to `pInto`.
+void Histogram_merge(Histogram_t *pInto, const Histogram_t *pFrom);
+
+// The value below which `percent` (0..100) of the recorded values fall:
+// the top of the bucket holding that rank, kept within [min, max].
+// 0 if nothing has been recorded.
+long long Histogram_percentile(const Histogram_t *pHist, double percent);
+
+#endif
@@ -0,0 +1,184 @@
+// history_codec.h
+// Wire formats for sending a second of samples over UDP in pieces that
+// each fit in one datagram.
+//
+// Text: lines of comma separated volts (10 per line); a datagram always
+// ends on a line break, so no value is ever split.
+//
+// Binary (protocol version 2), little-endian, one header per datagram:
+//   off size
+//    0  4   magic "AS2H"
+//    4  1   version (2)
+//    5  1   encoding: 0 = raw uint16 codes, 1 = zigzag delta varints
+//    6  2   seq: datagram number within this reply, from 0
+//    8  2   flags: bit 0 set on the last datagram of the reply
+//   10  2   reserved (0)
+//   12  4   reply id: the same for every datagram of one reply (the
+//           number of the second sent, see Sampler_acquireSecond())
+//   16  4   sample rate (Hz)
+//   20  4   index (within the second) of this datagram's first sample
+//   24  4   samples in this datagram
+//   28  4   samples in the whole second
+//   32  8   CLOCK_MONOTONIC time of the second's first sample (ns)
+//   40  ... payload
+// Delta payloads restart in every datagram (the first value is the code
+// itself), so each datagram decodes on its own even if others are lost.
+//
+// Streamed samples (`subscribe samples`), little-endian:
+//   off size
+//    0  4   magic "AS2S"
+//    4  1   version (1)
+//    5  1   encoding: always 1 (zigzag delta varints, as above)
+//    6  2   reserved (0)
+//    8  4   seq: per subscription, +1 for every datagram sent
+//   12  4   samples this subscriber has lost so far (fell behind / send failed)
+//   16  8   sample number of the first sample (counts from sampler start)
+//   24  4   samples in this datagram
+//   28  4   sample rate (Hz)
+//   32  ... payload
+// A gap in seq means datagrams were lost in the network; a gap in sample
+// numbers that the dropped count explains was lost on the board.
+//
+// Plot (`plot ... v2`, see hal/decimate.h), always one datagram, little-endian:
+//   off size
+//    0  4   magic "AS2P"
+//    4  1   version (1)
+//    5  1   method: 0 = min/max per bucket, 1 = LTTB
+//    6  2   points in the payload
+//    8  4   number of the first second covered
+//   12  4   seconds covered
+//   16  4   samples covered (n)
+//   20  4   sample rate (Hz)
+//   24  8   CLOCK_MONOTONIC time of the first sample (ns)
+//   32  ... payload: min/max - uint16 min, uint16 max per bucket (bucket
+//           b covers samples [b*n/points, (b+1)*n/points)); LTTB - uint32
+//           sample index (from the first sample covered), uint16 code
+//
+// Per-second summary (see hal/broadcast.h), one datagram, little-endian:
+//   off size
+//    0  4   magic "AS2M"
+//    4  1   version (1)
+//    5  1   reserved (0)
+//    6  2   datagram size (newer versions may append fields)
+//    8  4   seq: +1 for every summary sent
+//   12  4   number of the second summarised (see Sampler_acquireSecond())
+//   16  8   CLOCK_MONOTONIC time of the second's first sample (ns)
+//   24  4   samples in the second
+//   28  4   PWM frequency (Hz)
+//   32  4   average light level (microvolts)
+//   36  4   dips
+//   40  4   min / 44 max / 48 avg sample period (microseconds)
+//   52  4   sampler overruns since start
+
+#ifndef _HISTORY_CODEC_H_
+#define _HISTORY_CODEC_H_
+
+#include <stdint.h>
+
+#define HISTORY_V2_MAGIC "AS2H"
+#define HISTORY_V2_VERSION 2
+#define HISTORY_V2_HEADER_SIZE 40
+#define HISTORY_V2_FLAG_LAST 0x01
+
+#define HISTORY_STREAM_MAGIC "AS2S"
+#define HISTORY_STREAM_VERSION 1
+#define HISTORY_STREAM_HEADER_SIZE 32
+
+#define HISTORY_PLOT_MAGIC "AS2P"
+#define HISTORY_PLOT_VERSION 1
+#define HISTORY_PLOT_HEADER_SIZE 32
+
+#define HISTORY_SUMMARY_MAGIC "AS2M"
+#define HISTORY_SUMMARY_VERSION 1
+#define HISTORY_SUMMARY_SIZE 56
+
+// Payload size that stays under a 1500 byte Ethernet MTU after IP/UDP headers.
+#define HISTORY_MAX_DATAGRAM 1400
+
+typedef enum {
+    HISTORY_ENC_RAW = 0,
+    HISTORY_ENC_DELTA = 1,
+} History_encoding_t;
+
+// What is being sent: one second of samples.
+typedef struct {
+    const uint16_t *samples;
+    int totalSamples;
+    uint32_t sampleRateHz;
+    uint64_t startTimeNs;
+    uint32_t replyId;
+    History_encoding_t encoding;
+} History_reply_t;
+
+// Encode samples [first, ...) into one binary datagram of at most `cap`
+// bytes. Returns the datagram size and sets *pConsumed to the number of
+// samples it holds; call again from first + *pConsumed with seq + 1
+// until first reaches totalSamples.
+int History_encodeDatagram(const History_reply_t *pReply, uint16_t seq, int first,
+                           uint8_t *out, int cap, int *pConsumed);
+
+// One datagram of a sample stream.
+typedef struct {
+    uint32_t seq;
+    uint32_t dropped;
+    uint64_t firstSample;
+    uint32_t sampleRateHz;
+} History_stream_t;
+
+// Encode samples[0..n) into one stream datagram of at most `cap` bytes.
+// Returns the datagram size and sets *pConsumed to the samples it holds.
+int History_encodeStreamDatagram(const History_stream_t *pStream, const uint16_t *samples,
+                                 int n, uint8_t *out, int cap, int *pConsumed);
+
+typedef enum {
+    HISTORY_PLOT_MINMAX = 0,
+    HISTORY_PLOT_LTTB = 1,
+} History_plotMethod_t;
+
+// Points that fit in one plot datagram.
+#define HISTORY_PLOT_MAX_MINMAX ((HISTORY_MAX_DATAGRAM - HISTORY_PLOT_HEADER_SIZE) / 4)
+#define HISTORY_PLOT_MAX_LTTB ((HISTORY_MAX_DATAGRAM - HISTORY_PLOT_HEADER_SIZE) / 6)
+
+// A decimated series: mins/maxs for min/max, indices/values for LTTB.
+typedef struct {
+    History_plotMethod_t method;
+    int points;
+    const uint16_t *mins;
+    const uint16_t *maxs;
+    const uint32_t *indices;
+    const uint16_t *values;
+    uint32_t firstSecond;
+    uint32_t seconds;
+    uint32_t totalSamples;
+    uint32_t sampleRateHz;
+    uint64_t startTimeNs;
+} History_plot_t;
+
+// Encode a plot into one datagram (`out` must hold HISTORY_MAX_DATAGRAM
+// bytes; points beyond the method's maximum are left out). Returns its size.
+int History_encodePlot(const History_plot_t *pPlot, uint8_t *out);
+
+// The reporter's once a second summary.
+typedef struct {
+    uint32_t seq;
+    uint32_t second;
+    uint64_t startTimeNs;
+    uint32_t samples;
+    uint32_t pwmFrequencyHz;
+    uint32_t averageMicrovolts;
+    uint32_t dips;
+    uint32_t minPeriodUs;
+    uint32_t maxPeriodUs;
+    uint32_t avgPeriodUs;
+    uint32_t overruns;
+} History_summary_t;
+
+// Encode a summary into `out` (HISTORY_SUMMARY_SIZE bytes). Returns its size.
+int History_encodeSummary(const History_summary_t *pSummary, uint8_t *out);
+
+// Format samples [first, ...) as text lines into `out` (NUL terminated,
+// at most `cap` bytes). Returns the length and sets *pConsumed.
+int History_formatText(const uint16_t *samples, int totalSamples, int first,
+                       char *out, int cap, int *pConsumed);
+
+#endif
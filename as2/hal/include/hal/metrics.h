@@ -0,0 +1,24 @@
+// metrics.h
+// Optional HTTP endpoint serving GET /metrics in the Prometheus text
+// exposition format: sampler totals and rates, dips, the average light
+// level, period timer statistics, and UDP/subscription counters.
+//
+// Everything is read from lock-free state or copied snapshots, so a
+// scrape never holds up the sampling thread. Runs on the event loop if
+// EventLoop_init() has been called, otherwise on its own thread.
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#define METRICS_ENV "AS2_METRICS_PORT"     // main(): serve on this TCP port, if set
+#define METRICS_MAX_CLIENTS 4
+
+// Start serving on `port` (all interfaces). Returns 0, or -1 on error.
+int Metrics_init(int port);
+void Metrics_cleanup(void);
+
+// Format the current metrics into `buf` (at most `cap` bytes, NUL
+// terminated). Returns the length.
+int Metrics_format(char *buf, int cap);
+
+#endif
@@ -14,10 +14,36 @@
 //     data collected for this event (but not others).
 //     For example, call this function once a second to get timing
 //     information to print to the screen.
+//
+// Recording modes (Period_setRecordingMode()):
+//  - PERIOD_RECORD_STREAMING (default): each mark folds the period since
+//    the same thread's previous mark straight into that thread's running
+//    statistics (min/max/sum, Welford mean/variance, histogram). Nothing
+//    is buffered, so any event rate works in constant memory, and a read
+//    only merges the threads' statistics. Marks never block or print.
+//  - PERIOD_RECORD_LOCKFREE: each thread stores timestamps in its own
+//    lock-free ring per event; a read merges them in time order, so
+//    periods span marks made by different threads.
+//  - PERIOD_RECORD_LOCKED: the original single buffer per event behind
+//    a mutex.
+// Timestamps that don't fit a buffer are counted (numDropped).
+// Marks are timed with Timestamp_nowNs() (hal/timestamp.h), which reads
+// the CPU counter rather than calling clock_gettime().
+//
+// Besides min/max/avg, the periods go into a histogram (see
+// hal/histogram.h) for percentiles, and the periods longer than the
+// event's deadline, if one is set, are counted.
 
-// Maximum number of timestamps to record for a given event.
+// Maximum number of timestamps to record for a given event (per thread,
+// when recording to rings) between reads. A power of two.
 #define MAX_EVENT_TIMESTAMPS (1024*4)
 
+#include "hal/histogram.h"
+
+// Threads that can record at once (streaming or rings); marks from any
+// more are dropped.
+#define PERIOD_MAX_THREADS 8
+
 enum Period_whichEvent {
     PERIOD_EVENT_SAMPLE_LIGHT,
     PERIOD_EVENT_MARK_SECOND,
@@ -29,12 +55,31 @@ typedef struct {
     double minPeriodInMs;
     double maxPeriodInMs;
     double avgPeriodInMs;
+    double stdDevPeriodInMs;
+    double p50PeriodInMs;       // percentiles, to within about 3%
+    double p90PeriodInMs;
+    double p99PeriodInMs;
+    double p999PeriodInMs;
+    int numDeadlineMisses;      // periods longer than the deadline (0 if none set)
+    long long numDropped;       // marks lost because a buffer was full
 } Period_statistics_t;
 
+typedef enum {
+    PERIOD_RECORD_STREAMING,    // per-thread running statistics (default)
+    PERIOD_RECORD_LOCKFREE,     // per-thread timestamp rings
+    PERIOD_RECORD_LOCKED,       // one buffer per event, behind a mutex
+} Period_recordingMode_t;
+
+// Short name of an event, e.g. "sample_light", for reports.
+const char *Period_getEventName(enum Period_whichEvent whichEvent);
+
 // Initialize/cleanup the module's data structures.
 void Period_init(void);
 void Period_cleanup(void);
 
+// Choose how marks are recorded. Call before Period_init().
+void Period_setRecordingMode(Period_recordingMode_t mode);
+
 // Record the current time as a timestamp for the 
 // indicated event. This allows later calls to 
 // Period_getStatisticsAndClear() to access these timestamps
@@ -51,4 +96,26 @@ void Period_getStatisticsAndClear(
     Period_statistics_t *pStats
 );
 
+// Count periods of `whichEvent` longer than `deadlineInMs` as deadline
+// misses (0, the default, turns counting off). Any thread.
+void Period_setDeadline(enum Period_whichEvent whichEvent, double deadlineInMs);
+
+// Copy the period histogram (in ns) of the last reporting interval
+// and/or the one merged over every interval since Period_init(). Either
+// pointer may be NULL. Merge them further with Histogram_merge().
+void Period_getHistograms(
+    enum Period_whichEvent whichEvent,
+    Histogram_t *pLastInterval,
+    Histogram_t *pSinceStart
+);
+
+// Get a copy of the statistics returned by the most recent call to
+// Period_getStatisticsAndClear() for `whichEvent` (all zero if none),
+// without clearing anything. For observers such as the metrics
+// endpoint, so they don't steal data from the code that owns the event.
+void Period_getLastStatistics(
+    enum Period_whichEvent whichEvent,
+    Period_statistics_t *pStats
+);
+
 #endif
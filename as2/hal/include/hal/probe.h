@@ -0,0 +1,61 @@
+// probe.h
+// Named timing probes, to see where the milliseconds go on the board.
+//
+// A probe is registered by name at run time and then marks either point
+// events (Probe_mark) or spans (Probe_begin ... Probe_end, nested
+// properly within a thread). Every thread records into its own ring of
+// the last PROBE_RING_RECORDS records, overwriting the oldest, so
+// recording is a counter read (hal/timestamp.h) and two stores, never
+// blocks, and costs nothing to keep running.
+//
+// Probe_writeChromeTrace() dumps the last few seconds from every thread
+// as Chrome trace JSON, for chrome://tracing or https://ui.perfetto.dev.
+// Probe_startChromeTrace() does the same on a worker thread, so an event
+// loop handler can ask for a dump without waiting for it.
+//
+// The program runs as root, so the trace goes in a directory only it can
+// write (PROBE_TRACE_DIR, created mode 0700): it is written to a
+// temporary file there, opened without following symlinks, and renamed
+// over the trace when complete.
+
+#ifndef _PROBE_H_
+#define _PROBE_H_
+
+#define PROBE_MAX 32
+#define PROBE_MAX_NAME 32
+#define PROBE_MAX_THREADS 8         // recording threads kept; more reuse exited ones
+#define PROBE_RING_RECORDS (1 << 16)        // per thread: ~10 s of the sampler at 1 kHz
+#define PROBE_TRACE_DIR "/run/as2"
+#define PROBE_TRACE_PATH PROBE_TRACE_DIR "/trace.json"
+
+// Get the id of the probe called `name`, registering it if it's new.
+// Returns -1 if PROBE_MAX probes already exist. Any thread.
+int Probe_register(const char *name);
+
+// Record on the calling thread. An id of -1 is ignored, so a failed
+// registration only loses that probe.
+void Probe_begin(int id);
+void Probe_end(int id);
+void Probe_mark(int id);
+
+// Write the records of the last `seconds` to `path` as Chrome trace
+// JSON. The directory of `path` is created if need be, and must be owned
+// by this user and writable by no one else. Returns the number of events
+// written, or -1 (perror) if the file can't be written. Takes a while
+// for a large trace: call it from a worker, not a time-critical path.
+long Probe_writeChromeTrace(const char *path, double seconds);
+
+// Called on the worker thread when a dump is done, with the result of
+// Probe_writeChromeTrace().
+typedef void (*Probe_traceDone_t)(long events, void *arg);
+
+// Write the trace on a worker thread, then call `done` (if not NULL).
+// Returns 0, or -1 if a dump is already being written (or the worker
+// can't be started). `path` must stay valid until `done` is called.
+int Probe_startChromeTrace(const char *path, double seconds, Probe_traceDone_t done, void *arg);
+
+// Wait for the dump being written (if any) to finish. Call before
+// cleaning up anything its `done` callback uses.
+void Probe_waitChromeTrace(void);
+
+#endif
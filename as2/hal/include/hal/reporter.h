@@ -1,10 +1,11 @@
 #ifndef REPORTER_H
 #define REPORTER_H
 
-// Start the reporting thread
+// Start reporting once a second (a timer on the event loop if
+// EventLoop_init() has been called, otherwise a thread)
 void Reporter_start(void);
 
-// Stop the reporting thread
+// Stop reporting
 void Reporter_stop(void);
 
 // Set the current PWM frequency (for printing)
@@ -35,6 +35,12 @@ void re_stop(re_encoder *enc);
 void re_destroy(re_encoder *enc);
 int32_t re_get_position(re_encoder *enc);
 
+// Instead of re_start()'s thread: watch re_get_fd() for readability
+// (e.g. on the event loop) and call re_process_events() each time.
+// re_process_events() returns the number of edges handled, or -1.
+int  re_get_fd(re_encoder *enc);
+int  re_process_events(re_encoder *enc);
+
 #ifdef __cplusplus
 }
 #endif
@@ -13,38 +13,154 @@
 #ifndef _SAMPLER_H_
 #define _SAMPLER_H_
 #include <stdbool.h>
+#include <stdint.h>
+
+#define SAMPLER_DEFAULT_RATE_HZ 1000
+#define SAMPLER_DEFAULT_RT_PRIORITY 50
+#define SAMPLER_DEFAULT_HISTORY_SECONDS 10
+
+// Most memory the retained history may use (samples and averages, plus
+// the spare buffers). historySeconds is reduced to fit: at 1 kHz a
+// second takes 5 KB, so 8 MB holds a long history even at high rates.
+#define SAMPLER_HISTORY_BUDGET_BYTES (8 * 1024 * 1024)
+
+// How the sampling thread paces itself.
+//  SLEEP:    sleep one period after each read (period + read time + latency).
+//  DEADLINE: sleep to absolute CLOCK_MONOTONIC deadlines, so the rate
+//            does not drift; periods missed entirely count as overruns.
+//  FREERUN:  never sleep; for replaying captures as fast as possible.
+typedef enum {
+    SAMPLER_SCHED_SLEEP,
+    SAMPLER_SCHED_DEADLINE,
+    SAMPLER_SCHED_FREERUN,
+} Sampler_schedule_t;
+
+typedef struct {
+    int sampleRateHz;           // e.g. 1000, 2000, 5000
+    Sampler_schedule_t schedule;
+    bool realtime;              // SCHED_FIFO + mlockall (needs root/CAP_SYS_NICE)
+    int realtimePriority;       // SCHED_FIFO priority, 1..99
+    int oversample;             // conversions averaged per sample (1..SPI_MAX_BATCH),
+                                // read in one SPI transaction
+    const char *capturePath;    // record every sample here (see hal/capture.h), or NULL
+    int historySeconds;         // completed seconds kept for queries
+} Sampler_config_t;
+
+// 1 kHz, deadline scheduling, no realtime priority, no oversampling,
+// no recording, 10 s of history.
+Sampler_config_t Sampler_defaultConfig(void);
 
 // Begin/end the background thread which samples light levels.
-void Sampler_init(void);
+// pConfig may be NULL to use Sampler_defaultConfig().
+void Sampler_init(const Sampler_config_t *pConfig);
 void Sampler_cleanup(void);
 
 // Must be called once every 1s.
 // Moves the samples that it has been collecting this second into
 // the history, which makes the samples available for reads (below).
+// The oldest retained second is dropped once historySeconds are held.
 void Sampler_moveCurrentDataToHistory(void);
 
 // Get the number of samples collected during the previous complete
 // second.
 int Sampler_getHistorySize(void);
 
-// Get a copy of the samples in the sample history.
+// Read-only view of the previous complete second, borrowed from the
+// sampler without copying. Samples are raw 12-bit ADC codes; convert
+// with ADC_rawToVolts() when presenting them. avgs[i] is the running
+// average (Q4 code, i.e. code * 16) captured with samples[i], so the
+// pair can be fed straight to DipDetector_pushBlock()/Dips_countRaw().
+// `slot` is internal.
+typedef struct {
+    const uint16_t *samples;
+    const uint16_t *avgs;
+    int size;
+    int dips;
+    long long startTimeNs;      // CLOCK_MONOTONIC time of samples[0]
+    long long second;           // which second this is (see below)
+    int slot;
+} Sampler_historyView_t;
+
+// Borrow the current history (the newest completed second). The samples
+// stay valid (and unchanged) until Sampler_releaseHistory() is called,
+// even across rollovers. Keep views short-lived: each one pins a
+// history buffer.
+void Sampler_acquireHistory(Sampler_historyView_t *pView);
+void Sampler_releaseHistory(Sampler_historyView_t *pView);
+
+// Older seconds. Completed seconds are numbered from 0 at the first
+// rollover; the numbers make resumable cursors for clients. The range
+// retained is [*pOldest, *pNewest] (*pNewest is -1 before the first
+// rollover). Sampler_acquireSecond() returns false (and an empty view)
+// if `second` is not retained; release the view either way.
+void Sampler_getRetainedSeconds(long long *pOldest, long long *pNewest);
+bool Sampler_acquireSecond(long long second, Sampler_historyView_t *pView);
+
+// The retained second holding CLOCK_MONOTONIC time `timeNs` (or the
+// oldest retained one if it is older still); newest + 1 if it is newer
+// than everything retained, -1 if nothing is.
+long long Sampler_findSecond(long long timeNs);
+
+// Get a copy of the samples in the sample history, in volts.
 // Returns a newly allocated array and sets 'size' to be the number
 // of elements in the returned array (output-only parameter).
 // The calling code must call free() on the returned pointer.
 // Note: It provides both data and size to ensure consistency.
+// Prefer Sampler_acquireHistory(), which avoids the copy.
 double* Sampler_getHistory(int * size);
 
-// Get the average light level (not tied to the history).
+// Get the average light level in volts (not tied to the history).
+// None of the getters block the sampling thread: it publishes its state
+// through a lock-free ring and seqlock-protected snapshots.
 double Sampler_getAverageReading(void);
 
 // Get the total number of light level samples taken so far.
 long long Sampler_getNumSamplesTaken(void);
 
+// Get the number of sample periods missed entirely (deadline mode only).
+long long Sampler_getNumOverruns(void);
+
+// Get the number of samples left out of the history because the current
+// second's buffer (rate + 25%) was full, i.e. the rollover came late.
+// They still reach the live stream (Sampler_readLiveSamples()).
+long long Sampler_getNumSamplesDiscarded(void);
+
+// Get the number of completed seconds that never reached the history
+// because readers still held every spare buffer, and the dips detected
+// in them. Those dips are in the dip totals (Sampler_getDipEventHead())
+// but in no second's count.
+long long Sampler_getNumSecondsDropped(void);
+long long Sampler_getNumDipsDropped(void);
+
+// Get the configured sample rate.
+int Sampler_getSampleRateHz(void);
+
+// Live streaming, for readers that want every sample rather than one
+// second at a time. Each reader owns a cursor (a sample number; start
+// from Sampler_getLiveHead()). Reads copy up to `max` samples from the
+// cursor on and advance it; samples the sampler overwrote before the
+// reader got to them (it keeps about two seconds) are skipped and added
+// to *pDropped. Returns the number of samples copied. Never blocks.
+int Sampler_readLiveSamples(long long *pNext, uint16_t *out, int max, long long *pDropped);
+long long Sampler_getLiveHead(void);
+
+// A dip, as it was detected (sampleNumber counts from the first sample).
+typedef struct {
+    long long sampleNumber;
+    long long timeNs;           // CLOCK_MONOTONIC
+} Sampler_dipEvent_t;
+
+// Same pattern, for dip events (the last 256 are kept).
+int Sampler_readDipEvents(long long *pNext, Sampler_dipEvent_t *out, int max, long long *pDropped);
+long long Sampler_getDipEventHead(void);
+
+// Program-wide stop flag (set by e.g. the UDP "stop" command).
 void request_program_stop(void);
 bool is_stop_requested(void);
 
 void Sampler_sampleBuffer(void);
 
+// Get the number of dips detected during the previous complete second.
 int Sampler_countDips(void);
 
 #endif
@@ -0,0 +1,54 @@
+// subscriptions.h
+// Push streams for UDP clients, so they don't have to poll.
+//
+// A client sends "subscribe <stream> [period_ms]" and gets back a cookie
+// (a keyed hash of its address, the stream and the time). It confirms
+// with "subscribe <stream> [period_ms] cookie <cookie>", and the server
+// then sends it a batch every period from its own thread, until the
+// client unsubscribes or the lease runs out (subscribing again with the
+// cookie from the last reply renews it). Without the round trip, a
+// datagram with a forged source address could start a stream to
+// anyone; with it, the stranger only gets the one short reply.
+// Streams:
+//   samples - every sample, binary (see "Streamed samples" in hal/history_codec.h)
+//   summary - one text line per period: samples, average, dips, overruns
+//   dips    - one text line per dip, batched per period
+// Text lines start with the subscription's seq, so gaps show lost
+// datagrams, and carry the number of items the board had to drop.
+
+#ifndef _SUBSCRIPTIONS_H_
+#define _SUBSCRIPTIONS_H_
+
+#include <stdbool.h>
+#include <netinet/in.h>
+
+#define SUBSCRIPTIONS_MAX 16
+#define SUBSCRIPTION_LEASE_S 60
+#define SUBSCRIPTION_MIN_PERIOD_MS 10
+#define SUBSCRIPTION_MAX_PERIOD_MS 60000
+#define SUBSCRIPTION_DEFAULT_PERIOD_MS 1000
+
+// Start/stop the sender: a timer on the event loop if EventLoop_init()
+// has been called, otherwise its own thread. It sends from `sock` (the
+// listener's socket, so replies come from the port clients talk to).
+void Subscriptions_init(int sock);
+void Subscriptions_cleanup(void);
+
+// Handle "subscribe ..." / "unsubscribe ..." arguments (the text after
+// the command word) from `cli`. Writes the reply to send back into `buf`.
+void Subscriptions_subscribe(const struct sockaddr_in *cli, const char *args, char *buf, int cap);
+void Subscriptions_unsubscribe(const struct sockaddr_in *cli, const char *args, char *buf, int cap);
+
+// Number of active subscriptions, and totals over all subscriptions since start.
+typedef struct {
+    int active;
+    long long datagramsSent;
+    long long sendFailures;     // datagrams that could not be queued (socket full)
+    long long itemsDropped;     // samples/events lost because a subscriber fell behind
+    long long expired;          // leases that ran out
+    long long unconfirmed;      // subscribes answered with a cookie to confirm with
+} Subscriptions_stats_t;
+
+void Subscriptions_getStats(Subscriptions_stats_t *pStats);
+
+#endif
@@ -0,0 +1,35 @@
+// timestamp.h
+// Cheap nanosecond timestamps for hot-path instrumentation (period marks,
+// probes): the CPU's own counter is read directly instead of through
+// clock_gettime(), and scaled to nanoseconds.
+//
+// On aarch64 that is the generic timer's virtual count (CNTVCT_EL0), on
+// x86-64 the TSC when the CPU says it is invariant. Either is calibrated
+// once against CLOCK_MONOTONIC, so timestamps start out equal to
+// CLOCK_MONOTONIC and are the same clock on every thread. Anywhere else
+// (or with $AS2_TIMESTAMP=clock) they come from clock_gettime().
+//
+// The scale is fixed after calibration, so over hours these may drift
+// from CLOCK_MONOTONIC by some parts per million (and don't follow NTP's
+// slewing). Use them for intervals and traces; times handed to clients
+// to compare with their own CLOCK_MONOTONIC should still come from
+// clock_gettime().
+
+#ifndef _TIMESTAMP_H_
+#define _TIMESTAMP_H_
+
+#define TIMESTAMP_ENV "AS2_TIMESTAMP"
+
+// Calibrate now (it takes about 20 ms) rather than on first use, which
+// might be on a time-critical thread. Safe to call more than once.
+void Timestamp_init(void);
+
+// Nanoseconds on a monotonic clock. Any thread.
+long long Timestamp_nowNs(void);
+
+// "cntvct", "tsc" or "clock_gettime", and the counter's frequency in Hz
+// (0 for clock_gettime), for diagnostics.
+const char *Timestamp_getSourceName(void);
+double Timestamp_getCounterHz(void);
+
+#endif
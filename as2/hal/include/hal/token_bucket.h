@@ -0,0 +1,33 @@
+// token_bucket.h
+// Token bucket rate limiter (the UDP listener's per-source and global
+// command budgets). Tokens are kept in thousandths, and only the time
+// actually turned into tokens is used up, so slow rates stay exact no
+// matter how often the bucket is topped up.
+//
+// Not thread-safe: a bucket belongs to one thread.
+
+#ifndef _TOKEN_BUCKET_H_
+#define _TOKEN_BUCKET_H_
+
+#include <stdbool.h>
+
+#define TOKEN_BUCKET_MILLI 1000LL
+
+// Zero-initialised, a bucket is unused; it starts full.
+typedef struct {
+    long long milliTokens;
+    long long lastNs;
+} TokenBucket_t;
+
+// Top the bucket up for the time since it was last refilled, at
+// `ratePerSecond` tokens a second, up to `burst` tokens.
+void TokenBucket_refill(TokenBucket_t *pBucket, long long nowNs, int ratePerSecond, int burst);
+
+// Whether the bucket holds at least `tokens`.
+bool TokenBucket_has(const TokenBucket_t *pBucket, int tokens);
+
+// Take `tokens` if the bucket holds that many; false (and nothing
+// taken) if not.
+bool TokenBucket_take(TokenBucket_t *pBucket, int tokens);
+
+#endif
@@ -2,14 +2,98 @@
 #define _UDP_LISTENER_H_
 
 #include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <netinet/in.h>
 
-// Function that starts the UDP listening thread
+#define UDP_MAX_COMMANDS 32
+#define UDP_MAX_COMMAND_NAME 16
+#define UDP_MAX_SESSIONS 64
+
+// Datagrams received (or replies sent) per syscall, at most.
+#define UDP_BATCH 16
+
+// Rate limits, in command tokens (most commands cost 1, see
+// UDP_setCommandCost()). Commands over a limit are dropped unanswered.
+#define UDP_SOURCE_RATE 20          // per second, per source IP address
+#define UDP_SOURCE_BURST 40
+#define UDP_GLOBAL_RATE 200         // per second, all sources together
+#define UDP_GLOBAL_BURST 400
+
+// For benchmarking the listener (app/src/udp_loadgen.c) on a private
+// network; call before UDP_init().
+// Datagrams taken per recvmmsg(), and replies queued per sendmmsg(): 1
+// to UDP_BATCH (the default). 1 is the unbatched listener, one syscall
+// per datagram each way.
+void UDP_setBatchSize(int batch);
+// Turn the rate limits off (or back on), so a load generator on one
+// address isn't shed.
+void UDP_setRateLimiting(bool enabled);
+
+// Function that starts the UDP listener: on the event loop if
+// EventLoop_init() has been called, otherwise on its own thread.
 void UDP_init(void);
 
-// Function that stops the UDP listener thread
+// Function that stops the UDP listener (returns promptly, even if no
+// datagram ever arrives)
 void UDP_cleanup(void);
 
-// The function run by the UDP thread
+// The function run by the UDP thread (when not on the event loop)
 void* udpFunc(void* arg);
 
+// Traffic counters. The listener drains bursts of requests with one
+// recvmmsg() and answers them with one sendmmsg(), so packets per call
+// above 1 means batching is saving syscalls.
+typedef struct {
+    long long packetsIn;
+    long long packetsOut;
+    long long recvCalls;
+    long long sendCalls;
+    int maxRecvBatch;       // most datagrams taken by a single recvmmsg()
+    int maxSendBatch;       // deepest reply queue flushed by one sendmmsg() pass
+    long long accepted;     // commands let through the rate limits
+    long long shedSource;   // dropped: the source was over its rate
+    long long shedGlobal;   // dropped: the global budget was spent
+    long long shedHeavy;    // dropped: a heavy command while the global budget ran low
+    long long unknownCommands;
+    long long sessionsEvicted;
+} UDP_stats_t;
+
+void UDP_getStats(UDP_stats_t* pStats);
+
+// Per-command totals (safe to read from any thread). Fills up to `max`
+// entries, in registration order, and returns how many.
+typedef struct {
+    const char* name;
+    long long calls;
+    long long totalNs;      // time spent in the handler
+    long long maxNs;
+} UDP_commandStats_t;
+
+int UDP_getCommandStats(UDP_commandStats_t* pStats, int max);
+
+// A command from a client. The first word of the line selects the
+// handler; `args` is the rest of it (leading spaces skipped, "" if none).
+typedef struct {
+    const struct sockaddr_in* client;
+    const char* args;
+} UDP_request_t;
+
+typedef void (*UDP_commandHandler_t)(const UDP_request_t* pReq);
+
+// Add a command. `help` is its line(s) in the "help" reply (NULL to
+// leave it out). Call before UDP_init() or from a command handler.
+// Returns 0, or -1 if the name is taken or the table is full.
+// Each command's calls and handling times are shown by "stats".
+int UDP_registerCommand(const char* name, UDP_commandHandler_t handler, const char* help);
+
+// Set how many rate-limit tokens a command costs (default 1). Heavy
+// commands cost more and are the first shed under load.
+int UDP_setCommandCost(const char* name, int cost);
+
+// From a handler: queue a reply datagram to the requesting client.
+void UDP_reply(const UDP_request_t* pReq, const void* data, size_t len);
+void UDP_replyf(const UDP_request_t* pReq, const char* fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
 #endif
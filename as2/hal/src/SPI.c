@@ -1,5 +1,6 @@
 #include "hal/SPI.h"
 #include <stdio.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
@@ -20,15 +21,23 @@ int spi_init(const char *device, uint32_t speed_hz) {
     return fd;
 }
 
+// MCP3208 command: start bit, single-ended, channel select.
+static void fillCommand(uint8_t tx[3], int channel) {
+    tx[0] = 0x06 | ((channel & 0x04) >> 2);
+    tx[1] = (channel & 0x03) << 6;
+    tx[2] = 0x00;
+}
+
+static uint16_t parseResult(const uint8_t rx[3]) {
+    return ((rx[1] & 0x0F) << 8) | rx[2];
+}
+
 int readADC(int fd, int channel, uint32_t speed_hz) {
     if (channel < 0 || channel > 7) return -1;
 
-    uint8_t tx[3] = {
-        0x06 | ((channel & 0x04) >> 2),
-        (channel & 0x03) << 6,
-        0x00
-    };
+    uint8_t tx[3];
     uint8_t rx[3] = {0};
+    fillCommand(tx, channel);
 
     struct spi_ioc_transfer tr = {
         .tx_buf = (unsigned long)tx,
@@ -40,7 +49,34 @@ int readADC(int fd, int channel, uint32_t speed_hz) {
 
     if (ioctl(fd, SPI_IOC_MESSAGE(1), &tr) < 1) return -1;
 
-    int value = ((rx[1] & 0x0F) << 8) | rx[2];
-    return value;
+    return parseResult(rx);
+}
+
+int readADCBatch(int fd, const int *channels, int n, uint32_t speed_hz, uint16_t *out) {
+    if (n <= 0 || n > SPI_MAX_BATCH) return -1;
+
+    uint8_t tx[SPI_MAX_BATCH][3];
+    uint8_t rx[SPI_MAX_BATCH][3];
+    struct spi_ioc_transfer tr[SPI_MAX_BATCH];
+    memset(tr, 0, n * sizeof(tr[0]));
+
+    for (int i = 0; i < n; i++) {
+        if (channels[i] < 0 || channels[i] > 7) return -1;
+        fillCommand(tx[i], channels[i]);
+        tr[i].tx_buf = (unsigned long)tx[i];
+        tr[i].rx_buf = (unsigned long)rx[i];
+        tr[i].len = 3;
+        tr[i].speed_hz = speed_hz;
+        tr[i].bits_per_word = 8;
+        // The MCP3208 starts each conversion on a falling CS edge.
+        tr[i].cs_change = (i < n - 1);
+    }
+
+    if (ioctl(fd, SPI_IOC_MESSAGE(n), tr) < 1) return -1;
+
+    for (int i = 0; i < n; i++) {
+        out[i] = parseResult(rx[i]);
+    }
+    return n;
 }
 
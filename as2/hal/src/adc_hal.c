@@ -1,40 +1,176 @@
 #include "hal/adc_hal.h"
+#include "hal/adc_backend.h"
 #include "hal/SPI.h"
+#include "hal/probe.h"
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
+#define SPI_SPEED_HZ 500000
+#define SPI_DEFAULT_DEVICE "/dev/spidev0.0"
+#define BACKEND_ENV "AS2_ADC"
+#define MAX_SPEC_LEN 256
+
+static const ADC_backend_t *backends[] = {
+    &ADC_spiBackend,
+    &ADC_synthBackend,
+    &ADC_replayBackend,
+};
+#define NUM_BACKENDS (sizeof(backends) / sizeof(backends[0]))
+
+static const ADC_backend_t *backend = NULL;     // selected
+static char backendOptions[MAX_SPEC_LEN] = "";
+static int isOpen = 0;
+
+
+// ---- spidev backend ----
 static int spi_fd = -1;  // handle for SPI device
+static int probeSpiTransfer = -1;
 
-void ADC_init(void)
+static int spiOpen(const char *options)
 {
-    // Initialize the SPI interface
-    spi_fd = spi_init("/dev/spidev0.0", 500000);
+    const char *device = (options[0] != '\0') ? options : SPI_DEFAULT_DEVICE;
+    spi_fd = spi_init(device, SPI_SPEED_HZ);
     if (spi_fd < 0) {
         perror("Failed to initialize SPI for ADC");
+        return -1;
+    }
+    printf("ADC SPI initialized (fd=%d)\n", spi_fd);
+    probeSpiTransfer = Probe_register("spi_transfer");
+    return 0;
+}
+
+static int spiReadBatch(const int *channels, int n, uint16_t *out)
+{
+    int result;
+    Probe_begin(probeSpiTransfer);
+    if (n == 1) {
+        int raw = readADC(spi_fd, channels[0], SPI_SPEED_HZ);
+        if (raw >= 0) out[0] = (uint16_t)raw;
+        result = (raw < 0) ? -1 : 1;
     } else {
-        printf("ADC SPI initialized (fd=%d)\n", spi_fd);
+        result = readADCBatch(spi_fd, channels, n, SPI_SPEED_HZ, out);
+    }
+    Probe_end(probeSpiTransfer);
+    return result;
+}
+
+static void spiClose(void)
+{
+    close(spi_fd);  // <- just close the SPI file descriptor
+    spi_fd = -1;
+    printf("ADC SPI closed\n");
+}
+
+const ADC_backend_t ADC_spiBackend = {
+    .name = "spi",
+    .open = spiOpen,
+    .readBatch = spiReadBatch,
+    .close = spiClose,
+};
+
+
+// ---- backend selection ----
+int ADC_setBackend(const char *spec)
+{
+    if (isOpen) {
+        fprintf(stderr, "ADC_setBackend() must be called before ADC_init()\n");
+        return -1;
+    }
+
+    const char *colon = strchr(spec, ':');
+    size_t nameLen = colon ? (size_t)(colon - spec) : strlen(spec);
+    for (size_t i = 0; i < NUM_BACKENDS; i++) {
+        if (strlen(backends[i]->name) == nameLen &&
+                strncmp(backends[i]->name, spec, nameLen) == 0) {
+            backend = backends[i];
+            snprintf(backendOptions, sizeof(backendOptions), "%s", colon ? colon + 1 : "");
+            return 0;
+        }
+    }
+    fprintf(stderr, "Unknown ADC backend '%s' (expected spi, synth or replay)\n", spec);
+    return -1;
+}
+
+const char *ADC_getBackendName(void)
+{
+    return backend ? backend->name : ADC_spiBackend.name;
+}
+
+void ADC_init(void)
+{
+    // Not chosen in code? Let the environment pick (default: spidev).
+    if (!backend) {
+        const char *spec = getenv(BACKEND_ENV);
+        if (!spec || ADC_setBackend(spec) != 0) {
+            backend = &ADC_spiBackend;
+            backendOptions[0] = '\0';
+        }
     }
+
+    isOpen = (backend->open(backendOptions) == 0);
 }
 
 double ADC_read(int channel)
 {
-    if (spi_fd < 0) {
+    if (!isOpen) {
         fprintf(stderr, "ADC_read() called before ADC_init()\n");
         return 0.0;
     }
 
-    int raw = readADC(spi_fd, channel, 500000); // read from SPI ADC
-    double voltage = (raw / 4095.0) * 3.3;      // convert to volts (12-bit ADC)
-    return voltage;
+    uint16_t raw;
+    if (backend->readBatch(&channel, 1, &raw) != 1) {
+        return ADC_rawToVolts(-1);
+    }
+    return ADC_rawToVolts(raw);
 }
 
-void ADC_cleanup(void)
+int ADC_readRaw(int channel)
+{
+    if (!isOpen) {
+        fprintf(stderr, "ADC_readRaw() called before ADC_init()\n");
+        return -1;
+    }
+
+    uint16_t raw;
+    if (backend->readBatch(&channel, 1, &raw) != 1) {
+        return -1;
+    }
+    return raw;
+}
+
+int ADC_readRawBatch(const int *channels, int n, uint16_t *out)
 {
-    if (spi_fd >= 0) {
-        close(spi_fd);  // <- just close the SPI file descriptor
-        spi_fd = -1;
-        printf("ADC SPI closed\n");
+    if (!isOpen) {
+        fprintf(stderr, "ADC_readRawBatch() called before ADC_init()\n");
+        return -1;
     }
+    if (n <= 0 || n > SPI_MAX_BATCH) return -1;
+    return backend->readBatch(channels, n, out);
 }
 
+int ADC_readRawRepeated(int channel, int n, uint16_t *out)
+{
+    if (n <= 0 || n > SPI_MAX_BATCH) return -1;
+
+    int channels[SPI_MAX_BATCH];
+    for (int i = 0; i < n; i++) {
+        channels[i] = channel;
+    }
+    return ADC_readRawBatch(channels, n, out);
+}
+
+double ADC_rawToVolts(double raw)
+{
+    return (raw / ADC_MAX_CODE) * ADC_VREF_VOLTS;  // 12-bit ADC
+}
+
+void ADC_cleanup(void)
+{
+    if (isOpen) {
+        backend->close();
+        isOpen = 0;
+    }
+}
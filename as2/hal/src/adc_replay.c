@@ -0,0 +1,117 @@
+// Replay ADC source: serves codes recorded with hal/capture.h, or from a
+// plain file of little-endian uint16 samples, looping at the end.
+// Pacing comes from the sampler: its normal schedule replays in real
+// time, SAMPLER_SCHED_FREERUN replays as fast as possible.
+#include "hal/adc_backend.h"
+#include "hal/adc_hal.h"
+#include "hal/capture.h"
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Capture file source
+static Capture_reader_t *pCapture = NULL;
+
+// Plain uint16 file source
+static const uint16_t *codes = NULL;
+static size_t numCodes = 0;
+static size_t mappedLen = 0;
+static size_t position = 0;
+
+static int openRaw(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("ADC replay: open");
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(uint16_t)) {
+        fprintf(stderr, "ADC replay: '%s' has no samples\n", path);
+        close(fd);
+        return -1;
+    }
+
+    mappedLen = st.st_size;
+    void *map = mmap(NULL, mappedLen, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("ADC replay: mmap");
+        return -1;
+    }
+
+    codes = map;
+    numCodes = mappedLen / sizeof(uint16_t);
+    position = 0;
+    printf("ADC replaying %zu samples from %s\n", numCodes, path);
+    return 0;
+}
+
+static int replayOpen(const char *options)
+{
+    pCapture = Capture_openReader(options);
+    if (pCapture) {
+        uint16_t probe;
+        if (Capture_read(pCapture, &probe, 1, NULL) != 1) {
+            fprintf(stderr, "ADC replay: capture '%s' has no samples\n", options);
+            Capture_closeReader(pCapture);
+            pCapture = NULL;
+            return -1;
+        }
+        Capture_rewind(pCapture);
+        printf("ADC replaying capture %s (recorded at %u Hz)\n",
+               options, Capture_getHeader(pCapture)->sampleRateHz);
+        return 0;
+    }
+    return openRaw(options);
+}
+
+static int replayReadBatch(const int *channels, int n, uint16_t *out)
+{
+    (void)channels;
+    if (pCapture) {
+        int got = 0;
+        while (got < n) {
+            int k = Capture_read(pCapture, out + got, n - got, NULL);
+            if (k == 0) {
+                Capture_rewind(pCapture);
+            }
+            got += k;
+        }
+        for (int i = 0; i < n; i++) {
+            if (out[i] > ADC_MAX_CODE) out[i] = ADC_MAX_CODE;
+        }
+        return n;
+    }
+
+    for (int i = 0; i < n; i++) {
+        uint16_t code = codes[position];
+        out[i] = (code > ADC_MAX_CODE) ? ADC_MAX_CODE : code;
+        if (++position == numCodes) {
+            position = 0;
+        }
+    }
+    return n;
+}
+
+static void replayClose(void)
+{
+    if (pCapture) {
+        Capture_closeReader(pCapture);
+        pCapture = NULL;
+        return;
+    }
+    munmap((void *)codes, mappedLen);
+    codes = NULL;
+    numCodes = 0;
+}
+
+const ADC_backend_t ADC_replayBackend = {
+    .name = "replay",
+    .open = replayOpen,
+    .readBatch = replayReadBatch,
+    .close = replayClose,
+};
@@ -0,0 +1,126 @@
+// Synthetic ADC source: a steady light level with noise, dipping at a
+// fixed rate (or at the LED's PWM frequency), so the sampler stack can
+// run and be load-tested on a plain Linux host.
+#include "hal/adc_backend.h"
+#include "hal/adc_hal.h"
+#include "hal/pwm_hal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+
+#define MAX_OPTIONS_LEN 256
+
+static double dcVolts = 1.5;
+static double noiseVolts = 0.01;
+static double depthVolts = 0.3;
+static double dipHz = 0;           // 0: follow PWM_getFrequency()
+static double dutyPercent = 50;
+
+static uint32_t rngState = 0x12345678;
+static long long startNs = 0;
+
+static long long nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// xorshift32: cheap, and good enough for noise.
+static uint32_t nextRandom(void)
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+static bool parseOption(const char *key, const char *value)
+{
+    if (strcmp(key, "dc") == 0) {
+        dcVolts = atof(value);
+    } else if (strcmp(key, "noise") == 0) {
+        noiseVolts = atof(value);
+    } else if (strcmp(key, "depth") == 0) {
+        depthVolts = atof(value);
+    } else if (strcmp(key, "hz") == 0) {
+        dipHz = (strcmp(value, "pwm") == 0) ? 0 : atof(value);
+    } else if (strcmp(key, "duty") == 0) {
+        dutyPercent = atof(value);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static int synthOpen(const char *options)
+{
+    char buf[MAX_OPTIONS_LEN];
+    snprintf(buf, sizeof(buf), "%s", options);
+
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(tok, '=');
+        if (!eq) {
+            fprintf(stderr, "ADC synth: expected key=value, got '%s'\n", tok);
+            return -1;
+        }
+        *eq = '\0';
+        if (!parseOption(tok, eq + 1)) {
+            fprintf(stderr, "ADC synth: unknown option '%s'\n", tok);
+            return -1;
+        }
+    }
+
+    startNs = nowNs();
+    printf("ADC synthetic source: dc=%.3fV noise=%.3fV depth=%.3fV hz=%s%.1f duty=%.0f%%\n",
+           dcVolts, noiseVolts, depthVolts, dipHz > 0 ? "" : "pwm/",
+           dipHz > 0 ? dipHz : (double)PWM_getFrequency(), dutyPercent);
+    return 0;
+}
+
+static uint16_t synthCode(long long tNs)
+{
+    double volts = dcVolts;
+
+    double hz = (dipHz > 0) ? dipHz : PWM_getFrequency();
+    if (hz > 0) {
+        // Over the whole run, not per second: fractional rates keep their period.
+        double phase = fmod((double)tNs * 1e-9 * hz, 1.0);
+        if (phase * 100.0 < dutyPercent) {
+            volts -= depthVolts;
+        }
+    }
+
+    volts += noiseVolts * ((nextRandom() / (double)UINT32_MAX) * 2.0 - 1.0);
+
+    double code = volts / ADC_VREF_VOLTS * ADC_MAX_CODE + 0.5;
+    if (code < 0) code = 0;
+    if (code > ADC_MAX_CODE) code = ADC_MAX_CODE;
+    return (uint16_t)code;
+}
+
+static int synthReadBatch(const int *channels, int n, uint16_t *out)
+{
+    (void)channels;
+    long long t = nowNs() - startNs;
+    for (int i = 0; i < n; i++) {
+        out[i] = synthCode(t);
+    }
+    return n;
+}
+
+static void synthClose(void)
+{
+    // nothing
+}
+
+const ADC_backend_t ADC_synthBackend = {
+    .name = "synth",
+    .open = synthOpen,
+    .readBatch = synthReadBatch,
+    .close = synthClose,
+};
@@ -0,0 +1,146 @@
+#define _GNU_SOURCE  // sendmmsg()
+
+#include "hal/broadcast.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#define MULTICAST_TTL 1
+#define TARGETS_MAX_LEN 512
+
+static int sock = -1;
+static struct sockaddr_in targets[BROADCAST_MAX_TARGETS];
+static int numTargets = 0;
+static uint32_t nextSeq = 0;
+
+static atomic_llong statSent;
+static atomic_llong statFailures;
+
+// Parse "a.b.c.d:port" into `pAddr`.
+static bool parseTarget(const char *text, struct sockaddr_in *pAddr)
+{
+    char host[INET_ADDRSTRLEN];
+    const char *colon = strrchr(text, ':');
+    if (!colon || colon == text || colon - text >= (int)sizeof(host)) {
+        return false;
+    }
+    memcpy(host, text, colon - text);
+    host[colon - text] = '\0';
+
+    char *end;
+    long port = strtol(colon + 1, &end, 10);
+    if (*end != '\0' || port <= 0 || port > 65535) {
+        return false;
+    }
+    memset(pAddr, 0, sizeof(*pAddr));
+    pAddr->sin_family = AF_INET;
+    pAddr->sin_port = htons((uint16_t)port);
+    return inet_pton(AF_INET, host, &pAddr->sin_addr) == 1;
+}
+
+int Broadcast_init(const char *targetList)
+{
+    char list[TARGETS_MAX_LEN];
+    if (strlen(targetList) >= sizeof(list)) {
+        fprintf(stderr, "Broadcast_init: target list too long\n");
+        return -1;
+    }
+    strcpy(list, targetList);
+
+    numTargets = 0;
+    bool multicast = false;
+    char *save = NULL;
+    for (char *tok = strtok_r(list, ", ", &save); tok; tok = strtok_r(NULL, ", ", &save)) {
+        if (numTargets == BROADCAST_MAX_TARGETS) {
+            fprintf(stderr, "Broadcast_init: more than %d targets\n", BROADCAST_MAX_TARGETS);
+            return -1;
+        }
+        if (!parseTarget(tok, &targets[numTargets])) {
+            fprintf(stderr, "Broadcast_init: bad target '%s' (want address:port)\n", tok);
+            return -1;
+        }
+        if (IN_MULTICAST(ntohl(targets[numTargets].sin_addr.s_addr))) {
+            multicast = true;
+        }
+        numTargets++;
+    }
+    if (numTargets == 0) {
+        fprintf(stderr, "Broadcast_init: no targets\n");
+        return -1;
+    }
+
+    sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        perror("Broadcast_init: socket");
+        numTargets = 0;
+        return -1;
+    }
+    if (multicast) {
+        unsigned char ttl = MULTICAST_TTL;
+        if (setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0) {
+            perror("Broadcast_init: IP_MULTICAST_TTL");
+        }
+    }
+    nextSeq = 0;
+    return 0;
+}
+
+void Broadcast_cleanup(void)
+{
+    if (sock >= 0) {
+        close(sock);
+        sock = -1;
+    }
+    numTargets = 0;
+}
+
+bool Broadcast_isActive(void)
+{
+    return sock >= 0;
+}
+
+void Broadcast_sendSummary(History_summary_t *pSummary)
+{
+    if (sock < 0) {
+        return;
+    }
+    uint8_t datagram[HISTORY_SUMMARY_SIZE];
+    pSummary->seq = nextSeq++;
+    int len = History_encodeSummary(pSummary, datagram);
+
+    // The same bytes to every target, in one system call.
+    struct iovec iov = { .iov_base = datagram, .iov_len = len };
+    struct mmsghdr msgs[BROADCAST_MAX_TARGETS];
+    for (int i = 0; i < numTargets; i++) {
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_name = &targets[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(targets[i]);
+        msgs[i].msg_hdr.msg_iov = &iov;
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int sent = 0;
+    while (sent < numTargets) {
+        int n = sendmmsg(sock, msgs + sent, numTargets - sent, MSG_DONTWAIT);
+        if (n <= 0) {
+            // Skip the datagram that failed (unreachable, buffer full) and
+            // carry on with the rest.
+            atomic_fetch_add(&statFailures, 1);
+            n = 1;
+        }
+        sent += n;
+    }
+    atomic_fetch_add(&statSent, 1);
+}
+
+void Broadcast_getStats(Broadcast_stats_t *pStats)
+{
+    pStats->targets = numTargets;
+    pStats->summariesSent = atomic_load(&statSent);
+    pStats->sendFailures = atomic_load(&statFailures);
+}
@@ -0,0 +1,244 @@
+#define _GNU_SOURCE  // mremap()
+
+#include "hal/capture.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Grow the file (and mapping) this much at a time: ~35 minutes at 1 kHz.
+#define GROW_BYTES (4 * 1024 * 1024)
+
+#define BLOCK_BYTES(blockSamples) \
+    (sizeof(Capture_blockHeader_t) + (size_t)(blockSamples) * sizeof(uint16_t))
+
+struct Capture_writer {
+    int fd;
+    uint8_t *map;
+    size_t mappedLen;
+    size_t blockOffset;         // current block; 0 if none started yet
+    size_t usedLen;             // bytes holding valid data
+    uint32_t blockSamples;
+    bool failed;
+};
+
+struct Capture_reader {
+    const uint8_t *map;
+    size_t len;
+    const Capture_header_t *pHeader;
+    size_t blockOffset;
+    uint32_t indexInBlock;
+};
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool growWriter(Capture_writer_t *pWriter, size_t newLen)
+{
+    if (ftruncate(pWriter->fd, newLen) != 0) {
+        perror("Capture: ftruncate");
+        return false;
+    }
+    void *map = (pWriter->map == NULL)
+        ? mmap(NULL, newLen, PROT_READ | PROT_WRITE, MAP_SHARED, pWriter->fd, 0)
+        : mremap(pWriter->map, pWriter->mappedLen, newLen, MREMAP_MAYMOVE);
+    if (map == MAP_FAILED) {
+        perror("Capture: mmap");
+        return false;
+    }
+    pWriter->map = map;
+    pWriter->mappedLen = newLen;
+    return true;
+}
+
+Capture_writer_t *Capture_openWriter(const char *path, int sampleRateHz)
+{
+    Capture_writer_t *pWriter = calloc(1, sizeof(*pWriter));
+    if (!pWriter) {
+        return NULL;
+    }
+
+    pWriter->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (pWriter->fd < 0) {
+        perror("Capture: open");
+        free(pWriter);
+        return NULL;
+    }
+    if (!growWriter(pWriter, GROW_BYTES)) {
+        close(pWriter->fd);
+        free(pWriter);
+        return NULL;
+    }
+
+    Capture_header_t *pHeader = (Capture_header_t *)pWriter->map;
+    memcpy(pHeader->magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+    pHeader->version = CAPTURE_VERSION;
+    pHeader->sampleRateHz = sampleRateHz;
+    pHeader->startTimeNs = nowNs();
+    pHeader->blockSamples = CAPTURE_BLOCK_SAMPLES;
+
+    pWriter->blockSamples = CAPTURE_BLOCK_SAMPLES;
+    pWriter->usedLen = sizeof(Capture_header_t);
+    return pWriter;
+}
+
+// Start a new block at the end of the file, growing it if needed.
+static bool startBlock(Capture_writer_t *pWriter)
+{
+    size_t offset = pWriter->blockOffset
+        ? pWriter->blockOffset + BLOCK_BYTES(pWriter->blockSamples)
+        : sizeof(Capture_header_t);
+    size_t end = offset + BLOCK_BYTES(pWriter->blockSamples);
+    if (end > pWriter->mappedLen && !growWriter(pWriter, pWriter->mappedLen + GROW_BYTES)) {
+        return false;
+    }
+
+    Capture_blockHeader_t *pBlock = (Capture_blockHeader_t *)(pWriter->map + offset);
+    pBlock->timestampNs = nowNs();
+    pBlock->count = 0;
+    pWriter->blockOffset = offset;
+    return true;
+}
+
+void Capture_writeSample(Capture_writer_t *pWriter, uint16_t code)
+{
+    if (pWriter->failed) {
+        return;
+    }
+
+    Capture_blockHeader_t *pBlock = (Capture_blockHeader_t *)(pWriter->map + pWriter->blockOffset);
+    if (pWriter->blockOffset == 0 || pBlock->count == pWriter->blockSamples) {
+        if (!startBlock(pWriter)) {
+            fprintf(stderr, "Capture: stopped recording (file could not grow)\n");
+            pWriter->failed = true;
+            return;
+        }
+        pBlock = (Capture_blockHeader_t *)(pWriter->map + pWriter->blockOffset);
+    }
+
+    uint16_t *codes = (uint16_t *)(pBlock + 1);
+    codes[pBlock->count] = code;
+    // Bump the count last, so the file is readable if we crash.
+    pBlock->count++;
+    pWriter->usedLen = pWriter->blockOffset + sizeof(*pBlock) + pBlock->count * sizeof(uint16_t);
+}
+
+void Capture_closeWriter(Capture_writer_t *pWriter)
+{
+    if (!pWriter) {
+        return;
+    }
+    munmap(pWriter->map, pWriter->mappedLen);
+    if (ftruncate(pWriter->fd, pWriter->usedLen) != 0) {
+        perror("Capture: ftruncate");
+    }
+    close(pWriter->fd);
+    free(pWriter);
+}
+
+Capture_reader_t *Capture_openReader(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Capture_header_t)) {
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    const Capture_header_t *pHeader = map;
+    if (memcmp(pHeader->magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0 ||
+            pHeader->version != CAPTURE_VERSION || pHeader->blockSamples == 0) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    Capture_reader_t *pReader = calloc(1, sizeof(*pReader));
+    if (!pReader) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    pReader->map = map;
+    pReader->len = st.st_size;
+    pReader->pHeader = pHeader;
+    Capture_rewind(pReader);
+    return pReader;
+}
+
+const Capture_header_t *Capture_getHeader(const Capture_reader_t *pReader)
+{
+    return pReader->pHeader;
+}
+
+void Capture_rewind(Capture_reader_t *pReader)
+{
+    pReader->blockOffset = sizeof(Capture_header_t);
+    pReader->indexInBlock = 0;
+}
+
+int Capture_read(Capture_reader_t *pReader, uint16_t *out, int max, uint64_t *pTimestampNs)
+{
+    const size_t blockBytes = BLOCK_BYTES(pReader->pHeader->blockSamples);
+    const uint64_t periodNs = 1000000000ULL / (pReader->pHeader->sampleRateHz ? pReader->pHeader->sampleRateHz : 1);
+    int copied = 0;
+
+    while (copied < max && pReader->blockOffset + sizeof(Capture_blockHeader_t) <= pReader->len) {
+        const Capture_blockHeader_t *pBlock =
+            (const Capture_blockHeader_t *)(pReader->map + pReader->blockOffset);
+        const uint16_t *codes = (const uint16_t *)(pBlock + 1);
+
+        // A count that runs past the end of the file is a block the file
+        // was cut short in (e.g. copied while recording): end there, with
+        // the complete blocks only.
+        size_t available = (pReader->len - pReader->blockOffset - sizeof(*pBlock)) / sizeof(uint16_t);
+        uint32_t count = pBlock->count;
+        if (count > available) {
+            break;
+        }
+
+        if (pReader->indexInBlock >= count) {
+            if (count < pReader->pHeader->blockSamples) {
+                break;  // partial block: end of recording
+            }
+            pReader->blockOffset += blockBytes;
+            pReader->indexInBlock = 0;
+            continue;
+        }
+
+        if (copied == 0 && pTimestampNs) {
+            *pTimestampNs = pBlock->timestampNs + pReader->indexInBlock * periodNs;
+        }
+        int n = count - pReader->indexInBlock;
+        if (n > max - copied) n = max - copied;
+        memcpy(out + copied, codes + pReader->indexInBlock, n * sizeof(uint16_t));
+        copied += n;
+        pReader->indexInBlock += n;
+    }
+    return copied;
+}
+
+void Capture_closeReader(Capture_reader_t *pReader)
+{
+    if (!pReader) {
+        return;
+    }
+    munmap((void *)pReader->map, pReader->len);
+    free(pReader);
+}
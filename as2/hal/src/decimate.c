@@ -0,0 +1,126 @@
+#include "hal/decimate.h"
+
+// Position in a list of segments, read forwards only.
+typedef struct {
+    const Decimate_segment_t *segs;
+    int seg;
+    int offset;
+} cursor_t;
+
+// The caller never reads past the last sample.
+static inline uint16_t nextSample(cursor_t *pCursor)
+{
+    while (pCursor->offset >= pCursor->segs[pCursor->seg].count) {
+        pCursor->seg++;
+        pCursor->offset = 0;
+    }
+    return pCursor->segs[pCursor->seg].samples[pCursor->offset++];
+}
+
+long long Decimate_countSamples(const Decimate_segment_t *segs, int numSegs)
+{
+    long long n = 0;
+    for (int i = 0; i < numSegs; i++) {
+        n += segs[i].count;
+    }
+    return n;
+}
+
+int Decimate_minMax(const Decimate_segment_t *segs, int numSegs, int buckets,
+                    uint16_t *mins, uint16_t *maxs)
+{
+    long long n = Decimate_countSamples(segs, numSegs);
+    if (buckets > n) buckets = (int)n;
+    if (buckets <= 0) return 0;
+
+    cursor_t cursor = { segs, 0, 0 };
+    long long i = 0;
+    for (int b = 0; b < buckets; b++) {
+        long long end = (b + 1) * n / buckets;
+        uint16_t lo = UINT16_MAX;
+        uint16_t hi = 0;
+        for (; i < end; i++) {
+            uint16_t v = nextSample(&cursor);
+            if (v < lo) lo = v;
+            if (v > hi) hi = v;
+        }
+        mins[b] = lo;
+        maxs[b] = hi;
+    }
+    return buckets;
+}
+
+int Decimate_lttb(const Decimate_segment_t *segs, int numSegs, int points,
+                  uint32_t *indices, uint16_t *values)
+{
+    long long n = Decimate_countSamples(segs, numSegs);
+    if (points < 3) points = 3;
+
+    cursor_t scan = { segs, 0, 0 };
+    if (points >= n) {
+        for (long long i = 0; i < n; i++) {
+            indices[i] = (uint32_t)i;
+            values[i] = nextSample(&scan);
+        }
+        return (int)n;
+    }
+
+    // The first and last samples are always kept; samples [1, n - 1) are
+    // split into `middle` buckets, each giving one point. `scan` walks the
+    // bucket being picked from, `ahead` the next one (for its average), so
+    // every sample is read twice but the pass is still linear and only
+    // ever moves forwards.
+    int middle = points - 2;
+    long long inner = n - 2;
+    cursor_t ahead = { segs, 0, 0 };
+
+    double ax = 0;
+    double ay = nextSample(&scan);
+    indices[0] = 0;
+    values[0] = (uint16_t)ay;
+    int out = 1;
+
+    long long bucketEnd = 1 + inner / middle;
+    for (long long i = 0; i < bucketEnd; i++) {
+        nextSample(&ahead);
+    }
+
+    long long bucketStart = 1;
+    for (int b = 0; b < middle; b++) {
+        // Average of the next bucket; the last bucket looks at the last sample.
+        long long nextEnd = (b + 1 < middle) ? 1 + (b + 2) * inner / middle : n;
+        double sum = 0;
+        for (long long i = bucketEnd; i < nextEnd; i++) {
+            sum += nextSample(&ahead);
+        }
+        double cx = (bucketEnd + nextEnd - 1) / 2.0;
+        double cy = sum / (nextEnd - bucketEnd);
+
+        // Twice the triangle's area; only the comparison matters.
+        double best = -1;
+        long long bestIndex = bucketStart;
+        uint16_t bestValue = 0;
+        for (long long i = bucketStart; i < bucketEnd; i++) {
+            uint16_t v = nextSample(&scan);
+            double area = (ax - cx) * (v - ay) - (ax - i) * (cy - ay);
+            if (area < 0) area = -area;
+            if (area > best) {
+                best = area;
+                bestIndex = i;
+                bestValue = v;
+            }
+        }
+        indices[out] = (uint32_t)bestIndex;
+        values[out] = bestValue;
+        out++;
+        ax = bestIndex;
+        ay = bestValue;
+
+        bucketStart = bucketEnd;
+        bucketEnd = nextEnd;
+    }
+
+    indices[out] = (uint32_t)(n - 1);
+    values[out] = nextSample(&scan);
+    return out + 1;
+}
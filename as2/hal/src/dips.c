@@ -1,4 +1,14 @@
 #include "hal/dips.h"
+#include "hal/adc_hal.h"
+#include <stdbool.h>
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 int Dips_count(const double *samples, const double *avgs, int n, DipConfig cfg)
 {
@@ -28,4 +38,260 @@ int Dips_count(const double *samples, const double *avgs, int n, DipConfig cfg)
         }
     }
     return dips;
-}
\ No newline at end of file
+}
+
+DipConfigRaw DipConfig_toRaw(DipConfig cfg)
+{
+    const double q4PerVolt = ADC_MAX_CODE / ADC_VREF_VOLTS * (1 << DIPS_Q4_SHIFT);
+    DipConfigRaw raw;
+    raw.trigger_q4 = (uint16_t)(cfg.trigger_drop_volts * q4PerVolt + 0.5);
+    raw.reset_q4   = (uint16_t)(cfg.reset_drop_volts * q4PerVolt + 0.5);
+    return raw;
+}
+
+int Dips_countRawScalar(const uint16_t *samples, const uint16_t *avgs_q4, int n, DipConfigRaw cfg)
+{
+    if (!samples || !avgs_q4 || n <= 0) return 0;
+
+    enum { WAITING_FOR_DIP, WAITING_FOR_RESET } state = WAITING_FOR_DIP;
+    int dips = 0;
+
+    for (int i = 0; i < n; i++) {
+        int32_t s = (int32_t)samples[i] << DIPS_Q4_SHIFT;
+        int32_t a = avgs_q4[i];
+
+        if (state == WAITING_FOR_DIP) {
+            if (s <= a - cfg.trigger_q4) {
+                dips++;
+                state = WAITING_FOR_RESET;
+            }
+        } else { // WAITING_FOR_RESET
+            if (s >= a - cfg.reset_q4) {
+                state = WAITING_FOR_DIP;
+            }
+        }
+    }
+    return dips;
+}
+
+// Block kernel: for up to 64 samples at a time, build one bitmask of
+// samples at/below the trigger threshold and one of samples at/above
+// the reset threshold. The hysteresis then only has to hop between set
+// bits of the two masks, which costs one ctz per state change instead
+// of a branch per sample.
+//
+// Thresholds are tested as (s << 4) + threshold vs avg with a saturating
+// add, so everything stays in unsigned 16-bit lanes:
+//   trigger: sat(s + trigger) <= avg    reset: sat(s + reset) >= avg
+// (saturation only happens when the true sum exceeds any possible avg).
+#define DIPS_BLOCK 64
+
+static inline uint16_t satAdd16(uint16_t a, uint16_t b)
+{
+    uint32_t sum = (uint32_t)a + b;
+    return (sum > 0xFFFF) ? 0xFFFF : (uint16_t)sum;
+}
+
+static void buildMasksScalar(const uint16_t *samples, const uint16_t *avgs_q4, int n,
+                             DipConfigRaw cfg, uint64_t *pTrigger, uint64_t *pReset)
+{
+    uint64_t trigger = 0;
+    uint64_t reset = 0;
+    for (int i = 0; i < n; i++) {
+        uint16_t s = (uint16_t)(samples[i] << DIPS_Q4_SHIFT);
+        trigger |= (uint64_t)(satAdd16(s, cfg.trigger_q4) <= avgs_q4[i]) << i;
+        reset   |= (uint64_t)(satAdd16(s, cfg.reset_q4) >= avgs_q4[i]) << i;
+    }
+    *pTrigger = trigger;
+    *pReset = reset;
+}
+
+#if defined(__aarch64__)
+
+static void buildMasks(const uint16_t *samples, const uint16_t *avgs_q4, int n,
+                       DipConfigRaw cfg, uint64_t *pTrigger, uint64_t *pReset)
+{
+    if (n < DIPS_BLOCK) {
+        buildMasksScalar(samples, avgs_q4, n, cfg, pTrigger, pReset);
+        return;
+    }
+
+    // Lane i of `bits` holds 1 << i, so a horizontal add of the selected
+    // lanes packs 8 comparison results into one byte.
+    static const uint16_t laneBits[8] = {1, 2, 4, 8, 16, 32, 64, 128};
+    const uint16x8_t bits = vld1q_u16(laneBits);
+    const uint16x8_t trig = vdupq_n_u16(cfg.trigger_q4);
+    const uint16x8_t rst = vdupq_n_u16(cfg.reset_q4);
+
+    uint64_t trigger = 0;
+    uint64_t reset = 0;
+    for (int i = 0; i < DIPS_BLOCK; i += 8) {
+        uint16x8_t s = vshlq_n_u16(vld1q_u16(samples + i), DIPS_Q4_SHIFT);
+        uint16x8_t a = vld1q_u16(avgs_q4 + i);
+        uint16x8_t t = vcleq_u16(vqaddq_u16(s, trig), a);
+        uint16x8_t r = vcgeq_u16(vqaddq_u16(s, rst), a);
+        trigger |= (uint64_t)vaddvq_u16(vandq_u16(t, bits)) << i;
+        reset   |= (uint64_t)vaddvq_u16(vandq_u16(r, bits)) << i;
+    }
+    *pTrigger = trigger;
+    *pReset = reset;
+}
+
+#elif defined(__AVX2__)
+
+static void buildMasks(const uint16_t *samples, const uint16_t *avgs_q4, int n,
+                       DipConfigRaw cfg, uint64_t *pTrigger, uint64_t *pReset)
+{
+    if (n < DIPS_BLOCK) {
+        buildMasksScalar(samples, avgs_q4, n, cfg, pTrigger, pReset);
+        return;
+    }
+
+    const __m256i trig = _mm256_set1_epi16((short)cfg.trigger_q4);
+    const __m256i rst = _mm256_set1_epi16((short)cfg.reset_q4);
+    const __m256i zero = _mm256_setzero_si256();
+
+    uint64_t trigger = 0;
+    uint64_t reset = 0;
+    for (int i = 0; i < DIPS_BLOCK; i += 32) {
+        __m256i t2[2], r2[2];
+        for (int j = 0; j < 2; j++) {
+            const __m256i *ps = (const __m256i *)(samples + i + 16 * j);
+            const __m256i *pa = (const __m256i *)(avgs_q4 + i + 16 * j);
+            __m256i s = _mm256_slli_epi16(_mm256_loadu_si256(ps), DIPS_Q4_SHIFT);
+            __m256i a = _mm256_loadu_si256(pa);
+            // x <= y  <=>  saturating x - y == 0
+            t2[j] = _mm256_cmpeq_epi16(_mm256_subs_epu16(_mm256_adds_epu16(s, trig), a), zero);
+            r2[j] = _mm256_cmpeq_epi16(_mm256_subs_epu16(a, _mm256_adds_epu16(s, rst)), zero);
+        }
+        // Pack 2x16 word masks to 32 bytes; packs works per 128-bit lane,
+        // so restore sample order before taking the byte mask.
+        __m256i t = _mm256_permute4x64_epi64(_mm256_packs_epi16(t2[0], t2[1]), 0xD8);
+        __m256i r = _mm256_permute4x64_epi64(_mm256_packs_epi16(r2[0], r2[1]), 0xD8);
+        trigger |= (uint64_t)(uint32_t)_mm256_movemask_epi8(t) << i;
+        reset   |= (uint64_t)(uint32_t)_mm256_movemask_epi8(r) << i;
+    }
+    *pTrigger = trigger;
+    *pReset = reset;
+}
+
+#elif defined(__SSE2__)
+
+static void buildMasks(const uint16_t *samples, const uint16_t *avgs_q4, int n,
+                       DipConfigRaw cfg, uint64_t *pTrigger, uint64_t *pReset)
+{
+    if (n < DIPS_BLOCK) {
+        buildMasksScalar(samples, avgs_q4, n, cfg, pTrigger, pReset);
+        return;
+    }
+
+    const __m128i trig = _mm_set1_epi16((short)cfg.trigger_q4);
+    const __m128i rst = _mm_set1_epi16((short)cfg.reset_q4);
+    const __m128i zero = _mm_setzero_si128();
+
+    uint64_t trigger = 0;
+    uint64_t reset = 0;
+    for (int i = 0; i < DIPS_BLOCK; i += 16) {
+        __m128i t2[2], r2[2];
+        for (int j = 0; j < 2; j++) {
+            const __m128i *ps = (const __m128i *)(samples + i + 8 * j);
+            const __m128i *pa = (const __m128i *)(avgs_q4 + i + 8 * j);
+            __m128i s = _mm_slli_epi16(_mm_loadu_si128(ps), DIPS_Q4_SHIFT);
+            __m128i a = _mm_loadu_si128(pa);
+            // x <= y  <=>  saturating x - y == 0 (SSE2 has no unsigned compare)
+            t2[j] = _mm_cmpeq_epi16(_mm_subs_epu16(_mm_adds_epu16(s, trig), a), zero);
+            r2[j] = _mm_cmpeq_epi16(_mm_subs_epu16(a, _mm_adds_epu16(s, rst)), zero);
+        }
+        trigger |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_packs_epi16(t2[0], t2[1])) << i;
+        reset   |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_packs_epi16(r2[0], r2[1])) << i;
+    }
+    *pTrigger = trigger;
+    *pReset = reset;
+}
+
+#else
+
+#define buildMasks buildMasksScalar
+
+#endif
+
+// Run the hysteresis state machine over one block's masks.
+// `*pArmed` is true while waiting for a dip, false while waiting for reset.
+static int scanMasks(uint64_t trigger, uint64_t reset, int n, bool *pArmed)
+{
+    uint64_t valid = (n >= 64) ? ~0ULL : ((1ULL << n) - 1);
+    trigger &= valid;
+    reset &= valid;
+
+    int dips = 0;
+    int pos = 0;
+    bool armed = *pArmed;
+    while (pos < n) {
+        uint64_t pending = (armed ? trigger : reset) >> pos;
+        if (pending == 0) {
+            break;
+        }
+        pos += __builtin_ctzll(pending);
+        dips += armed;
+        armed = !armed;
+        pos++;
+    }
+    *pArmed = armed;
+    return dips;
+}
+
+int Dips_countRaw(const uint16_t *samples, const uint16_t *avgs_q4, int n, DipConfigRaw cfg)
+{
+    DipDetector det;
+    DipDetector_init(&det, cfg);
+    return DipDetector_pushBlock(&det, samples, avgs_q4, n);
+}
+
+void DipDetector_init(DipDetector *pDet, DipConfigRaw cfg)
+{
+    pDet->cfg = cfg;
+    pDet->armed = true;
+    pDet->totalDips = 0;
+    pDet->windowDips = 0;
+}
+
+bool DipDetector_push(DipDetector *pDet, uint16_t sample, uint16_t avg_q4)
+{
+    int32_t s = (int32_t)sample << DIPS_Q4_SHIFT;
+    int32_t a = avg_q4;
+
+    if (pDet->armed) {
+        if (s <= a - pDet->cfg.trigger_q4) {
+            pDet->armed = false;
+            pDet->totalDips++;
+            pDet->windowDips++;
+            return true;
+        }
+    } else if (s >= a - pDet->cfg.reset_q4) {
+        pDet->armed = true;
+    }
+    return false;
+}
+
+int DipDetector_pushBlock(DipDetector *pDet, const uint16_t *samples, const uint16_t *avgs_q4, int n)
+{
+    if (!samples || !avgs_q4 || n <= 0) return 0;
+
+    int dips = 0;
+    for (int i = 0; i < n; i += DIPS_BLOCK) {
+        int len = (n - i < DIPS_BLOCK) ? n - i : DIPS_BLOCK;
+        uint64_t trigger, reset;
+        buildMasks(samples + i, avgs_q4 + i, len, pDet->cfg, &trigger, &reset);
+        dips += scanMasks(trigger, reset, len, &pDet->armed);
+    }
+    pDet->totalDips += dips;
+    pDet->windowDips += dips;
+    return dips;
+}
+
+int DipDetector_takeWindow(DipDetector *pDet)
+{
+    int dips = pDet->windowDips;
+    pDet->windowDips = 0;
+    return dips;
+}
@@ -1,22 +1,19 @@
 #include "hal/encoder.h"
-#include <gpiod.h>
-#include <pthread.h>
+#include "hal/rotary_encoder.h"
+#include "hal/eventloop.h"
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>
 
 #define CHIP_NAME "gpiochip0"
 #define LINE_A 4   // GPIO12
 #define LINE_B 16  // GPIO13
 
-static struct gpiod_chip *chip = NULL;
-static struct gpiod_line *lineA = NULL;
-static struct gpiod_line *lineB = NULL;
-static struct gpiod_line_request *reqA = NULL;
-static struct gpiod_line_request *reqB = NULL;
+// The previous poller reported one step per change of A; two quadrature
+// steps per reported step gives the same resolution.
+#define STEPS_PER_DELTA 2
 
-static pthread_t encoderThread;
-static volatile int running = 0;
+static re_encoder *encoder = NULL;
+static int encoderFd = -1;      // watched by the event loop, if there is one
 static void (*positionCallback)(int) = NULL;
 
 // Set callback
@@ -24,78 +21,57 @@ void Encoder_setPositionCallback(void (*callback)(int)) {
     positionCallback = callback;
 }
 
-// Thread to poll encoder
-static void *encoderThreadFunc(void *arg) {
-    (void)arg;
-
-    int lastA = gpiod_line_request_get_value(reqA, 0);
-    int lastB = gpiod_line_request_get_value(reqB, 0);
-
-    while (running) {
-        int currA = gpiod_line_request_get_value(reqA, 0);
-        int currB = gpiod_line_request_get_value(reqB, 0);
-
-        if (currA != lastA) {
-            int delta = (currA == currB) ? 1 : -1;
-            if (positionCallback)
-                positionCallback(delta);
-        }
-
-        lastA = currA;
-        lastB = currB;
-        usleep(1000); // 1 ms
-    }
+static void onPositionChanged(int32_t position, int32_t delta, int64_t timestamp_ns, void *user) {
+    (void)position;
+    (void)timestamp_ns;
+    (void)user;
+    // The poller counted A rising while B was low as -1; keep that sign.
+    if (positionCallback)
+        positionCallback(-delta);
+}
 
-    return NULL;
+static void onEdges(void *arg) {
+    (void)arg;
+    re_process_events(encoder);
 }
 
-// Initialize encoder
+// Initialize encoder: edge events, served by the event loop if it is
+// active, otherwise by the rotary encoder's own thread.
 void Encoder_init(void) {
-    chip = gpiod_chip_open_by_name(CHIP_NAME);
-    if (!chip) {
-        perror("gpiod_chip_open_by_name");
+    re_config config = {
+        .chip = CHIP_NAME,
+        .line_a = LINE_A,
+        .line_b = LINE_B,
+        .steps_per_detent = STEPS_PER_DELTA,
+        .a_bias = -1,
+        .b_bias = -1,
+        .consumer = "encoder",
+    };
+    if (re_create(&config, &encoder) != 0) {
+        perror("Encoder_init");
         exit(EXIT_FAILURE);
     }
+    re_set_position_callback(encoder, onPositionChanged, NULL);
 
-    lineA = gpiod_chip_get_line(chip, LINE_A);
-    lineB = gpiod_chip_get_line(chip, LINE_B);
-    if (!lineA || !lineB) {
-        perror("gpiod_chip_get_line");
-        gpiod_chip_close(chip);
-        exit(EXIT_FAILURE);
-    }
-
-    struct gpiod_line_request_config config;
-    config.consumer = "encoder";
-    config.request_type = GPIOD_LINE_REQUEST_DIRECTION_INPUT;
-    config.flags = 0;
-
-    reqA = gpiod_line_request(lineA, &config, 0);
-    reqB = gpiod_line_request(lineB, &config, 0);
-    if (!reqA || !reqB) {
-        perror("gpiod_line_request");
-        gpiod_chip_close(chip);
-        exit(EXIT_FAILURE);
-    }
-
-    running = 1;
-    if (pthread_create(&encoderThread, NULL, encoderThreadFunc, NULL) != 0) {
+    if (EventLoop_isActive()) {
+        encoderFd = re_get_fd(encoder);
+        if (encoderFd < 0 || EventLoop_addFd(encoderFd, onEdges, NULL) != 0) {
+            perror("Encoder_init: event loop");
+            exit(EXIT_FAILURE);
+        }
+    } else if (re_start(encoder) != 0) {
         perror("pthread_create");
-        gpiod_line_request_release(reqA);
-        gpiod_line_request_release(reqB);
-        gpiod_chip_close(chip);
+        re_destroy(encoder);
         exit(EXIT_FAILURE);
     }
 }
 
 // Cleanup encoder
 void Encoder_cleanup(void) {
-    running = 0;
-    pthread_join(encoderThread, NULL);
-
-    if (reqA) gpiod_line_request_release(reqA);
-    if (reqB) gpiod_line_request_release(reqB);
-
-    if (chip) gpiod_chip_close(chip);
+    if (encoderFd >= 0) {
+        EventLoop_removeFd(encoderFd);
+        encoderFd = -1;
+    }
+    re_destroy(encoder);    // stops the thread, if running
+    encoder = NULL;
 }
-
@@ -0,0 +1,253 @@
+#include "hal/eventloop.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#define NS_PER_SECOND 1000000000LL
+#define MAX_SIGNALS 8
+#define EPOLL_BATCH 16
+
+typedef enum {
+    WATCH_FREE,
+    WATCH_FD,
+    WATCH_TIMER,
+    WATCH_SIGNAL,
+    WATCH_WAKE,
+} watchKind_t;
+
+typedef struct {
+    watchKind_t kind;
+    int fd;
+    EventLoop_handler_t handler;
+    void *arg;
+} watch_t;
+
+typedef struct {
+    int signo;
+    EventLoop_handler_t handler;
+    void *arg;
+} signalHandler_t;
+
+static int epollFd = -1;
+static int wakeFd = -1;
+static int signalFd = -1;
+static sigset_t signalMask;
+static atomic_bool stopRequested = false;
+
+static watch_t watches[EVENTLOOP_MAX_WATCHES];
+static signalHandler_t signalHandlers[MAX_SIGNALS];
+static int numSignals = 0;
+
+static watch_t *addWatch(watchKind_t kind, int fd, EventLoop_handler_t handler, void *arg)
+{
+    for (int i = 0; i < EVENTLOOP_MAX_WATCHES; i++) {
+        if (watches[i].kind != WATCH_FREE) {
+            continue;
+        }
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &watches[i] };
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("EventLoop: epoll_ctl");
+            return NULL;
+        }
+        watches[i] = (watch_t){ .kind = kind, .fd = fd, .handler = handler, .arg = arg };
+        return &watches[i];
+    }
+    fprintf(stderr, "EventLoop: more than %d watches\n", EVENTLOOP_MAX_WATCHES);
+    return NULL;
+}
+
+static void removeWatch(watchKind_t kind, int fd)
+{
+    for (int i = 0; i < EVENTLOOP_MAX_WATCHES; i++) {
+        if (watches[i].kind == kind && watches[i].fd == fd) {
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
+            // Events for it may already be in this round's batch; a free
+            // watch is skipped when dispatched.
+            watches[i].kind = WATCH_FREE;
+            watches[i].fd = -1;
+            return;
+        }
+    }
+}
+
+void EventLoop_init(void)
+{
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epollFd < 0 || wakeFd < 0) {
+        perror("EventLoop_init");
+        exit(1);
+    }
+    for (int i = 0; i < EVENTLOOP_MAX_WATCHES; i++) {
+        watches[i].kind = WATCH_FREE;
+        watches[i].fd = -1;
+    }
+    sigemptyset(&signalMask);
+    numSignals = 0;
+    atomic_store(&stopRequested, false);
+
+    if (!addWatch(WATCH_WAKE, wakeFd, NULL, NULL)) {
+        exit(1);
+    }
+}
+
+void EventLoop_cleanup(void)
+{
+    for (int i = 0; i < EVENTLOOP_MAX_WATCHES; i++) {
+        if (watches[i].kind == WATCH_TIMER || watches[i].kind == WATCH_SIGNAL ||
+                watches[i].kind == WATCH_WAKE) {
+            close(watches[i].fd);
+        }
+        watches[i].kind = WATCH_FREE;
+        watches[i].fd = -1;
+    }
+    if (numSignals > 0) {
+        pthread_sigmask(SIG_UNBLOCK, &signalMask, NULL);
+    }
+    close(epollFd);
+    epollFd = -1;
+    wakeFd = -1;
+    signalFd = -1;
+}
+
+bool EventLoop_isActive(void)
+{
+    return epollFd >= 0;
+}
+
+int EventLoop_addFd(int fd, EventLoop_handler_t handler, void *arg)
+{
+    return addWatch(WATCH_FD, fd, handler, arg) ? 0 : -1;
+}
+
+void EventLoop_removeFd(int fd)
+{
+    removeWatch(WATCH_FD, fd);
+}
+
+int EventLoop_addTimer(long long periodNs, EventLoop_handler_t handler, void *arg)
+{
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) {
+        perror("EventLoop: timerfd_create");
+        return -1;
+    }
+    struct itimerspec spec = {
+        .it_interval = { .tv_sec = periodNs / NS_PER_SECOND, .tv_nsec = periodNs % NS_PER_SECOND },
+    };
+    spec.it_value = spec.it_interval;
+    if (timerfd_settime(fd, 0, &spec, NULL) < 0) {
+        perror("EventLoop: timerfd_settime");
+        close(fd);
+        return -1;
+    }
+    if (!addWatch(WATCH_TIMER, fd, handler, arg)) {
+        close(fd);      // addWatch() said why
+        return -1;
+    }
+    return fd;
+}
+
+void EventLoop_removeTimer(int timerId)
+{
+    removeWatch(WATCH_TIMER, timerId);
+    close(timerId);
+}
+
+int EventLoop_onSignal(int signo, EventLoop_handler_t handler, void *arg)
+{
+    if (numSignals == MAX_SIGNALS) {
+        return -1;
+    }
+    sigaddset(&signalMask, signo);
+    // Blocked here, the signal is inherited as blocked by threads created
+    // later, so it is only ever delivered through the signalfd.
+    pthread_sigmask(SIG_BLOCK, &signalMask, NULL);
+
+    bool first = (signalFd < 0);
+    signalFd = signalfd(signalFd, &signalMask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signalFd < 0) {
+        perror("EventLoop: signalfd");
+        return -1;
+    }
+    if (first && !addWatch(WATCH_SIGNAL, signalFd, NULL, NULL)) {
+        return -1;
+    }
+    signalHandlers[numSignals++] = (signalHandler_t){ signo, handler, arg };
+    return 0;
+}
+
+static void dispatchSignals(void)
+{
+    struct signalfd_siginfo info;
+    while (read(signalFd, &info, sizeof(info)) == sizeof(info)) {
+        for (int i = 0; i < numSignals; i++) {
+            if ((int)info.ssi_signo == signalHandlers[i].signo) {
+                signalHandlers[i].handler(signalHandlers[i].arg);
+            }
+        }
+    }
+}
+
+static void dispatch(watch_t *pWatch)
+{
+    uint64_t count;
+    switch (pWatch->kind) {
+    case WATCH_FD:
+        pWatch->handler(pWatch->arg);
+        break;
+    case WATCH_TIMER:
+        // Reading clears the expiration count; late ticks coalesce.
+        if (read(pWatch->fd, &count, sizeof(count)) == sizeof(count)) {
+            pWatch->handler(pWatch->arg);
+        }
+        break;
+    case WATCH_SIGNAL:
+        dispatchSignals();
+        break;
+    case WATCH_WAKE:
+        if (read(pWatch->fd, &count, sizeof(count)) < 0) {
+            // Nothing pending: already drained.
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void EventLoop_run(void)
+{
+    struct epoll_event events[EPOLL_BATCH];
+
+    while (!atomic_load(&stopRequested)) {
+        int n = epoll_wait(epollFd, events, EPOLL_BATCH, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("EventLoop: epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n && !atomic_load(&stopRequested); i++) {
+            dispatch(events[i].data.ptr);
+        }
+    }
+}
+
+void EventLoop_stop(void)
+{
+    atomic_store(&stopRequested, true);
+    if (wakeFd >= 0) {
+        uint64_t one = 1;
+        if (write(wakeFd, &one, sizeof(one)) < 0) {
+            // Counter full: the loop is already due to wake.
+        }
+    }
+}
@@ -0,0 +1,82 @@
+#include "hal/histogram.h"
+#include <string.h>
+
+#define MAX_VALUE ((1LL << HISTOGRAM_MAX_BITS) - 1)
+
+// Values below HISTOGRAM_SUB_BUCKETS have a bucket each. Above that, the
+// bucket is the position of the leading 1 bit (the group) and the next
+// HISTOGRAM_SUB_BITS bits below it.
+static int bucketOf(long long value)
+{
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return (int)value;
+    }
+    int msb = 63 - __builtin_clzll((unsigned long long)value);
+    int group = msb - HISTOGRAM_SUB_BITS + 1;
+    int sub = (int)(value >> (msb - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1);
+    return group * HISTOGRAM_SUB_BUCKETS + sub;
+}
+
+// Largest value that lands in `bucket`.
+static long long bucketTop(int bucket)
+{
+    if (bucket < HISTOGRAM_SUB_BUCKETS) {
+        return bucket;
+    }
+    int group = bucket / HISTOGRAM_SUB_BUCKETS;
+    int sub = bucket % HISTOGRAM_SUB_BUCKETS;
+    long long width = 1LL << (group - 1);
+    return (HISTOGRAM_SUB_BUCKETS + sub) * width + width - 1;
+}
+
+void Histogram_clear(Histogram_t *pHist)
+{
+    memset(pHist, 0, sizeof(*pHist));
+}
+
+void Histogram_record(Histogram_t *pHist, long long value)
+{
+    if (value < 0) value = 0;
+    if (value > MAX_VALUE) value = MAX_VALUE;
+
+    if (pHist->total == 0 || value < pHist->min) pHist->min = value;
+    if (pHist->total == 0 || value > pHist->max) pHist->max = value;
+    pHist->counts[bucketOf(value)]++;
+    pHist->total++;
+}
+
+void Histogram_merge(Histogram_t *pInto, const Histogram_t *pFrom)
+{
+    if (pFrom->total == 0) {
+        return;
+    }
+    if (pInto->total == 0 || pFrom->min < pInto->min) pInto->min = pFrom->min;
+    if (pInto->total == 0 || pFrom->max > pInto->max) pInto->max = pFrom->max;
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        pInto->counts[b] += pFrom->counts[b];
+    }
+    pInto->total += pFrom->total;
+}
+
+long long Histogram_percentile(const Histogram_t *pHist, double percent)
+{
+    if (pHist->total == 0) {
+        return 0;
+    }
+    // Rank of the value wanted, from 1.
+    uint64_t rank = (uint64_t)(percent / 100.0 * pHist->total + 0.999999);
+    if (rank < 1) rank = 1;
+    if (rank > pHist->total) rank = pHist->total;
+
+    uint64_t seen = 0;
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        seen += pHist->counts[b];
+        if (seen >= rank) {
+            long long top = bucketTop(b);
+            if (top > pHist->max) top = pHist->max;
+            if (top < pHist->min) top = pHist->min;
+            return top;
+        }
+    }
+    return pHist->max;
+}
@@ -0,0 +1,198 @@
+#include "hal/history_codec.h"
+#include "hal/adc_hal.h"
+#include <stdio.h>
+#include <string.h>
+
+#define VALUES_PER_LINE 10
+#define MAX_VARINT_BYTES 3      // enough for a zigzag delta of 12-bit codes
+
+static void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    put16(p, v & 0xFFFF);
+    put16(p + 2, v >> 16);
+}
+
+static void put64(uint8_t *p, uint64_t v)
+{
+    put32(p, v & 0xFFFFFFFF);
+    put32(p + 4, v >> 32);
+}
+
+static int putVarint(uint8_t *p, uint32_t v)
+{
+    int n = 0;
+    while (v >= 0x80) {
+        p[n++] = (v & 0x7F) | 0x80;
+        v >>= 7;
+    }
+    p[n++] = v;
+    return n;
+}
+
+static uint32_t zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+// Encode up to `remaining` samples into [out, out + cap). Returns the
+// bytes used and sets *pCount to the samples that fit.
+static int encodeSamples(const uint16_t *samples, int remaining, History_encoding_t encoding,
+                         uint8_t *out, int cap, int *pCount)
+{
+    int used = 0;
+    int count = 0;
+
+    if (encoding == HISTORY_ENC_RAW) {
+        count = cap / (int)sizeof(uint16_t);
+        if (count > remaining) count = remaining;
+        for (int i = 0; i < count; i++) {
+            put16(out + used, samples[i]);
+            used += sizeof(uint16_t);
+        }
+    } else {
+        int32_t prev = 0;
+        while (count < remaining && cap - used >= MAX_VARINT_BYTES) {
+            int32_t code = samples[count];
+            used += putVarint(out + used, zigzag(code - prev));
+            prev = code;
+            count++;
+        }
+    }
+
+    *pCount = count;
+    return used;
+}
+
+int History_encodeDatagram(const History_reply_t *pReply, uint16_t seq, int first,
+                           uint8_t *out, int cap, int *pConsumed)
+{
+    int count = 0;
+    int used = HISTORY_V2_HEADER_SIZE +
+        encodeSamples(pReply->samples + first, pReply->totalSamples - first, pReply->encoding,
+                      out + HISTORY_V2_HEADER_SIZE, cap - HISTORY_V2_HEADER_SIZE, &count);
+
+    uint16_t flags = (first + count >= pReply->totalSamples) ? HISTORY_V2_FLAG_LAST : 0;
+
+    memcpy(out, HISTORY_V2_MAGIC, 4);
+    out[4] = HISTORY_V2_VERSION;
+    out[5] = (uint8_t)pReply->encoding;
+    put16(out + 6, seq);
+    put16(out + 8, flags);
+    put16(out + 10, 0);
+    put32(out + 12, pReply->replyId);
+    put32(out + 16, pReply->sampleRateHz);
+    put32(out + 20, first);
+    put32(out + 24, count);
+    put32(out + 28, pReply->totalSamples);
+    put64(out + 32, pReply->startTimeNs);
+
+    *pConsumed = count;
+    return used;
+}
+
+int History_encodeStreamDatagram(const History_stream_t *pStream, const uint16_t *samples,
+                                 int n, uint8_t *out, int cap, int *pConsumed)
+{
+    int count = 0;
+    int used = HISTORY_STREAM_HEADER_SIZE +
+        encodeSamples(samples, n, HISTORY_ENC_DELTA,
+                      out + HISTORY_STREAM_HEADER_SIZE, cap - HISTORY_STREAM_HEADER_SIZE, &count);
+
+    memcpy(out, HISTORY_STREAM_MAGIC, 4);
+    out[4] = HISTORY_STREAM_VERSION;
+    out[5] = (uint8_t)HISTORY_ENC_DELTA;
+    put16(out + 6, 0);
+    put32(out + 8, pStream->seq);
+    put32(out + 12, pStream->dropped);
+    put64(out + 16, pStream->firstSample);
+    put32(out + 24, count);
+    put32(out + 28, pStream->sampleRateHz);
+
+    *pConsumed = count;
+    return used;
+}
+
+int History_encodePlot(const History_plot_t *pPlot, uint8_t *out)
+{
+    int max = (pPlot->method == HISTORY_PLOT_MINMAX) ? HISTORY_PLOT_MAX_MINMAX : HISTORY_PLOT_MAX_LTTB;
+    int points = (pPlot->points < max) ? pPlot->points : max;
+    int used = HISTORY_PLOT_HEADER_SIZE;
+
+    for (int i = 0; i < points; i++) {
+        if (pPlot->method == HISTORY_PLOT_MINMAX) {
+            put16(out + used, pPlot->mins[i]);
+            put16(out + used + 2, pPlot->maxs[i]);
+            used += 4;
+        } else {
+            put32(out + used, pPlot->indices[i]);
+            put16(out + used + 4, pPlot->values[i]);
+            used += 6;
+        }
+    }
+
+    memcpy(out, HISTORY_PLOT_MAGIC, 4);
+    out[4] = HISTORY_PLOT_VERSION;
+    out[5] = (uint8_t)pPlot->method;
+    put16(out + 6, points);
+    put32(out + 8, pPlot->firstSecond);
+    put32(out + 12, pPlot->seconds);
+    put32(out + 16, pPlot->totalSamples);
+    put32(out + 20, pPlot->sampleRateHz);
+    put64(out + 24, pPlot->startTimeNs);
+    return used;
+}
+
+int History_encodeSummary(const History_summary_t *pSummary, uint8_t *out)
+{
+    memcpy(out, HISTORY_SUMMARY_MAGIC, 4);
+    out[4] = HISTORY_SUMMARY_VERSION;
+    out[5] = 0;
+    put16(out + 6, HISTORY_SUMMARY_SIZE);
+    put32(out + 8, pSummary->seq);
+    put32(out + 12, pSummary->second);
+    put64(out + 16, pSummary->startTimeNs);
+    put32(out + 24, pSummary->samples);
+    put32(out + 28, pSummary->pwmFrequencyHz);
+    put32(out + 32, pSummary->averageMicrovolts);
+    put32(out + 36, pSummary->dips);
+    put32(out + 40, pSummary->minPeriodUs);
+    put32(out + 44, pSummary->maxPeriodUs);
+    put32(out + 48, pSummary->avgPeriodUs);
+    put32(out + 52, pSummary->overruns);
+    return HISTORY_SUMMARY_SIZE;
+}
+
+int History_formatText(const uint16_t *samples, int totalSamples, int first,
+                       char *out, int cap, int *pConsumed)
+{
+    char line[VALUES_PER_LINE * 8 + 2];
+    int len = 0;
+    int i = first;
+
+    out[0] = '\0';
+    while (i < totalSamples) {
+        // Build one line, then keep it only if it fits whole.
+        int lineLen = 0;
+        int end = i + VALUES_PER_LINE;
+        if (end > totalSamples) end = totalSamples;
+        for (int j = i; j < end; j++) {
+            lineLen += snprintf(line + lineLen, sizeof(line) - lineLen, "%.3f%s",
+                                ADC_rawToVolts(samples[j]), (j < end - 1) ? ", " : "\n");
+        }
+        if (len + lineLen >= cap) {
+            break;
+        }
+        memcpy(out + len, line, lineLen + 1);
+        len += lineLen;
+        i = end;
+    }
+
+    *pConsumed = i - first;
+    return len;
+}
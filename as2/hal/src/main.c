@@ -3,24 +3,46 @@
 #include <unistd.h>
 #include <stdlib.h>
 
+#include "hal/eventloop.h"
 #include "hal/sampler.h"
 #include "hal/pwm_hal.h"
 #include "hal/udp_listener.h"
 #include "hal/periodTimer.h"
 #include "hal/reporter.h"
 #include "hal/encoder.h"
+#include "hal/metrics.h"
+#include "hal/broadcast.h"
+#include "hal/probe.h"
 
-volatile int keepRunning = 1;
+// Seconds of probe records SIGUSR1 dumps
+#define TRACE_SIGNAL_SECONDS 10
 
 // Current PWM frequency index
 static size_t currentIndex = 0;
 static int pwmFrequencies[] = {12, 16, 22, 29, 32, 37, 45};
 static size_t numFrequencies = sizeof(pwmFrequencies) / sizeof(pwmFrequencies[0]);
 
-// Handle Ctrl+C
-void sigintHandler(int sig) {
-    (void)sig;
-    keepRunning = 0;
+// Handle Ctrl+C (delivered by the event loop, not as a signal handler)
+static void onStopSignal(void* arg) {
+    (void)arg;
+    EventLoop_stop();
+}
+
+// On the probes' worker thread, when a SIGUSR1 trace is written
+static void onTraceWritten(long events, void* arg) {
+    (void)arg;
+    if (events >= 0) {
+        printf("Trace: %ld events -> %s\n", events, PROBE_TRACE_PATH);
+    }
+}
+
+// kill -USR1 dumps the recent timing probes, for when UDP isn't at hand
+// (on a worker: the loop carries on meanwhile)
+static void onTraceSignal(void* arg) {
+    (void)arg;
+    if (Probe_startChromeTrace(PROBE_TRACE_PATH, TRACE_SIGNAL_SECONDS, onTraceWritten, NULL) != 0) {
+        printf("Trace: already writing one\n");
+    }
 }
 
 // Callback for encoder changes
@@ -39,14 +61,29 @@ void encoderPositionChanged(int delta) {
 }
 
 int main(void) {
-    // Register Ctrl+C handler
-    signal(SIGINT, sigintHandler);
-
-    // Initialize modules
-    Sampler_init();
+    // Everything but ADC sampling runs on this thread's event loop. Set
+    // it up (and block the stop signals) before any thread starts.
+    EventLoop_init();
+    EventLoop_onSignal(SIGINT, onStopSignal, NULL);
+    EventLoop_onSignal(SIGTERM, onStopSignal, NULL);
+    EventLoop_onSignal(SIGUSR1, onTraceSignal, NULL);
+
+    // Initialize modules (the sampler marks periods from its first sample)
+    Sampler_config_t samplerConfig = Sampler_defaultConfig();
+    Period_init();
+    // A sample period more than twice as long as it should be is a miss.
+    Period_setDeadline(PERIOD_EVENT_SAMPLE_LIGHT, 2 * 1000.0 / samplerConfig.sampleRateHz);
+    Sampler_init(&samplerConfig);
     PWM_init();
     UDP_init();
-    Period_init();
+    const char* metricsPort = getenv(METRICS_ENV);
+    if (metricsPort) {
+        Metrics_init(atoi(metricsPort));
+    }
+    const char* summaryTargets = getenv(BROADCAST_ENV);
+    if (summaryTargets && Broadcast_init(summaryTargets) != 0) {
+        exit(1);
+    }
     Reporter_start();
 
     // Initialize encoder
@@ -59,17 +96,19 @@ int main(void) {
 
     printf("Starting main loop. Ctrl+C to exit...\n");
 
-    while (keepRunning) {
-        sleep(1); // main loop sleeps, encoder thread handles changes
-    }
+    // Returns on Ctrl+C / SIGTERM or the UDP "stop" command.
+    EventLoop_run();
 
     // Cleanup modules
     Encoder_cleanup();
     Reporter_stop();
+    Broadcast_cleanup();
     PWM_cleanup();
+    Metrics_cleanup();
     UDP_cleanup();
     Sampler_cleanup();
     Period_cleanup();
+    EventLoop_cleanup();
 
     printf("Exiting cleanly...\n");
     return 0;
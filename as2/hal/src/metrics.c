@@ -0,0 +1,354 @@
+#define _GNU_SOURCE  // accept4()
+
+#include "hal/metrics.h"
+#include "hal/sampler.h"
+#include "hal/periodTimer.h"
+#include "hal/udp_listener.h"
+#include "hal/subscriptions.h"
+#include "hal/eventloop.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+#define REQUEST_MAX 1024
+#define BODY_MAX 16384
+
+typedef struct {
+    int fd;                     // -1 when free
+    int len;
+    char request[REQUEST_MAX];
+    long long acceptOrder;      // the oldest is dropped to make room
+} client_t;
+
+static int listenFd = -1;
+static client_t clients[METRICS_MAX_CLIENTS];
+static long long acceptCount = 0;
+
+// Without the event loop: our own thread, woken by wakeFd to exit.
+static bool ownThread = false;
+static pthread_t serverThread;
+static int wakeFd = -1;
+
+// Only one scrape is formatted at a time (event loop or server thread).
+static char body[BODY_MAX];
+static char response[BODY_MAX + 256];
+
+
+
+// ---- Formatting ----
+typedef struct {
+    char *buf;
+    int cap;
+    int len;
+} writer_t;
+
+__attribute__((format(printf, 2, 3)))
+static void put(writer_t *pW, const char *fmt, ...)
+{
+    if (pW->len >= pW->cap - 1) {
+        return;
+    }
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(pW->buf + pW->len, pW->cap - pW->len, fmt, args);
+    va_end(args);
+    pW->len += (n < pW->cap - pW->len) ? n : pW->cap - pW->len - 1;
+}
+
+static void header(writer_t *pW, const char *name, const char *type, const char *help)
+{
+    put(pW, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+int Metrics_format(char *buf, int cap)
+{
+    writer_t w = { .buf = buf, .cap = cap, .len = 0 };
+    buf[0] = '\0';
+
+    header(&w, "as2_samples_total", "counter", "Light samples taken since start.");
+    put(&w, "as2_samples_total %lld\n", Sampler_getNumSamplesTaken());
+    header(&w, "as2_samples_last_second", "gauge", "Samples in the last completed second.");
+    put(&w, "as2_samples_last_second %d\n", Sampler_getHistorySize());
+    header(&w, "as2_sample_rate_hz", "gauge", "Configured sample rate.");
+    put(&w, "as2_sample_rate_hz %d\n", Sampler_getSampleRateHz());
+    header(&w, "as2_sample_overruns_total", "counter", "Sample periods missed entirely.");
+    put(&w, "as2_sample_overruns_total %lld\n", Sampler_getNumOverruns());
+    header(&w, "as2_samples_discarded_total", "counter",
+           "Samples left out of the history because a second's buffer was full.");
+    put(&w, "as2_samples_discarded_total %lld\n", Sampler_getNumSamplesDiscarded());
+    header(&w, "as2_history_seconds_dropped_total", "counter",
+           "Completed seconds dropped because readers held every spare history buffer.");
+    put(&w, "as2_history_seconds_dropped_total %lld\n", Sampler_getNumSecondsDropped());
+    header(&w, "as2_history_dips_dropped_total", "counter",
+           "Dips in the dropped seconds (in as2_dips_total, but in no second).");
+    put(&w, "as2_history_dips_dropped_total %lld\n", Sampler_getNumDipsDropped());
+    header(&w, "as2_dips_total", "counter", "Dips detected since start.");
+    put(&w, "as2_dips_total %lld\n", Sampler_getDipEventHead());
+    header(&w, "as2_dips_last_second", "gauge", "Dips in the last completed second.");
+    put(&w, "as2_dips_last_second %d\n", Sampler_countDips());
+    header(&w, "as2_light_average_volts", "gauge", "Exponential moving average of the light level.");
+    put(&w, "as2_light_average_volts %.4f\n", Sampler_getAverageReading());
+
+    header(&w, "as2_period_ms", "gauge",
+           "Time between marks of a periodic event over its last reporting interval.");
+    for (int e = 0; e < NUM_PERIOD_EVENTS; e++) {
+        Period_statistics_t st;
+        Period_getLastStatistics(e, &st);
+        put(&w, "as2_period_ms{event=\"%s\",stat=\"min\"} %.4f\n", Period_getEventName(e), st.minPeriodInMs);
+        put(&w, "as2_period_ms{event=\"%s\",stat=\"avg\"} %.4f\n", Period_getEventName(e), st.avgPeriodInMs);
+        put(&w, "as2_period_ms{event=\"%s\",stat=\"max\"} %.4f\n", Period_getEventName(e), st.maxPeriodInMs);
+        put(&w, "as2_period_ms{event=\"%s\",stat=\"stddev\"} %.4f\n", Period_getEventName(e), st.stdDevPeriodInMs);
+        put(&w, "as2_period_ms{event=\"%s\",stat=\"p50\"} %.4f\n", Period_getEventName(e), st.p50PeriodInMs);
+        put(&w, "as2_period_ms{event=\"%s\",stat=\"p90\"} %.4f\n", Period_getEventName(e), st.p90PeriodInMs);
+        put(&w, "as2_period_ms{event=\"%s\",stat=\"p99\"} %.4f\n", Period_getEventName(e), st.p99PeriodInMs);
+        put(&w, "as2_period_ms{event=\"%s\",stat=\"p99.9\"} %.4f\n", Period_getEventName(e), st.p999PeriodInMs);
+    }
+    header(&w, "as2_period_deadline_misses", "gauge",
+           "Periods longer than the event's deadline in its last reporting interval.");
+    for (int e = 0; e < NUM_PERIOD_EVENTS; e++) {
+        Period_statistics_t st;
+        Period_getLastStatistics(e, &st);
+        put(&w, "as2_period_deadline_misses{event=\"%s\"} %d\n", Period_getEventName(e), st.numDeadlineMisses);
+    }
+    header(&w, "as2_period_marks", "gauge", "Marks of a periodic event in its last reporting interval.");
+    for (int e = 0; e < NUM_PERIOD_EVENTS; e++) {
+        Period_statistics_t st;
+        Period_getLastStatistics(e, &st);
+        put(&w, "as2_period_marks{event=\"%s\"} %d\n", Period_getEventName(e), st.numSamples);
+    }
+    header(&w, "as2_period_marks_dropped", "gauge",
+           "Marks of a periodic event lost (buffer full) in its last reporting interval.");
+    for (int e = 0; e < NUM_PERIOD_EVENTS; e++) {
+        Period_statistics_t st;
+        Period_getLastStatistics(e, &st);
+        put(&w, "as2_period_marks_dropped{event=\"%s\"} %lld\n", Period_getEventName(e), st.numDropped);
+    }
+
+    UDP_stats_t udp;
+    UDP_getStats(&udp);
+    header(&w, "as2_udp_packets_total", "counter", "UDP datagrams received and sent.");
+    put(&w, "as2_udp_packets_total{direction=\"in\"} %lld\n", udp.packetsIn);
+    put(&w, "as2_udp_packets_total{direction=\"out\"} %lld\n", udp.packetsOut);
+    header(&w, "as2_udp_commands_accepted_total", "counter", "Commands let through the rate limits.");
+    put(&w, "as2_udp_commands_accepted_total %lld\n", udp.accepted);
+    header(&w, "as2_udp_commands_shed_total", "counter", "Commands dropped by the rate limits.");
+    put(&w, "as2_udp_commands_shed_total{reason=\"source\"} %lld\n", udp.shedSource);
+    put(&w, "as2_udp_commands_shed_total{reason=\"global\"} %lld\n", udp.shedGlobal);
+    put(&w, "as2_udp_commands_shed_total{reason=\"heavy\"} %lld\n", udp.shedHeavy);
+    header(&w, "as2_udp_unknown_commands_total", "counter", "Commands with no handler.");
+    put(&w, "as2_udp_unknown_commands_total %lld\n", udp.unknownCommands);
+
+    UDP_commandStats_t cmds[UDP_MAX_COMMANDS];
+    int numCmds = UDP_getCommandStats(cmds, UDP_MAX_COMMANDS);
+    header(&w, "as2_udp_command_calls_total", "counter", "Calls per command.");
+    for (int i = 0; i < numCmds; i++) {
+        put(&w, "as2_udp_command_calls_total{command=\"%s\"} %lld\n", cmds[i].name, cmds[i].calls);
+    }
+    header(&w, "as2_udp_command_seconds_total", "counter", "Time spent handling each command.");
+    for (int i = 0; i < numCmds; i++) {
+        put(&w, "as2_udp_command_seconds_total{command=\"%s\"} %.6f\n", cmds[i].name, cmds[i].totalNs / 1e9);
+    }
+
+    Subscriptions_stats_t subs;
+    Subscriptions_getStats(&subs);
+    header(&w, "as2_subscriptions_active", "gauge", "Active push subscriptions.");
+    put(&w, "as2_subscriptions_active %d\n", subs.active);
+    header(&w, "as2_subscription_datagrams_total", "counter", "Datagrams pushed to subscribers.");
+    put(&w, "as2_subscription_datagrams_total %lld\n", subs.datagramsSent);
+    header(&w, "as2_subscription_drops_total", "counter", "Datagrams and items lost by subscribers.");
+    put(&w, "as2_subscription_drops_total{what=\"send_failures\"} %lld\n", subs.sendFailures);
+    put(&w, "as2_subscription_drops_total{what=\"items\"} %lld\n", subs.itemsDropped);
+
+    return w.len;
+}
+
+
+// ---- HTTP ----
+static void closeClient(client_t *pClient)
+{
+    if (!ownThread) {
+        EventLoop_removeFd(pClient->fd);
+    }
+    close(pClient->fd);
+    pClient->fd = -1;
+}
+
+static void respond(client_t *pClient)
+{
+    bool isMetrics = strncmp(pClient->request, "GET /metrics ", 13) == 0 ||
+                     strncmp(pClient->request, "GET / ", 6) == 0;
+    int len;
+    if (isMetrics) {
+        int bodyLen = Metrics_format(body, sizeof(body));
+        len = snprintf(response, sizeof(response),
+                       "HTTP/1.0 200 OK\r\n"
+                       "Content-Type: text/plain; version=0.0.4\r\n"
+                       "Content-Length: %d\r\n"
+                       "Connection: close\r\n\r\n%s", bodyLen, body);
+    } else {
+        len = snprintf(response, sizeof(response),
+                       "HTTP/1.0 404 Not Found\r\n"
+                       "Content-Length: 0\r\n"
+                       "Connection: close\r\n\r\n");
+    }
+    // The reply is small enough for the socket buffer; never wait on a
+    // slow reader (it can scrape again).
+    if (send(pClient->fd, response, len, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+        perror("Metrics: send");
+    }
+    closeClient(pClient);
+}
+
+static void onClientReadable(void *arg)
+{
+    client_t *pClient = arg;
+    int n = recv(pClient->fd, pClient->request + pClient->len,
+                 REQUEST_MAX - 1 - pClient->len, MSG_DONTWAIT);
+    if (n <= 0) {
+        closeClient(pClient);
+        return;
+    }
+    pClient->len += n;
+    pClient->request[pClient->len] = '\0';
+
+    // Only the request line matters; answer once the headers are in
+    // (or the buffer is full).
+    if (strstr(pClient->request, "\r\n\r\n") || strstr(pClient->request, "\n\n") ||
+            pClient->len == REQUEST_MAX - 1) {
+        respond(pClient);
+    }
+}
+
+static void onListenReadable(void *arg)
+{
+    (void)arg;
+    int fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+
+    client_t *pFree = NULL;
+    client_t *pOldest = &clients[0];
+    for (int i = 0; i < METRICS_MAX_CLIENTS; i++) {
+        if (clients[i].fd < 0 && !pFree) {
+            pFree = &clients[i];
+        }
+        if (clients[i].acceptOrder < pOldest->acceptOrder) {
+            pOldest = &clients[i];
+        }
+    }
+    if (!pFree) {
+        // A client that connects and never sends must not lock us out.
+        closeClient(pOldest);
+        pFree = pOldest;
+    }
+
+    pFree->fd = fd;
+    pFree->len = 0;
+    pFree->acceptOrder = ++acceptCount;
+    if (!ownThread && EventLoop_addFd(fd, onClientReadable, pFree) < 0) {
+        close(fd);
+        pFree->fd = -1;
+    }
+}
+
+static void* serverFunc(void *arg)
+{
+    (void)arg;
+    struct pollfd fds[2 + METRICS_MAX_CLIENTS];
+
+    while (true) {
+        fds[0] = (struct pollfd){ .fd = wakeFd, .events = POLLIN };
+        fds[1] = (struct pollfd){ .fd = listenFd, .events = POLLIN };
+        for (int i = 0; i < METRICS_MAX_CLIENTS; i++) {
+            fds[2 + i] = (struct pollfd){ .fd = clients[i].fd, .events = POLLIN };
+        }
+        if (poll(fds, 2 + METRICS_MAX_CLIENTS, -1) <= 0) {
+            continue;
+        }
+        if (fds[0].revents) {
+            break;
+        }
+        for (int i = 0; i < METRICS_MAX_CLIENTS; i++) {
+            if (fds[2 + i].revents && clients[i].fd >= 0) {
+                onClientReadable(&clients[i]);
+            }
+        }
+        if (fds[1].revents) {
+            onListenReadable(NULL);
+        }
+    }
+    return NULL;
+}
+
+int Metrics_init(int port)
+{
+    for (int i = 0; i < METRICS_MAX_CLIENTS; i++) {
+        clients[i].fd = -1;
+        clients[i].acceptOrder = 0;
+    }
+
+    listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd < 0) {
+        perror("Metrics: socket");
+        return -1;
+    }
+    int one = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = INADDR_ANY;
+    if (bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listenFd, 8) < 0) {
+        perror("Metrics: bind/listen");
+        close(listenFd);
+        listenFd = -1;
+        return -1;
+    }
+
+    ownThread = !EventLoop_isActive();
+    if (ownThread) {
+        wakeFd = eventfd(0, EFD_CLOEXEC);
+        pthread_create(&serverThread, NULL, serverFunc, NULL);
+    } else if (EventLoop_addFd(listenFd, onListenReadable, NULL) < 0) {
+        close(listenFd);
+        listenFd = -1;
+        return -1;
+    }
+    printf("Metrics on http://0.0.0.0:%d/metrics\n", port);
+    return 0;
+}
+
+void Metrics_cleanup(void)
+{
+    if (listenFd < 0) {
+        return;
+    }
+    if (ownThread) {
+        uint64_t one = 1;
+        if (write(wakeFd, &one, sizeof(one)) < 0) {
+            perror("Metrics_cleanup: eventfd");
+        }
+        pthread_join(serverThread, NULL);
+        close(wakeFd);
+        wakeFd = -1;
+    } else {
+        EventLoop_removeFd(listenFd);
+    }
+    for (int i = 0; i < METRICS_MAX_CLIENTS; i++) {
+        if (clients[i].fd >= 0) {
+            closeClient(&clients[i]);
+        }
+    }
+    close(listenFd);
+    listenFd = -1;
+}
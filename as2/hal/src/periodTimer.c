@@ -2,40 +2,152 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 #include <string.h>
+#include <math.h>
+#include <sched.h>
 
 #include "hal/periodTimer.h"
+#include "hal/timestamp.h"
 
 // Written by Brian Fraser
 
+#define RING_MASK (MAX_EVENT_TIMESTAMPS - 1)
+#define CACHE_LINE 64
 
+// How long a read waits for a thread to finish updating a set of
+// statistics: spins, then yields, then leaves the set for the next read.
+#define STREAM_SPINS 1000
+#define STREAM_YIELDS 10
 
-// Data collected
+// Running statistics over a sequence of periods (ns)
+typedef struct {
+    long count;
+    long long sumNs;
+    long long minNs;
+    long long maxNs;
+    double mean;                // Welford: running mean and sum of squared
+    double m2;                  // differences from it
+    int deadlineMisses;
+    Histogram_t hist;
+} periods_t;
+
+// Data collected (PERIOD_RECORD_LOCKED)
 typedef struct {
     // Store the timestamp samples each time we mark an event.
     long timestampCount;
     long long timestampsInNs[MAX_EVENT_TIMESTAMPS];
-
-    // Used for recording the event between analysis periods.
-    long long prevTimestampInNs;
 } timestamps_t;
 static timestamps_t s_eventData[NUM_PERIOD_EVENTS];
 
+// Used for recording the event between analysis periods.
+static long long s_prevTimestampInNs[NUM_PERIOD_EVENTS];
+
+// Data collected (PERIOD_RECORD_LOCKFREE): one single-producer ring per
+// event for each recording thread. The owning thread only advances
+// head; the reader (under s_lock) only advances tail.
+typedef struct {
+    _Alignas(CACHE_LINE) atomic_ulong head;
+    _Alignas(CACHE_LINE) atomic_ulong tail;
+    long long timestampsInNs[MAX_EVENT_TIMESTAMPS];
+} ring_t;
+
+// Data collected (PERIOD_RECORD_STREAMING): two sets of statistics per
+// event for each recording thread. The thread adds to periods[active];
+// a read flips `active` and takes the other set once the thread is no
+// longer inside it (`writing` is the set being updated + 1, or 0).
+typedef struct {
+    _Alignas(CACHE_LINE) atomic_int active;
+    atomic_int writing;
+    long long prevInNs;         // owning thread only
+    periods_t periods[2];
+} stream_t;
+
+enum {
+    THREAD_FREE,
+    THREAD_IN_USE,
+    THREAD_RETIRED,     // its thread exited; freed once drained
+};
+
+typedef struct {
+    atomic_int state;
+    ring_t rings[NUM_PERIOD_EVENTS];
+    stream_t streams[NUM_PERIOD_EVENTS];
+} threadData_t;
+
+static threadData_t s_threadData[PERIOD_MAX_THREADS];
+static _Thread_local threadData_t *tl_pData = NULL;
+static _Thread_local bool tl_noData = false;     // all taken: drop this thread's marks
+static pthread_key_t s_threadKey;
+static pthread_once_t s_threadKeyOnce = PTHREAD_ONCE_INIT;
+
+static atomic_llong s_dropped[NUM_PERIOD_EVENTS];
+static atomic_llong s_deadlineNs[NUM_PERIOD_EVENTS];
+
+static const char *s_eventNames[NUM_PERIOD_EVENTS] = { "sample_light", "mark_second" };
+
+// Result of the last Period_getStatisticsAndClear(), per event.
+static Period_statistics_t s_lastStats[NUM_PERIOD_EVENTS];
+
+// Periods (ns) of the last interval, and of all intervals merged.
+static Histogram_t s_lastHist[NUM_PERIOD_EVENTS];
+static Histogram_t s_totalHist[NUM_PERIOD_EVENTS];
+
+// The interval being read (under s_lock).
+static periods_t s_interval;
+
+static Period_recordingMode_t s_mode = PERIOD_RECORD_STREAMING;
 static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
 static bool s_initialized = false;
 
 
 // Prototypes
+static void clearPeriods(periods_t *pPeriods);
+static void addPeriod(periods_t *pPeriods, long long deltaNs, long long deadlineNs);
+static void mergePeriods(periods_t *pInto, const periods_t *pFrom);
+static void accumulate(long long *pPrevInNs, long long thisTime, long long deadlineNs);
 static void updateStats(
-    timestamps_t *pData, 
+    const periods_t *pPeriods,
     Period_statistics_t *pStats
 );
-static long long getTimeInNanoS(void);
+static void drainRings(enum Period_whichEvent whichEvent, long long *pPrevInNs, long long deadlineNs);
+static void collectStreams(enum Period_whichEvent whichEvent);
+static void freeRetiredThreads(void);
+
+
+const char *Period_getEventName(enum Period_whichEvent whichEvent)
+{
+    assert (whichEvent >= 0 && whichEvent < NUM_PERIOD_EVENTS);
+    return s_eventNames[whichEvent];
+}
 
+void Period_setRecordingMode(Period_recordingMode_t mode)
+{
+    assert (!s_initialized);
+    s_mode = mode;
+}
 
 void Period_init(void)
 {
+    Timestamp_init();   // calibrate here, not on the first mark
     memset(s_eventData, 0, sizeof(s_eventData[0]) * NUM_PERIOD_EVENTS);
+    memset(s_prevTimestampInNs, 0, sizeof(s_prevTimestampInNs));
+    memset(s_lastStats, 0, sizeof(s_lastStats));
+    for (int e = 0; e < NUM_PERIOD_EVENTS; e++) {
+        atomic_store(&s_dropped[e], 0);
+        Histogram_clear(&s_lastHist[e]);
+        Histogram_clear(&s_totalHist[e]);
+    }
+    // Discard anything recorded before (the data stays with its threads).
+    for (int t = 0; t < PERIOD_MAX_THREADS; t++) {
+        for (int e = 0; e < NUM_PERIOD_EVENTS; e++) {
+            ring_t *pRing = &s_threadData[t].rings[e];
+            atomic_store(&pRing->tail, atomic_load(&pRing->head));
+            stream_t *pStream = &s_threadData[t].streams[e];
+            clearPeriods(&pStream->periods[0]);
+            clearPeriods(&pStream->periods[1]);
+        }
+    }
     s_initialized = true;
 }
 void Period_cleanup(void)
@@ -44,19 +156,99 @@ void Period_cleanup(void)
     s_initialized = false;
 }
 
+static void retireThread(void *pData)
+{
+    atomic_store(&((threadData_t *)pData)->state, THREAD_RETIRED);
+}
+
+static void createThreadKey(void)
+{
+    pthread_key_create(&s_threadKey, retireThread);
+}
+
+// First mark on this thread: take a free set of rings/statistics.
+static threadData_t *claimThreadData(void)
+{
+    pthread_once(&s_threadKeyOnce, createThreadKey);
+    for (int t = 0; t < PERIOD_MAX_THREADS; t++) {
+        int expected = THREAD_FREE;
+        if (atomic_compare_exchange_strong(&s_threadData[t].state, &expected, THREAD_IN_USE)) {
+            for (int e = 0; e < NUM_PERIOD_EVENTS; e++) {
+                s_threadData[t].streams[e].prevInNs = 0;
+            }
+            pthread_setspecific(s_threadKey, &s_threadData[t]);
+            return &s_threadData[t];
+        }
+    }
+    tl_noData = true;
+    return NULL;
+}
+
+static void markRing(ring_t *pRing, enum Period_whichEvent whichEvent)
+{
+    unsigned long head = atomic_load_explicit(&pRing->head, memory_order_relaxed);
+    unsigned long tail = atomic_load_explicit(&pRing->tail, memory_order_acquire);
+    if (head - tail >= MAX_EVENT_TIMESTAMPS) {
+        atomic_fetch_add_explicit(&s_dropped[whichEvent], 1, memory_order_relaxed);
+        return;
+    }
+    pRing->timestampsInNs[head & RING_MASK] = Timestamp_nowNs();
+    atomic_store_explicit(&pRing->head, head + 1, memory_order_release);
+}
+
+static void markStream(stream_t *pStream, enum Period_whichEvent whichEvent)
+{
+    long long now = Timestamp_nowNs();
+    long long prev = pStream->prevInNs;
+    pStream->prevInNs = now;
+    if (prev == 0) {
+        return;     // first mark on this thread: no period yet
+    }
+
+    // Announce the set we're about to update, then make sure a read
+    // didn't flip it away meanwhile (pairs with collectStreams()).
+    int set = atomic_load(&pStream->active);
+    for (;;) {
+        atomic_store(&pStream->writing, set + 1);
+        int current = atomic_load(&pStream->active);
+        if (current == set) break;
+        set = current;
+    }
+    addPeriod(&pStream->periods[set], now - prev,
+              atomic_load_explicit(&s_deadlineNs[whichEvent], memory_order_relaxed));
+    atomic_store_explicit(&pStream->writing, 0, memory_order_release);
+}
+
 void Period_markEvent(enum Period_whichEvent whichEvent)
 {
     assert (whichEvent >= 0 && whichEvent < NUM_PERIOD_EVENTS);
     assert (s_initialized);
 
+    if (s_mode != PERIOD_RECORD_LOCKED) {
+        threadData_t *pThread = tl_pData;
+        if (!pThread) {
+            pThread = tl_noData ? NULL : (tl_pData = claimThreadData());
+            if (!pThread) {
+                atomic_fetch_add_explicit(&s_dropped[whichEvent], 1, memory_order_relaxed);
+                return;
+            }
+        }
+        if (s_mode == PERIOD_RECORD_STREAMING) {
+            markStream(&pThread->streams[whichEvent], whichEvent);
+        } else {
+            markRing(&pThread->rings[whichEvent], whichEvent);
+        }
+        return;
+    }
+
     timestamps_t *pData = &s_eventData[whichEvent];
     pthread_mutex_lock(&s_lock);
     {
         if (pData->timestampCount < MAX_EVENT_TIMESTAMPS) {
-            pData->timestampsInNs[pData->timestampCount] = getTimeInNanoS();
+            pData->timestampsInNs[pData->timestampCount] = Timestamp_nowNs();
             pData->timestampCount++;
         } else {
-            printf("WARNING: No sample space for event collection on %d\n", whichEvent);
+            atomic_fetch_add_explicit(&s_dropped[whichEvent], 1, memory_order_relaxed);
         }
     }
     pthread_mutex_unlock(&s_lock);
@@ -70,15 +262,26 @@ void Period_getStatisticsAndClear(
     assert (whichEvent >= 0 && whichEvent < NUM_PERIOD_EVENTS);
     assert (s_initialized);
     timestamps_t *pData = &s_eventData[whichEvent];
+    long long deadlineNs = atomic_load(&s_deadlineNs[whichEvent]);
     pthread_mutex_lock(&s_lock);
     {
-        // Compute stats
-        updateStats(pData, pStats);
-
-        // Update the "previous" sample (if we have any)
-        if (pData->timestampCount > 0) {
-            pData->prevTimestampInNs = pData->timestampsInNs[pData->timestampCount - 1];
+        // Compute stats over everything recorded since the last call
+        clearPeriods(&s_interval);
+        if (s_mode == PERIOD_RECORD_STREAMING) {
+            collectStreams(whichEvent);
+        } else if (s_mode == PERIOD_RECORD_LOCKFREE) {
+            drainRings(whichEvent, &s_prevTimestampInNs[whichEvent], deadlineNs);
+        } else {
+            for (int i = 0; i < pData->timestampCount; i++) {
+                accumulate(&s_prevTimestampInNs[whichEvent], pData->timestampsInNs[i], deadlineNs);
+            }
         }
+        freeRetiredThreads();
+        updateStats(&s_interval, pStats);
+        pStats->numDropped = atomic_exchange(&s_dropped[whichEvent], 0);
+        s_lastStats[whichEvent] = *pStats;
+        s_lastHist[whichEvent] = s_interval.hist;
+        Histogram_merge(&s_totalHist[whichEvent], &s_interval.hist);
 
         // Clear
         pData->timestampCount = 0;
@@ -86,66 +289,229 @@ void Period_getStatisticsAndClear(
     pthread_mutex_unlock(&s_lock);
 }
 
-static void updateStats(
-    timestamps_t *pData, 
+void Period_setDeadline(enum Period_whichEvent whichEvent, double deadlineInMs)
+{
+    assert (whichEvent >= 0 && whichEvent < NUM_PERIOD_EVENTS);
+    atomic_store(&s_deadlineNs[whichEvent], (long long)(deadlineInMs * 1000 * 1000));
+}
+
+void Period_getHistograms(
+    enum Period_whichEvent whichEvent,
+    Histogram_t *pLastInterval,
+    Histogram_t *pSinceStart
+)
+{
+    assert (whichEvent >= 0 && whichEvent < NUM_PERIOD_EVENTS);
+    pthread_mutex_lock(&s_lock);
+    if (pLastInterval) {
+        *pLastInterval = s_lastHist[whichEvent];
+    }
+    if (pSinceStart) {
+        *pSinceStart = s_totalHist[whichEvent];
+    }
+    pthread_mutex_unlock(&s_lock);
+}
+
+void Period_getLastStatistics(
+    enum Period_whichEvent whichEvent,
     Period_statistics_t *pStats
 )
 {
-    long long prevInNs = pData->prevTimestampInNs;
+    assert (whichEvent >= 0 && whichEvent < NUM_PERIOD_EVENTS);
+    pthread_mutex_lock(&s_lock);
+    *pStats = s_lastStats[whichEvent];
+    pthread_mutex_unlock(&s_lock);
+}
 
-    // Handle startup (no previous sample)
-    if (prevInNs == 0) {
-        prevInNs = pData->timestampsInNs[0];
+// Wait (boundedly) for a thread to leave the given set. False if it is
+// still inside it: preempted mid-update, possibly by this very thread.
+static bool waitForStreamWriter(stream_t *pStream, int set)
+{
+    for (int yields = 0; yields <= STREAM_YIELDS; yields++) {
+        for (int spins = 0; spins < STREAM_SPINS; spins++) {
+            if (atomic_load(&pStream->writing) != set + 1) {
+                return true;
+            }
+        }
+        sched_yield();
     }
-    
-    // Find min/max/sum time delta between consecutive samples
-    long long sumDeltasNs = 0;
-    long long minNs = 0;
-    long long maxNs = 0;
-    for (int i = 0; i < pData->timestampCount; i++) {
-        long long thisTime = pData->timestampsInNs[i];
-        long long deltaNs = thisTime - prevInNs;
-        sumDeltasNs += deltaNs;
+    return atomic_load(&pStream->writing) != set + 1;
+}
 
-        if (i == 0 || deltaNs < minNs) {
-            minNs = deltaNs;
+// Take every thread's statistics for the event into s_interval: flip
+// each thread to its other set, wait out an update already under way
+// (a few instructions), then merge and clear the set it was using. If
+// the update doesn't finish soon (the writer was preempted, and on one
+// core or under SCHED_FIFO waiting longer may never let it run), the set
+// is left alone: its periods are counted by a later read.
+static void collectStreams(enum Period_whichEvent whichEvent)
+{
+    for (int t = 0; t < PERIOD_MAX_THREADS; t++) {
+        if (atomic_load(&s_threadData[t].state) == THREAD_FREE) {
+            continue;
         }
-        if (i == 0 || deltaNs > maxNs) {
-            maxNs = deltaNs;
+        stream_t *pStream = &s_threadData[t].streams[whichEvent];
+        int old = atomic_load(&pStream->active);
+        atomic_store(&pStream->active, old ^ 1);
+        if (!waitForStreamWriter(pStream, old)) {
+            continue;
         }
+        mergePeriods(&s_interval, &pStream->periods[old]);
+        clearPeriods(&pStream->periods[old]);
+    }
+}
 
-        prevInNs = thisTime;
+// Feed every thread's pending timestamps for the event into s_interval,
+// in time order (each ring is already in order; take the oldest head).
+static void drainRings(enum Period_whichEvent whichEvent, long long *pPrevInNs, long long deadlineNs)
+{
+    ring_t *pending[PERIOD_MAX_THREADS];
+    unsigned long pos[PERIOD_MAX_THREADS];
+    unsigned long end[PERIOD_MAX_THREADS];
+    int numPending = 0;
+
+    for (int t = 0; t < PERIOD_MAX_THREADS; t++) {
+        if (atomic_load(&s_threadData[t].state) == THREAD_FREE) {
+            continue;
+        }
+        ring_t *pRing = &s_threadData[t].rings[whichEvent];
+        pos[numPending] = atomic_load_explicit(&pRing->tail, memory_order_relaxed);
+        end[numPending] = atomic_load_explicit(&pRing->head, memory_order_acquire);
+        if (pos[numPending] != end[numPending]) {
+            pending[numPending++] = pRing;
+        }
     }
 
-    long long avgNs = 0;
-    if (pData->timestampCount > 0) {
-        avgNs = sumDeltasNs / pData->timestampCount;
-    } 
+    while (numPending > 0) {
+        int oldest = 0;
+        for (int i = 1; i < numPending; i++) {
+            if (pending[i]->timestampsInNs[pos[i] & RING_MASK] <
+                    pending[oldest]->timestampsInNs[pos[oldest] & RING_MASK]) {
+                oldest = i;
+            }
+        }
+        accumulate(pPrevInNs, pending[oldest]->timestampsInNs[pos[oldest] & RING_MASK], deadlineNs);
+        if (++pos[oldest] == end[oldest]) {
+            // Done with this ring: hand the space back to its thread.
+            atomic_store_explicit(&pending[oldest]->tail, end[oldest], memory_order_release);
+            numPending--;
+            pending[oldest] = pending[numPending];
+            pos[oldest] = pos[numPending];
+            end[oldest] = end[numPending];
+        }
+    }
+}
 
-    // Save stats
-    #define MS_PER_NS (1000*1000.0)
-    pStats->minPeriodInMs = minNs / MS_PER_NS;
-    pStats->maxPeriodInMs = maxNs / MS_PER_NS;
-    pStats->avgPeriodInMs = avgNs / MS_PER_NS;
-    pStats->numSamples = pData->timestampCount;
+// The data of exited threads can be reused once nothing is left in it.
+static void freeRetiredThreads(void)
+{
+    for (int t = 0; t < PERIOD_MAX_THREADS; t++) {
+        threadData_t *pThread = &s_threadData[t];
+        if (atomic_load(&pThread->state) != THREAD_RETIRED) {
+            continue;
+        }
+        bool empty = true;
+        for (int e = 0; e < NUM_PERIOD_EVENTS; e++) {
+            ring_t *pRing = &pThread->rings[e];
+            stream_t *pStream = &pThread->streams[e];
+            empty = empty && atomic_load(&pRing->head) == atomic_load(&pRing->tail) &&
+                    pStream->periods[0].count == 0 && pStream->periods[1].count == 0;
+        }
+        if (empty) {
+            atomic_store(&pThread->state, THREAD_FREE);
+        }
+    }
 }
 
+// Add the period ending at `thisTime` to s_interval.
+static void accumulate(long long *pPrevInNs, long long thisTime, long long deadlineNs)
+{
+    // Handle startup (no previous sample)
+    if (*pPrevInNs == 0) {
+        *pPrevInNs = thisTime;
+    }
+    addPeriod(&s_interval, thisTime - *pPrevInNs, deadlineNs);
+    *pPrevInNs = thisTime;
+}
 
+static void clearPeriods(periods_t *pPeriods)
+{
+    pPeriods->count = 0;
+    pPeriods->sumNs = 0;
+    pPeriods->minNs = 0;
+    pPeriods->maxNs = 0;
+    pPeriods->mean = 0;
+    pPeriods->m2 = 0;
+    pPeriods->deadlineMisses = 0;
+    Histogram_clear(&pPeriods->hist);
+}
 
+static void addPeriod(periods_t *pPeriods, long long deltaNs, long long deadlineNs)
+{
+    // Track min/max/sum time delta between consecutive samples
+    if (pPeriods->count == 0 || deltaNs < pPeriods->minNs) {
+        pPeriods->minNs = deltaNs;
+    }
+    if (pPeriods->count == 0 || deltaNs > pPeriods->maxNs) {
+        pPeriods->maxNs = deltaNs;
+    }
+    pPeriods->sumNs += deltaNs;
+    pPeriods->count++;
 
+    double diff = deltaNs - pPeriods->mean;
+    pPeriods->mean += diff / pPeriods->count;
+    pPeriods->m2 += diff * (deltaNs - pPeriods->mean);
 
-// Timing function
-static long long getTimeInNanoS(void) 
+    if (deadlineNs > 0 && deltaNs > deadlineNs) {
+        pPeriods->deadlineMisses++;
+    }
+    Histogram_record(&pPeriods->hist, deltaNs);
+}
+
+// Combine two sets of statistics (Chan et al. for the variance).
+static void mergePeriods(periods_t *pInto, const periods_t *pFrom)
 {
-    struct timespec spec;
-    clock_gettime(CLOCK_BOOTTIME, &spec);
-    long long seconds = spec.tv_sec;
-    long long nanoSeconds = spec.tv_nsec + seconds * 1000*1000*1000;
-	assert(nanoSeconds > 0);
-    
-    static long long lastTimeHack = 0;
-    assert(nanoSeconds > lastTimeHack);
-    lastTimeHack = nanoSeconds;
+    if (pFrom->count == 0) {
+        return;
+    }
+    if (pInto->count == 0 || pFrom->minNs < pInto->minNs) {
+        pInto->minNs = pFrom->minNs;
+    }
+    if (pInto->count == 0 || pFrom->maxNs > pInto->maxNs) {
+        pInto->maxNs = pFrom->maxNs;
+    }
+    long total = pInto->count + pFrom->count;
+    double diff = pFrom->mean - pInto->mean;
+    pInto->m2 += pFrom->m2 + diff * diff * pInto->count * pFrom->count / total;
+    pInto->mean += diff * pFrom->count / total;
+    pInto->count = total;
+    pInto->sumNs += pFrom->sumNs;
+    pInto->deadlineMisses += pFrom->deadlineMisses;
+    Histogram_merge(&pInto->hist, &pFrom->hist);
+}
 
-    return nanoSeconds;
+static void updateStats(
+    const periods_t *pPeriods,
+    Period_statistics_t *pStats
+)
+{
+    long long avgNs = 0;
+    double variance = 0;
+    if (pPeriods->count > 0) {
+        avgNs = pPeriods->sumNs / pPeriods->count;
+        variance = pPeriods->m2 / pPeriods->count;
+    }
+
+    // Save stats
+    #define MS_PER_NS (1000*1000.0)
+    pStats->minPeriodInMs = pPeriods->minNs / MS_PER_NS;
+    pStats->maxPeriodInMs = pPeriods->maxNs / MS_PER_NS;
+    pStats->avgPeriodInMs = avgNs / MS_PER_NS;
+    pStats->stdDevPeriodInMs = sqrt(variance) / MS_PER_NS;
+    pStats->p50PeriodInMs = Histogram_percentile(&pPeriods->hist, 50) / MS_PER_NS;
+    pStats->p90PeriodInMs = Histogram_percentile(&pPeriods->hist, 90) / MS_PER_NS;
+    pStats->p99PeriodInMs = Histogram_percentile(&pPeriods->hist, 99) / MS_PER_NS;
+    pStats->p999PeriodInMs = Histogram_percentile(&pPeriods->hist, 99.9) / MS_PER_NS;
+    pStats->numDeadlineMisses = pPeriods->deadlineMisses;
+    pStats->numSamples = pPeriods->count;
 }
@@ -0,0 +1,373 @@
+#define _GNU_SOURCE  // pthread_getname_np(), gettid
+
+#include "hal/probe.h"
+#include "hal/timestamp.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define NS_PER_SECOND 1000000000LL
+#define RING_MASK (PROBE_RING_RECORDS - 1)
+#define THREAD_NAME_LEN 16
+
+typedef enum {
+    RECORD_BEGIN,
+    RECORD_END,
+    RECORD_MARK,
+} recordType_t;
+
+// Written with relaxed atomics, so a dump racing the owner reads whole
+// values; records it may have caught mid-overwrite are discarded.
+typedef struct {
+    atomic_llong timeNs;
+    atomic_uint meta;           // id << 2 | type
+} record_t;
+
+enum {
+    THREAD_FREE,
+    THREAD_CLAIMING,    // being set up: not yet for dumps
+    THREAD_IN_USE,
+    THREAD_EXITED,      // records kept for dumps until the slot is reused
+};
+
+typedef struct {
+    atomic_int state;
+    int tid;
+    char name[THREAD_NAME_LEN];
+    atomic_ullong head;         // records written so far
+    record_t *records;          // PROBE_RING_RECORDS, allocated on first use
+} probeThread_t;
+
+static char probeNames[PROBE_MAX][PROBE_MAX_NAME];
+static atomic_int numProbes = 0;
+static pthread_mutex_t registerLock = PTHREAD_MUTEX_INITIALIZER;
+
+static probeThread_t threads[PROBE_MAX_THREADS];
+static _Thread_local probeThread_t *tl_pThread = NULL;
+static _Thread_local bool tl_noThread = false;
+static pthread_key_t threadKey;
+static pthread_once_t threadKeyOnce = PTHREAD_ONCE_INIT;
+
+// Serialises dumps (each takes a copy of every ring).
+static pthread_mutex_t dumpLock = PTHREAD_MUTEX_INITIALIZER;
+static record_t dumpRecords[PROBE_RING_RECORDS];
+
+// The dump Probe_startChromeTrace() hands to its worker thread.
+typedef struct {
+    const char *path;
+    double seconds;
+    Probe_traceDone_t done;
+    void *arg;
+} traceJob_t;
+
+static pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t traceThread;
+static bool traceJoinable = false;      // traceThread started, not yet joined
+static atomic_bool traceBusy = false;
+static traceJob_t traceJob;
+
+int Probe_register(const char *name)
+{
+    pthread_mutex_lock(&registerLock);
+    int n = atomic_load(&numProbes);
+    int id = -1;
+    for (int i = 0; i < n; i++) {
+        if (strncmp(probeNames[i], name, PROBE_MAX_NAME - 1) == 0) {
+            id = i;
+            break;
+        }
+    }
+    if (id < 0 && n < PROBE_MAX) {
+        snprintf(probeNames[n], PROBE_MAX_NAME, "%s", name);
+        atomic_store(&numProbes, n + 1);
+        id = n;
+    }
+    pthread_mutex_unlock(&registerLock);
+    return id;
+}
+
+static void threadExited(void *pThread)
+{
+    atomic_store(&((probeThread_t *)pThread)->state, THREAD_EXITED);
+}
+
+static void createThreadKey(void)
+{
+    pthread_key_create(&threadKey, threadExited);
+}
+
+// First record on this thread: take a free slot, or else the slot of a
+// thread that has exited.
+static probeThread_t *claimThread(void)
+{
+    pthread_once(&threadKeyOnce, createThreadKey);
+    for (int pass = 0; pass < 2; pass++) {
+        int from = (pass == 0) ? THREAD_FREE : THREAD_EXITED;
+        for (int t = 0; t < PROBE_MAX_THREADS; t++) {
+            probeThread_t *pThread = &threads[t];
+            int expected = from;
+            if (!atomic_compare_exchange_strong(&pThread->state, &expected, THREAD_CLAIMING)) {
+                continue;
+            }
+            if (from == THREAD_EXITED) {
+                // Empty the ring, or the exited thread's records would be
+                // dumped under this thread's tid. Never wait for a dump
+                // that is reading it: try another slot.
+                if (pthread_mutex_trylock(&dumpLock) != 0) {
+                    atomic_store(&pThread->state, THREAD_EXITED);
+                    continue;
+                }
+                atomic_store(&pThread->head, 0);
+                pthread_mutex_unlock(&dumpLock);
+            }
+            if (!pThread->records) {
+                pThread->records = calloc(PROBE_RING_RECORDS, sizeof(record_t));
+                if (!pThread->records) {
+                    atomic_store(&pThread->state, THREAD_FREE);
+                    break;
+                }
+            }
+            pThread->tid = (int)syscall(SYS_gettid);
+            if (pthread_getname_np(pthread_self(), pThread->name, sizeof(pThread->name)) != 0) {
+                snprintf(pThread->name, sizeof(pThread->name), "thread %d", pThread->tid);
+            }
+            pthread_setspecific(threadKey, pThread);
+            atomic_store(&pThread->state, THREAD_IN_USE);
+            return pThread;
+        }
+    }
+    tl_noThread = true;
+    return NULL;
+}
+
+static void record(int id, recordType_t type)
+{
+    if (id < 0) {
+        return;
+    }
+    probeThread_t *pThread = tl_pThread;
+    if (!pThread) {
+        if (tl_noThread || !(pThread = tl_pThread = claimThread())) {
+            return;
+        }
+    }
+    unsigned long long head = atomic_load_explicit(&pThread->head, memory_order_relaxed);
+    record_t *pRecord = &pThread->records[head & RING_MASK];
+    atomic_store_explicit(&pRecord->timeNs, Timestamp_nowNs(), memory_order_relaxed);
+    atomic_store_explicit(&pRecord->meta, (unsigned)id << 2 | type, memory_order_relaxed);
+    atomic_store_explicit(&pThread->head, head + 1, memory_order_release);
+}
+
+void Probe_begin(int id)
+{
+    record(id, RECORD_BEGIN);
+}
+
+void Probe_end(int id)
+{
+    record(id, RECORD_END);
+}
+
+void Probe_mark(int id)
+{
+    record(id, RECORD_MARK);
+}
+
+// Copy a thread's ring into dumpRecords. Sets *pFirst to the index of
+// the oldest record that was certainly not being overwritten meanwhile,
+// and returns the index after the newest.
+static unsigned long long copyRing(probeThread_t *pThread, unsigned long long *pFirst)
+{
+    unsigned long long head = atomic_load_explicit(&pThread->head, memory_order_acquire);
+    unsigned long long first = (head > PROBE_RING_RECORDS) ? head - PROBE_RING_RECORDS : 0;
+    for (unsigned long long i = first; i < head; i++) {
+        record_t *pFrom = &pThread->records[i & RING_MASK];
+        record_t *pTo = &dumpRecords[i & RING_MASK];
+        atomic_store_explicit(&pTo->timeNs,
+            atomic_load_explicit(&pFrom->timeNs, memory_order_relaxed), memory_order_relaxed);
+        atomic_store_explicit(&pTo->meta,
+            atomic_load_explicit(&pFrom->meta, memory_order_relaxed), memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_acquire);
+
+    // The owner may be writing record `now` (in the slot of now - RING)
+    // and may have overwritten everything before it.
+    unsigned long long now = atomic_load_explicit(&pThread->head, memory_order_relaxed);
+    if (now + 1 > first + PROBE_RING_RECORDS) {
+        first = now + 1 - PROBE_RING_RECORDS;
+    }
+    *pFirst = (first < head) ? first : head;
+    return head;
+}
+
+// One thread's records since `sinceNs`, as trace events.
+static long writeThreadEvents(FILE *pFile, probeThread_t *pThread, long long sinceNs,
+                              int pid, int numNames, bool *pFirstEvent)
+{
+    unsigned long long first;
+    unsigned long long end = copyRing(pThread, &first);
+    long written = 0;
+    int depth = 0;
+
+    fprintf(pFile, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+            "\"args\":{\"name\":\"%s\"}}", *pFirstEvent ? "" : ",", pid, pThread->tid, pThread->name);
+    *pFirstEvent = false;
+
+    for (unsigned long long i = first; i < end; i++) {
+        record_t *pRecord = &dumpRecords[i & RING_MASK];
+        long long timeNs = atomic_load_explicit(&pRecord->timeNs, memory_order_relaxed);
+        unsigned meta = atomic_load_explicit(&pRecord->meta, memory_order_relaxed);
+        int id = (int)(meta >> 2);
+        recordType_t type = (recordType_t)(meta & 3);
+        if (id >= numNames || timeNs < sinceNs) {
+            continue;
+        }
+        // Spans are nested, so an end with no begin in the window closes
+        // a span that started before it: leave it out.
+        if (type == RECORD_BEGIN) {
+            depth++;
+        } else if (type == RECORD_END) {
+            if (depth == 0) continue;
+            depth--;
+        }
+        const char *ph = (type == RECORD_BEGIN) ? "B" : (type == RECORD_END) ? "E" : "i";
+        fprintf(pFile, ",\n{\"name\":\"%s\",\"ph\":\"%s\",%s\"ts\":%lld.%03lld,\"pid\":%d,\"tid\":%d}",
+                probeNames[id], ph, (type == RECORD_MARK) ? "\"s\":\"t\"," : "",
+                timeNs / 1000, timeNs % 1000, pid, pThread->tid);
+        written++;
+    }
+    return written;
+}
+
+// Create the trace's directory if need be, and refuse it unless it is
+// ours alone: then no one else can put a symlink (or anything) there.
+static int checkTraceDir(const char *path)
+{
+    char dir[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    if (!slash) {
+        snprintf(dir, sizeof(dir), ".");
+    } else {
+        int len = (slash == path) ? 1 : (int)(slash - path);
+        snprintf(dir, sizeof(dir), "%.*s", len, path);
+    }
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+        return -1;
+    }
+    struct stat st;
+    if (lstat(dir, &st) != 0) {
+        return -1;
+    }
+    if (!S_ISDIR(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+        errno = EPERM;
+        return -1;
+    }
+    return 0;
+}
+
+long Probe_writeChromeTrace(const char *path, double seconds)
+{
+    char tmpPath[PATH_MAX];
+    if (snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path) >= (int)sizeof(tmpPath)) {
+        errno = ENAMETOOLONG;
+        perror("Probe_writeChromeTrace");
+        return -1;
+    }
+    if (checkTraceDir(path) != 0) {
+        perror("Probe_writeChromeTrace: trace directory");
+        return -1;
+    }
+    int fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+    FILE *pFile = (fd >= 0) ? fdopen(fd, "w") : NULL;
+    if (!pFile) {
+        perror("Probe_writeChromeTrace");
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    pthread_mutex_lock(&dumpLock);
+    long long sinceNs = Timestamp_nowNs() - (long long)(seconds * NS_PER_SECOND);
+    int numNames = atomic_load(&numProbes);
+    int pid = getpid();
+    bool firstEvent = true;
+    long written = 0;
+
+    fprintf(pFile, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (int t = 0; t < PROBE_MAX_THREADS; t++) {
+        int state = atomic_load(&threads[t].state);
+        if (state == THREAD_IN_USE || state == THREAD_EXITED) {
+            written += writeThreadEvents(pFile, &threads[t], sinceNs, pid, numNames, &firstEvent);
+        }
+    }
+    fprintf(pFile, "\n]}\n");
+    pthread_mutex_unlock(&dumpLock);
+
+    // Renaming replaces the old trace (even a symlink) rather than
+    // writing through it, and readers never see half a file.
+    if (fclose(pFile) != 0 || rename(tmpPath, path) != 0) {
+        perror("Probe_writeChromeTrace");
+        unlink(tmpPath);
+        return -1;
+    }
+    return written;
+}
+
+static void *traceFunc(void *arg)
+{
+    (void)arg;
+    pthread_setname_np(pthread_self(), "as2-trace");
+    long events = Probe_writeChromeTrace(traceJob.path, traceJob.seconds);
+    if (traceJob.done) {
+        traceJob.done(events, traceJob.arg);
+    }
+    atomic_store(&traceBusy, false);
+    return NULL;
+}
+
+int Probe_startChromeTrace(const char *path, double seconds, Probe_traceDone_t done, void *arg)
+{
+    pthread_mutex_lock(&traceLock);
+    if (atomic_load(&traceBusy)) {
+        pthread_mutex_unlock(&traceLock);
+        return -1;
+    }
+    if (traceJoinable) {
+        pthread_join(traceThread, NULL);    // finished: traceBusy is clear
+        traceJoinable = false;
+    }
+    traceJob = (traceJob_t){ .path = path, .seconds = seconds, .done = done, .arg = arg };
+    atomic_store(&traceBusy, true);
+    int err = pthread_create(&traceThread, NULL, traceFunc, NULL);
+    if (err != 0) {
+        errno = err;
+        perror("Probe_startChromeTrace: pthread_create");
+        atomic_store(&traceBusy, false);
+        pthread_mutex_unlock(&traceLock);
+        return -1;
+    }
+    traceJoinable = true;
+    pthread_mutex_unlock(&traceLock);
+    return 0;
+}
+
+void Probe_waitChromeTrace(void)
+{
+    pthread_mutex_lock(&traceLock);
+    if (traceJoinable) {
+        pthread_join(traceThread, NULL);
+        traceJoinable = false;
+    }
+    pthread_mutex_unlock(&traceLock);
+}
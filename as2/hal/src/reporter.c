@@ -3,69 +3,122 @@
 #include <unistd.h>
 #include <pthread.h>
 #include "hal/sampler.h"
+#include "hal/adc_hal.h"
 #include "hal/periodTimer.h"
 #include "hal/reporter.h"
+#include "hal/eventloop.h"
+#include "hal/broadcast.h"
+#include "hal/probe.h"
 
 static pthread_t reporterThread;
 static volatile int running = 0;
+static int reportTimer = -1;    // on the event loop instead of a thread
 static volatile int pwmFrequency = 0; // current LED frequency in Hz
+static int probeReport = -1;
 
 // Update the PWM frequency (so printed output includes it)
 void Reporter_setPWMFrequency(int freq) {
     pwmFrequency = freq;
 }
 
+// Once a second: roll the sampler over and print the summary.
+static void reportSecond(void* arg) {
+    (void)arg;
+    Period_markEvent(PERIOD_EVENT_MARK_SECOND);
+    Probe_begin(probeReport);
+
+    // Move current second samples into history
+    Sampler_moveCurrentDataToHistory();
+
+    // Borrow samples (no copy)
+    Sampler_historyView_t history;
+    Sampler_acquireHistory(&history);
+    int histSize = history.size;
+
+    // Get number of dips and average reading
+    int dips = history.dips;
+    double avgLight = Sampler_getAverageReading();
+
+    // Get timing statistics from periodTimer (closing the interval of
+    // the reporter's own period too, for "jitter" and the metrics)
+    Period_statistics_t stats;
+    Period_getStatisticsAndClear(PERIOD_EVENT_SAMPLE_LIGHT, &stats);
+    Period_statistics_t reportStats;
+    Period_getStatisticsAndClear(PERIOD_EVENT_MARK_SECOND, &reportStats);
+
+    // Line 1: summary, include PWM frequency
+    // (then the period percentiles, and periods over the deadline)
+    printf("#Smpl/s = %d Flash @ %dHz avg = %.3fV dips = %d Smpl ms[ %.3f, %.3f] avg %.3f/%d"
+           " p50/90/99/99.9 %.3f/%.3f/%.3f/%.3f miss %d\n",
+           histSize,
+           pwmFrequency,
+           avgLight,
+           dips,
+           stats.minPeriodInMs,
+           stats.maxPeriodInMs,
+           stats.avgPeriodInMs,
+           histSize,
+           stats.p50PeriodInMs,
+           stats.p90PeriodInMs,
+           stats.p99PeriodInMs,
+           stats.p999PeriodInMs,
+           stats.numDeadlineMisses);
+
+    // The same summary, once, for every listener (if enabled)
+    if (Broadcast_isActive()) {
+        History_summary_t summary = {
+            .second = (uint32_t)history.second,
+            .startTimeNs = history.startTimeNs,
+            .samples = histSize,
+            .pwmFrequencyHz = pwmFrequency,
+            .averageMicrovolts = (uint32_t)(avgLight * 1e6),
+            .dips = dips,
+            .minPeriodUs = (uint32_t)(stats.minPeriodInMs * 1000),
+            .maxPeriodUs = (uint32_t)(stats.maxPeriodInMs * 1000),
+            .avgPeriodUs = (uint32_t)(stats.avgPeriodInMs * 1000),
+            .overruns = (uint32_t)Sampler_getNumOverruns(),
+        };
+        Broadcast_sendSummary(&summary);
+    }
+
+    // Line 2: 10 evenly spaced samples
+    int step = (histSize < 10) ? 1 : histSize / 10;
+    for (int i = 0; i < histSize; i += step) {
+        printf(" %d:%.3f", i, ADC_rawToVolts(history.samples[i]));
+    }
+    printf("\n");
+
+    Sampler_releaseHistory(&history);
+    Probe_end(probeReport);
+}
+
 static void* reporterFunc(void* arg) {
     (void)arg;
 
     while (running) {
         sleep(1); // wait 1 second
-
-        // Move current second samples into history
-        Sampler_moveCurrentDataToHistory();
-
-        // Get samples
-        int histSize = 0;
-        double* history = Sampler_getHistory(&histSize);
-
-        // Get number of dips and average reading
-        int dips = Sampler_countDips();
-        double avgLight = Sampler_getAverageReading();
-
-        // Get timing statistics from periodTimer
-        Period_statistics_t stats;
-        Period_getStatisticsAndClear(0, &stats);
-
-        // Line 1: summary, include PWM frequency
-        printf("#Smpl/s = %d Flash @ %dHz avg = %.3fV dips = %d Smpl ms[ %.3f, %.3f] avg %.3f/%d\n",
-               histSize,
-               pwmFrequency,
-               avgLight,
-               dips,
-               stats.minPeriodInMs,
-               stats.maxPeriodInMs,
-               stats.avgPeriodInMs,
-               histSize);
-
-        // Line 2: 10 evenly spaced samples
-        int step = (histSize < 10) ? 1 : histSize / 10;
-        for (int i = 0; i < histSize; i += step) {
-            printf(" %d:%.3f", i, history[i]);
-        }
-        printf("\n");
-
-        free(history);
+        reportSecond(NULL);
     }
 
     return NULL;
 }
 
 void Reporter_start(void) {
+    probeReport = Probe_register("report");
+    if (EventLoop_isActive()) {
+        reportTimer = EventLoop_addTimer(1000000000LL, reportSecond, NULL);
+        return;
+    }
     running = 1;
     pthread_create(&reporterThread, NULL, reporterFunc, NULL);
 }
 
 void Reporter_stop(void) {
+    if (reportTimer >= 0) {
+        EventLoop_removeTimer(reportTimer);
+        reportTimer = -1;
+        return;
+    }
     running = 0;
     pthread_join(reporterThread, NULL);
 }
@@ -11,6 +11,8 @@
 #include <stdatomic.h>
 #include <limits.h>
 
+#define EDGE_EVENT_CAP 16
+
 struct re_encoder {
     re_config cfg;
 
@@ -22,6 +24,7 @@ struct re_encoder {
 
     struct gpiod_line_config *lcfg;
     struct gpiod_request_config *rcfg;
+    struct gpiod_edge_event_buffer *events;
 
     pthread_t thread;
     atomic_bool running;
@@ -104,6 +107,29 @@ static struct gpiod_line_settings* make_settings(bool active_low, int bias) {
 
 static bool is_path(const char *s) { return s && s[0] == '/'; }
 
+int re_process_events(re_encoder *enc) {
+    if (!enc) return -1;
+    int n = gpiod_line_request_read_edge_events(enc->request, enc->events, EDGE_EVENT_CAP);
+    if (n < 0) {
+        return (errno == EAGAIN) ? 0 : -1;
+    }
+    for (int i = 0; i < n; ++i) {
+        struct gpiod_edge_event *ev = gpiod_edge_event_buffer_get_event(enc->events, i);
+        unsigned offset = gpiod_edge_event_get_line_offset(ev);
+        int64_t ts_ns = (int64_t)gpiod_edge_event_get_timestamp_ns(ev);
+        if (offset == enc->cfg.line_a || offset == enc->cfg.line_b) {
+            handle_ab_event(enc, ts_ns);
+        }
+    }
+    return n;
+}
+
+int re_get_fd(re_encoder *enc) {
+    if (!enc) return -1;
+    (void)init_prev_state(enc);
+    return gpiod_line_request_get_fd(enc->request);
+}
+
 static void* worker_thread(void *arg) {
     struct re_encoder *enc = (struct re_encoder*)arg;
     int fd = gpiod_line_request_get_fd(enc->request);
@@ -111,14 +137,6 @@ static void* worker_thread(void *arg) {
 
     (void)init_prev_state(enc);
 
-    // Edge event buffer
-    const unsigned CAP = 16;
-    struct gpiod_edge_event_buffer *buf = gpiod_edge_event_buffer_new(CAP);
-    if (!buf) {
-        atomic_store(&enc->running, false);
-        return NULL;
-    }
-
     while (atomic_load(&enc->running)) {
         int pr = poll(&pfd, 1, 250);
         if (pr < 0) {
@@ -128,23 +146,10 @@ static void* worker_thread(void *arg) {
         if (pr == 0) continue;
 
         if (pfd.revents & POLLIN) {
-            int n = gpiod_line_request_read_edge_events(enc->request, buf, CAP);
-            if (n < 0) {
-                if (errno == EAGAIN) continue;
-                break;
-            }
-            for (int i = 0; i < n; ++i) {
-                struct gpiod_edge_event *ev = gpiod_edge_event_buffer_get_event(buf, i);
-                unsigned offset = gpiod_edge_event_get_line_offset(ev);
-                int64_t ts_ns = (int64_t)gpiod_edge_event_get_timestamp_ns(ev);
-                if (offset == enc->cfg.line_a || offset == enc->cfg.line_b) {
-                    handle_ab_event(enc, ts_ns);
-                }
-            }
+            if (re_process_events(enc) < 0) break;
         }
     }
 
-    gpiod_edge_event_buffer_free(buf);
     return NULL;
 }
 
@@ -203,6 +208,9 @@ int re_create(const re_config *cfg_in, re_encoder **out) {
     enc->request = gpiod_chip_request_lines(enc->chip, enc->rcfg, enc->lcfg);
     if (!enc->request) { re_destroy(enc); return -1; }
 
+    enc->events = gpiod_edge_event_buffer_new(EDGE_EVENT_CAP);
+    if (!enc->events) { re_destroy(enc); return -1; }
+
     atomic_store(&enc->running, false);
     *out = enc;
     return 0;
@@ -239,6 +247,7 @@ void re_destroy(re_encoder *enc) {
     if (!enc) return;
     re_stop(enc);
 
+    if (enc->events) gpiod_edge_event_buffer_free(enc->events);
     if (enc->request) gpiod_line_request_release(enc->request);
 
     if (enc->set_b && enc->set_b != enc->set_a) gpiod_line_settings_free(enc->set_b);
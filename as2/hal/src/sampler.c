@@ -1,114 +1,723 @@
+#define _GNU_SOURCE  // pthread_setname_np()
+
 #include "hal/sampler.h"
 #include "hal/adc_hal.h"
+#include "hal/SPI.h"
+#include "hal/dips.h"
+#include "hal/capture.h"
+#include "hal/periodTimer.h"
+#include "hal/probe.h"
+#include "hal/timestamp.h"
 #include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <time.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <string.h>
+#include <sys/mman.h>
 
-#define HISTORY_MAX 2000
 #define SAMPLE_CHANNEL 0
-#define SMOOTH_FACTOR 0.999
+#define SMOOTH_FACTOR 0.999      // per sample at the 1 kHz reference rate
+#define SMOOTH_REFERENCE_HZ 1000
+#define NS_PER_SECOND 1000000000LL
 #define DIP_THRESHOLD 0.1
 #define DIP_HYSTERESIS 0.03
 
+// The hot path works on raw ADC codes. The EMA and its weight are kept
+// in Q24 fixed point (code << 24) so no floating point is needed per
+// sample; values are converted to volts only when read. 24 fractional
+// bits keep the weight within 0.3% of its value even at 100 kHz (in Q16
+// it is only about 65000 / rate LSBs: 13 at 5 kHz), and a 12-bit code
+// times the weight still fits 64 bits at any rate.
+#define Q24_SHIFT 24
+#define Q24_ONE (1LL << Q24_SHIFT)
+#define Q24_TO_Q4(q) ((uint16_t)((q) >> (Q24_SHIFT - DIPS_Q4_SHIFT)))
+
+// Seqlock: the single writer makes `seq` odd while it updates the
+// protected data; readers retry until they see the same even value
+// before and after copying it out. Writers never wait on readers.
+typedef struct {
+    atomic_uint seq;
+} seqlock_t;
+
+static unsigned seqlock_readBegin(seqlock_t *s) {
+    unsigned seq;
+    while ((seq = atomic_load_explicit(&s->seq, memory_order_acquire)) & 1) {
+        // writer in progress
+    }
+    return seq;
+}
+
+static bool seqlock_readRetry(seqlock_t *s, unsigned seq) {
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&s->seq, memory_order_relaxed) != seq;
+}
+
+static void seqlock_writeBegin(seqlock_t *s) {
+    atomic_fetch_add_explicit(&s->seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void seqlock_writeEnd(seqlock_t *s) {
+    atomic_fetch_add_explicit(&s->seq, 1, memory_order_release);
+}
+
 static pthread_t samplerThread;
 static volatile bool running = false;
+static atomic_bool stopRequested = false;
+
+// History slots: the sampler fills one while the last
+// config.historySeconds complete seconds are retained in others.
+// Rollover swaps which slot the sampler writes to, so it is O(1), and
+// readers borrow retained slots through a reference count instead of
+// copying them. Slots with readers still attached are never handed back
+// to the sampler; the spares cover a slot being written and readers
+// still holding seconds that have just aged out.
+#define SPARE_SLOTS 3
+#define MAX_SLOTS 255       // slot index must fit the cursor's top byte
+
+// Each slot is a struct-of-arrays: samples[i] is the raw code and
+// avgs[i] the EMA (Q4 code) right after that sample was taken.
+typedef struct {
+    uint16_t *samples;
+    uint16_t *avgs;
+    int size;
+    int dips;
+    long long startTimeNs;      // CLOCK_MONOTONIC time of samples[0]
+    atomic_llong second;        // which second it holds, once published
+    atomic_int refs;
+    bool retained;              // rollover's own bookkeeping
+} historySlot_t;
+static historySlot_t *slots = NULL;
+static int numSlots = 0;
+
+// Samples each slot can hold: one second at the configured rate, plus
+// slack for a late rollover.
+static int historyCapacity = 0;
+
+static Sampler_config_t config;
+static Capture_writer_t *pCapture = NULL;
+
+// Slot the sampler is writing to (top byte) and how many samples it has
+// committed there (low 24 bits), swapped as one word at rollover.
+#define CURSOR_SLOT(c) ((int)((c) >> 24))
+#define CURSOR_COUNT(c) ((int)((c) & 0xFFFFFF))
+#define CURSOR_MAKE(slot, count) (((uint32_t)(slot) << 24) | (uint32_t)(count))
+static _Atomic uint32_t writeCursor = CURSOR_MAKE(0, 0);
+
+// Retained seconds, numbered from 0 at the first rollover. Second k
+// is in slot retainedSlots[k % historySeconds], for the last
+// historySeconds values of k up to newestSecond (-1 before the first).
+static atomic_int *retainedSlots = NULL;
+static atomic_llong newestSecond = -1;
+// Raised before an aged-out slot is reused, so a reader that pins it
+// late sees it is no longer retained.
+static atomic_llong oldestSecond = 0;
+
+// Live values published by the sampler thread (protected by liveSeq).
+typedef struct {
+    long long avgQ24;
+    long long numSamples;
+    long long totalDips;
+    long long numOverruns;
+    long long numDiscarded;     // samples that found the current second full
+} live_t;
+static live_t live;
+static seqlock_t liveSeq;
 
-static double currentAvg = 0;
-static long long numSamples = 0;
+// Rollover caller's private bookkeeping.
+static long long rolloverDips = 0;
 
-static double history[HISTORY_MAX];
-static int historySize = 0;
+// Completed seconds the rollover had no free slot for, and the dips in
+// them (counted in the dip totals, but in no retained second).
+static atomic_llong secondsDropped = 0;
+static atomic_llong dipsDropped = 0;
 
-static double currentBuffer[HISTORY_MAX];
-static int currentBufferSize = 0;
+// Live tap: every sample by sample number, for streaming readers that
+// must not miss data between rollovers. Single producer (the sampler
+// thread); each reader keeps its own cursor and detects being lapped.
+// Holds at least two seconds at the configured rate (power of two).
+static uint16_t *tapRing = NULL;
+static long long tapMask = 0;
+static atomic_llong tapHead = 0;
 
-static int dips = 0;
-static bool inDip = false;
+// Dip events, in the same style.
+#define DIP_EVENT_RING 256
+static Sampler_dipEvent_t dipEventRing[DIP_EVENT_RING];
+static atomic_llong dipEventHead = 0;
 
-static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int probeSample = -1;
+static int probeAdcRead = -1;
+static int probeRollover = -1;
+
+static live_t readLive(void) {
+    live_t copy;
+    unsigned seq;
+    do {
+        seq = seqlock_readBegin(&liveSeq);
+        copy = live;
+    } while (seqlock_readRetry(&liveSeq, seq));
+    return copy;
+}
+
+static long long monotonicNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NS_PER_SECOND + ts.tv_nsec;
+}
+
+// Store a sample and its average in the current slot. If a rollover
+// swaps the slot between our write and our commit, the write is simply
+// not counted and we store the sample again in the new slot. Returns
+// false if the slot is full (the rollover is late), so the sample is
+// kept out of the history.
+static bool storeSample(uint16_t sample, uint16_t avgQ4) {
+    uint32_t cursor = atomic_load_explicit(&writeCursor, memory_order_acquire);
+    while (CURSOR_COUNT(cursor) < historyCapacity) {
+        historySlot_t *pSlot = &slots[CURSOR_SLOT(cursor)];
+        if (CURSOR_COUNT(cursor) == 0) {
+            pSlot->startTimeNs = monotonicNs();
+        }
+        pSlot->samples[CURSOR_COUNT(cursor)] = sample;
+        pSlot->avgs[CURSOR_COUNT(cursor)] = avgQ4;
+        if (atomic_compare_exchange_weak_explicit(&writeCursor, &cursor, cursor + 1,
+                memory_order_release, memory_order_acquire)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// One sample: a single conversion, or the mean of `oversample`
+// conversions fetched in one SPI transaction.
+static uint16_t readSample(void) {
+    if (config.oversample <= 1) {
+        int raw = ADC_readRaw(SAMPLE_CHANNEL);
+        return (raw < 0) ? 0 : (uint16_t)raw;
+    }
+
+    uint16_t raw[SPI_MAX_BATCH];
+    int n = ADC_readRawRepeated(SAMPLE_CHANNEL, config.oversample, raw);
+    if (n <= 0) {
+        return 0;
+    }
+    unsigned sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += raw[i];
+    }
+    return (uint16_t)((sum + n / 2) / n);
+}
+
+static void addNs(struct timespec *ts, long long ns) {
+    long long total = ts->tv_nsec + ns;
+    ts->tv_sec += total / NS_PER_SECOND;
+    ts->tv_nsec = total % NS_PER_SECOND;
+}
+
+static long long diffNs(const struct timespec *a, const struct timespec *b) {
+    return (a->tv_sec - b->tv_sec) * NS_PER_SECOND + (a->tv_nsec - b->tv_nsec);
+}
 
 static void* samplerFunc(void* arg) {
     (void)arg;
+    pthread_setname_np(pthread_self(), "as2-sampler");
+    long long avgQ24 = 0;
+    long long n = 0;
+    long long overruns = 0;
+    long long discarded = 0;
+    DipDetector dipDetector;
+    DipDetector_init(&dipDetector,
+        DipConfig_toRaw(DipConfig_make(DIP_THRESHOLD, DIP_THRESHOLD - DIP_HYSTERESIS)));
+
+    // Keep the EMA's time constant independent of the sample rate.
+    long long alphaQ24 = (long long)((1.0 - SMOOTH_FACTOR) * SMOOTH_REFERENCE_HZ
+                                     / config.sampleRateHz * Q24_ONE + 0.5);
+    if (alphaQ24 < 1) alphaQ24 = 1;
+    long long periodNs = NS_PER_SECOND / config.sampleRateHz;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+
     while (running) {
-        double sample = ADC_read(SAMPLE_CHANNEL);
+        Probe_begin(probeSample);
+        Period_markEvent(PERIOD_EVENT_SAMPLE_LIGHT);
+        Probe_begin(probeAdcRead);
+        uint16_t sample = readSample();
+        Probe_end(probeAdcRead);
+        long long sampleQ24 = (long long)sample << Q24_SHIFT;
+
+        if (n == 0) avgQ24 = sampleQ24;
+        else avgQ24 += ((sampleQ24 - avgQ24) * alphaQ24) >> Q24_SHIFT;
+        uint16_t avgQ4 = Q24_TO_Q4(avgQ24);
+
+        if (!storeSample(sample, avgQ4)) {
+            discarded++;
+        }
+        if (pCapture) {
+            Capture_writeSample(pCapture, sample);
+        }
 
-        pthread_mutex_lock(&lock);
-        if (currentBufferSize < HISTORY_MAX) currentBuffer[currentBufferSize++] = sample;
+        // The detector's state carries across rollovers, so a dip that
+        // straddles a second boundary is counted once.
+        bool dipStarted = DipDetector_push(&dipDetector, sample, avgQ4);
 
-        if (numSamples == 0) currentAvg = sample;
-        else currentAvg = SMOOTH_FACTOR * currentAvg + (1 - SMOOTH_FACTOR) * sample;
+        tapRing[n & tapMask] = sample;
+        atomic_store_explicit(&tapHead, n + 1, memory_order_release);
 
-        if (!inDip && currentAvg - sample >= DIP_THRESHOLD) {
-            dips++;
-            inDip = true;
-        } else if (inDip && currentAvg - sample <= DIP_THRESHOLD - DIP_HYSTERESIS) {
-            inDip = false;
+        if (dipStarted) {
+            long long e = dipDetector.totalDips - 1;
+            dipEventRing[e % DIP_EVENT_RING].sampleNumber = n;
+            dipEventRing[e % DIP_EVENT_RING].timeNs = monotonicNs();
+            atomic_store_explicit(&dipEventHead, e + 1, memory_order_release);
         }
 
-        numSamples++;
-        pthread_mutex_unlock(&lock);
+        n++;
+
+        seqlock_writeBegin(&liveSeq);
+        live.avgQ24 = avgQ24;
+        live.numSamples = n;
+        live.totalDips = dipDetector.totalDips;
+        live.numOverruns = overruns;
+        live.numDiscarded = discarded;
+        seqlock_writeEnd(&liveSeq);
+        Probe_end(probeSample);
 
-        usleep(1000); // 1 ms
+        if (config.schedule == SAMPLER_SCHED_SLEEP) {
+            usleep(periodNs / 1000);
+            continue;
+        }
+        if (config.schedule == SAMPLER_SCHED_FREERUN) {
+            continue;
+        }
+
+        // Sleep to the next absolute deadline, so the time spent reading
+        // the ADC (and any wakeup latency) does not accumulate as drift.
+        addNs(&deadline, periodNs);
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long lateNs = diffNs(&now, &deadline);
+        if (lateNs >= 0) {
+            // Missed whole periods: count them and skip ahead rather than
+            // sampling in a burst to catch up.
+            long long missed = lateNs / periodNs + 1;
+            overruns += missed;
+            addNs(&deadline, missed * periodNs);
+        }
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) != 0 && running) {
+            // interrupted by a signal: sleep again to the same deadline
+        }
     }
     return NULL;
 }
 
-void Sampler_init(void) {
+Sampler_config_t Sampler_defaultConfig(void) {
+    Sampler_config_t c;
+    c.sampleRateHz = SAMPLER_DEFAULT_RATE_HZ;
+    c.schedule = SAMPLER_SCHED_DEADLINE;
+    c.realtime = false;
+    c.realtimePriority = SAMPLER_DEFAULT_RT_PRIORITY;
+    c.oversample = 1;
+    c.capturePath = NULL;
+    c.historySeconds = SAMPLER_DEFAULT_HISTORY_SECONDS;
+    return c;
+}
+
+static bool startRealtimeThread(void) {
+    // Fault in and pin everything now so page faults can't stall sampling.
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        perror("Sampler: mlockall");
+    }
+
+    pthread_attr_t attr;
+    struct sched_param param = { .sched_priority = config.realtimePriority };
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    pthread_attr_setschedparam(&attr, &param);
+    int err = pthread_create(&samplerThread, &attr, samplerFunc, NULL);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        fprintf(stderr, "Sampler: SCHED_FIFO unavailable (%s), using default scheduling\n",
+                strerror(err));
+        return false;
+    }
+    return true;
+}
+
+void Sampler_init(const Sampler_config_t *pConfig) {
+    config = pConfig ? *pConfig : Sampler_defaultConfig();
+    if (config.sampleRateHz <= 0) {
+        config.sampleRateHz = SAMPLER_DEFAULT_RATE_HZ;
+    }
+    if (config.oversample < 1) config.oversample = 1;
+    if (config.oversample > SPI_MAX_BATCH) config.oversample = SPI_MAX_BATCH;
+
+    long long tapSize = 4096;
+    while (tapSize < 2LL * config.sampleRateHz) {
+        tapSize *= 2;
+    }
+    tapRing = calloc(tapSize, sizeof(uint16_t));
+    if (!tapRing) {
+        perror("Sampler: tap allocation");
+        exit(1);
+    }
+    tapMask = tapSize - 1;
+
+    // As many seconds as were asked for and fit the memory budget.
+    historyCapacity = config.sampleRateHz + config.sampleRateHz / 4;
+    long long slotBytes = 2LL * historyCapacity * sizeof(uint16_t);
+    long long maxSeconds = SAMPLER_HISTORY_BUDGET_BYTES / slotBytes - SPARE_SLOTS;
+    if (maxSeconds > MAX_SLOTS - SPARE_SLOTS) maxSeconds = MAX_SLOTS - SPARE_SLOTS;
+    if (config.historySeconds > maxSeconds) {
+        fprintf(stderr, "Sampler: keeping %lld s of history, not %d (memory budget)\n",
+                maxSeconds, config.historySeconds);
+        config.historySeconds = (int)maxSeconds;
+    }
+    if (config.historySeconds < 1) config.historySeconds = 1;
+
+    numSlots = config.historySeconds + SPARE_SLOTS;
+    slots = calloc(numSlots, sizeof(historySlot_t));
+    retainedSlots = calloc(config.historySeconds, sizeof(atomic_int));
+    if (!slots || !retainedSlots) {
+        perror("Sampler: history allocation");
+        exit(1);
+    }
+    for (int i = 0; i < numSlots; i++) {
+        slots[i].samples = calloc(historyCapacity, sizeof(uint16_t));
+        slots[i].avgs = calloc(historyCapacity, sizeof(uint16_t));
+        if (!slots[i].samples || !slots[i].avgs) {
+            perror("Sampler: history allocation");
+            exit(1);
+        }
+        atomic_store(&slots[i].second, -1);
+    }
+
+    if (config.capturePath) {
+        pCapture = Capture_openWriter(config.capturePath, config.sampleRateHz);
+        if (!pCapture) {
+            fprintf(stderr, "Sampler: not recording to %s\n", config.capturePath);
+        }
+    }
+
+    // The sampler's period marks and probes read the calibrated counter:
+    // calibrate it here rather than on the sampling thread.
+    Timestamp_init();
+    probeSample = Probe_register("sample");
+    probeAdcRead = Probe_register("adc_read");
+    probeRollover = Probe_register("rollover");
+
     ADC_init();
     running = true;
-    pthread_create(&samplerThread, NULL, samplerFunc, NULL);
+    if (!config.realtime || !startRealtimeThread()) {
+        pthread_create(&samplerThread, NULL, samplerFunc, NULL);
+    }
 }
 
 void Sampler_cleanup(void) {
     running = false;
     pthread_join(samplerThread, NULL);
+    ADC_cleanup();
+    Capture_closeWriter(pCapture);
+    pCapture = NULL;
+    if (config.realtime) {
+        munlockall();
+    }
+    for (int i = 0; i < numSlots; i++) {
+        free(slots[i].samples);
+        free(slots[i].avgs);
+    }
+    free(slots);
+    free(retainedSlots);
+    slots = NULL;
+    retainedSlots = NULL;
+    numSlots = 0;
+    atomic_store(&newestSecond, -1);
+    atomic_store(&oldestSecond, 0);
+    free(tapRing);
+    tapRing = NULL;
+}
+
+// Find a slot that is neither being written, retained, nor borrowed.
+static int findFreeSlot(int writing) {
+    for (int i = 1; i <= numSlots; i++) {
+        int slot = (writing + i) % numSlots;
+        if (slot != writing && !slots[slot].retained && atomic_load(&slots[slot].refs) == 0) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+// Sampler_moveCurrentDataToHistory() without the probe.
+static void moveCurrentDataToHistory(void) {
+    live_t now = readLive();
+    int dips = (int)(now.totalDips - rolloverDips);
+    rolloverDips = now.totalDips;
+
+    uint32_t cursor = atomic_load(&writeCursor);
+    int writing = CURSOR_SLOT(cursor);
+    long long second = atomic_load(&newestSecond) + 1;
+    int ringIndex = (int)(second % config.historySeconds);
+
+    // The oldest retained second ages out now (once the ring is full).
+    int evicted = -1;
+    long long oldest = atomic_load(&oldestSecond);
+    if (second >= config.historySeconds) {
+        evicted = atomic_load(&retainedSlots[ringIndex]);
+        slots[evicted].retained = false;
+        atomic_store(&oldestSecond, oldest + 1);
+    }
+
+    int next = findFreeSlot(writing);
+    if (next < 0) {
+        // Every spare slot is still borrowed: keep the history as it is
+        // and restart the current second in place. Its dips are accounted
+        // with it, so each retained second's count matches its samples.
+        if (evicted >= 0) {
+            slots[evicted].retained = true;
+            atomic_store(&oldestSecond, oldest);
+        }
+        while (!atomic_compare_exchange_weak(&writeCursor, &cursor, CURSOR_MAKE(writing, 0))) {
+        }
+        atomic_fetch_add(&secondsDropped, 1);
+        atomic_fetch_add(&dipsDropped, dips);
+        fprintf(stderr, "Sampler: dropped a second (%d samples, %d dips): "
+                "every spare history buffer is borrowed\n", CURSOR_COUNT(cursor), dips);
+        return;
+    }
+
+    // Hand the sampler its new slot; whatever count we swapped out is
+    // exactly what it committed to the old one.
+    while (!atomic_compare_exchange_weak(&writeCursor, &cursor, CURSOR_MAKE(next, 0))) {
+    }
+    slots[writing].size = CURSOR_COUNT(cursor);
+    slots[writing].dips = dips;
+    slots[writing].retained = true;
+    atomic_store(&slots[writing].second, second);
+    atomic_store(&retainedSlots[ringIndex], writing);
+    atomic_store(&newestSecond, second);
 }
 
 void Sampler_moveCurrentDataToHistory(void) {
-    pthread_mutex_lock(&lock);
-    historySize = currentBufferSize;
-    memcpy(history, currentBuffer, historySize * sizeof(double));
-    currentBufferSize = 0;
-    dips = 0; // reset dips for next second
-    pthread_mutex_unlock(&lock);
+    Probe_begin(probeRollover);
+    moveCurrentDataToHistory();
+    Probe_end(probeRollover);
+}
+
+static void clearView(Sampler_historyView_t *pView) {
+    pView->samples = NULL;
+    pView->avgs = NULL;
+    pView->size = 0;
+    pView->dips = 0;
+    pView->startTimeNs = 0;
+    pView->second = -1;
+    pView->slot = -1;
+}
+
+bool Sampler_acquireSecond(long long second, Sampler_historyView_t *pView) {
+    clearView(pView);
+
+    long long newest = atomic_load(&newestSecond);
+    if (second < atomic_load(&oldestSecond) || second > newest) {
+        return false;
+    }
+    int slot = atomic_load(&retainedSlots[second % config.historySeconds]);
+    atomic_fetch_add(&slots[slot].refs, 1);
+    // Still holding that second after pinning it? Then rollover cannot
+    // reuse it until we let go.
+    if (atomic_load(&slots[slot].second) != second || second < atomic_load(&oldestSecond)) {
+        atomic_fetch_sub(&slots[slot].refs, 1);
+        return false;
+    }
+    pView->samples = slots[slot].samples;
+    pView->avgs = slots[slot].avgs;
+    pView->size = slots[slot].size;
+    pView->dips = slots[slot].dips;
+    pView->startTimeNs = slots[slot].startTimeNs;
+    pView->second = second;
+    pView->slot = slot;
+    return true;
+}
+
+void Sampler_acquireHistory(Sampler_historyView_t *pView) {
+    // Retry if a rollover retires the newest second as we pin it.
+    for (;;) {
+        long long newest = atomic_load(&newestSecond);
+        if (newest < 0 || Sampler_acquireSecond(newest, pView)) {
+            return;
+        }
+    }
+}
+
+void Sampler_releaseHistory(Sampler_historyView_t *pView) {
+    if (pView->slot >= 0) {
+        atomic_fetch_sub(&slots[pView->slot].refs, 1);
+    }
+    clearView(pView);
+}
+
+void Sampler_getRetainedSeconds(long long *pOldest, long long *pNewest) {
+    *pNewest = atomic_load(&newestSecond);
+    *pOldest = atomic_load(&oldestSecond);
+}
+
+long long Sampler_findSecond(long long timeNs) {
+    long long oldest, newest;
+    Sampler_getRetainedSeconds(&oldest, &newest);
+    if (newest < 0) {
+        return -1;
+    }
+    // Seconds are in time order; take the first that ends after timeNs
+    // (i.e. whose successor starts after it).
+    for (long long k = oldest; k <= newest; k++) {
+        Sampler_historyView_t view;
+        if (!Sampler_acquireSecond(k, &view)) {
+            continue;   // aged out while we looked
+        }
+        long long start = view.startTimeNs;
+        long long end = start + (long long)view.size * NS_PER_SECOND / config.sampleRateHz;
+        Sampler_releaseHistory(&view);
+        if (timeNs < end) {
+            return k;
+        }
+    }
+    return newest + 1;
 }
 
 int Sampler_getHistorySize(void) {
-    pthread_mutex_lock(&lock);
-    int sz = historySize;
-    pthread_mutex_unlock(&lock);
+    Sampler_historyView_t view;
+    Sampler_acquireHistory(&view);
+    int sz = view.size;
+    Sampler_releaseHistory(&view);
     return sz;
 }
 
 double* Sampler_getHistory(int* size) {
-    pthread_mutex_lock(&lock);
-    double* buf = malloc(historySize * sizeof(double));
-    memcpy(buf, history, historySize * sizeof(double));
-    *size = historySize;
-    pthread_mutex_unlock(&lock);
+    Sampler_historyView_t view;
+    Sampler_acquireHistory(&view);
+    double* buf = malloc(view.size * sizeof(double));
+    for (int i = 0; i < view.size; i++) {
+        buf[i] = ADC_rawToVolts(view.samples[i]);
+    }
+    *size = view.size;
+    Sampler_releaseHistory(&view);
     return buf;
 }
 
+// Clamp a reader's cursor into what a single-producer ring still holds.
+// The producer may be storing entry `head` while we read, so one slot
+// fewer than the ring size is safe.
+static long long clampCursor(long long next, long long head, long long ringSize,
+                             long long *pDropped) {
+    if (next > head) {
+        next = head;    // cursor from a previous run: resync
+    }
+    long long oldest = head + 1 - ringSize;
+    if (next < oldest) {
+        if (pDropped) *pDropped += oldest - next;
+        next = oldest;
+    }
+    return next;
+}
+
+// After copying entries [start, end), find how many at the front the
+// producer overwrote meanwhile. The caller throws those away.
+static int countLapped(atomic_llong *pHead, long long ringSize, long long start, long long end) {
+    atomic_thread_fence(memory_order_acquire);
+    long long oldest = atomic_load_explicit(pHead, memory_order_relaxed) + 1 - ringSize;
+    if (oldest <= start) return 0;
+    return (oldest >= end) ? (int)(end - start) : (int)(oldest - start);
+}
+
+int Sampler_readLiveSamples(long long *pNext, uint16_t *out, int max, long long *pDropped) {
+    long long ringSize = tapMask + 1;
+    long long head = atomic_load_explicit(&tapHead, memory_order_acquire);
+    long long start = clampCursor(*pNext, head, ringSize, pDropped);
+    long long end = (head - start > max) ? start + max : head;
+
+    for (long long i = start; i < end; i++) {
+        out[i - start] = tapRing[i & tapMask];
+    }
+
+    int lapped = countLapped(&tapHead, ringSize, start, end);
+    if (lapped > 0) {
+        memmove(out, out + lapped, (end - start - lapped) * sizeof(out[0]));
+        if (pDropped) *pDropped += lapped;
+    }
+    *pNext = end;
+    return (int)(end - start) - lapped;
+}
+
+int Sampler_readDipEvents(long long *pNext, Sampler_dipEvent_t *out, int max, long long *pDropped) {
+    long long head = atomic_load_explicit(&dipEventHead, memory_order_acquire);
+    long long start = clampCursor(*pNext, head, DIP_EVENT_RING, pDropped);
+    long long end = (head - start > max) ? start + max : head;
+
+    for (long long i = start; i < end; i++) {
+        out[i - start] = dipEventRing[i % DIP_EVENT_RING];
+    }
+
+    int lapped = countLapped(&dipEventHead, DIP_EVENT_RING, start, end);
+    if (lapped > 0) {
+        memmove(out, out + lapped, (end - start - lapped) * sizeof(out[0]));
+        if (pDropped) *pDropped += lapped;
+    }
+    *pNext = end;
+    return (int)(end - start) - lapped;
+}
+
+long long Sampler_getLiveHead(void) {
+    return atomic_load_explicit(&tapHead, memory_order_acquire);
+}
+
+long long Sampler_getDipEventHead(void) {
+    return atomic_load_explicit(&dipEventHead, memory_order_acquire);
+}
+
 double Sampler_getAverageReading(void) {
-    pthread_mutex_lock(&lock);
-    double avg = currentAvg;
-    pthread_mutex_unlock(&lock);
-    return avg;
+    return ADC_rawToVolts((double)readLive().avgQ24 / Q24_ONE);
 }
 
 long long Sampler_getNumSamplesTaken(void) {
-    pthread_mutex_lock(&lock);
-    long long n = numSamples;
-    pthread_mutex_unlock(&lock);
-    return n;
+    return readLive().numSamples;
 }
 
-int Sampler_countDips(void) {
-    pthread_mutex_lock(&lock);
-    int d = dips;
-    pthread_mutex_unlock(&lock);
-    return d;
+long long Sampler_getNumOverruns(void) {
+    return readLive().numOverruns;
+}
+
+long long Sampler_getNumSamplesDiscarded(void) {
+    return readLive().numDiscarded;
+}
+
+long long Sampler_getNumSecondsDropped(void) {
+    return atomic_load(&secondsDropped);
+}
+
+long long Sampler_getNumDipsDropped(void) {
+    return atomic_load(&dipsDropped);
+}
+
+void request_program_stop(void) {
+    atomic_store(&stopRequested, true);
+}
+
+bool is_stop_requested(void) {
+    return atomic_load(&stopRequested);
 }
 
+int Sampler_getSampleRateHz(void) {
+    return config.sampleRateHz;
+}
+
+int Sampler_countDips(void) {
+    Sampler_historyView_t view;
+    Sampler_acquireHistory(&view);
+    int dips = view.dips;
+    Sampler_releaseHistory(&view);
+    return dips;
+}
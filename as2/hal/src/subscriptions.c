@@ -0,0 +1,496 @@
+#define _GNU_SOURCE  // sendmmsg()
+
+#include "hal/subscriptions.h"
+#include "hal/sampler.h"
+#include "hal/history_codec.h"
+#include "hal/eventloop.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/random.h>
+
+#define NS_PER_MS 1000000LL
+#define NS_PER_SECOND 1000000000LL
+
+// How often the sender wakes to see which subscriptions are due.
+#define TICK_NS (10 * NS_PER_MS)
+
+// Datagrams sent with one sendmmsg(), at most.
+#define SEND_BATCH 32
+
+// Most datagrams one subscription may send per tick. A subscriber that
+// still has data left is serviced again on the next tick; one that stays
+// behind long enough loses samples (counted) when the sampler's live
+// ring wraps.
+#define MAX_DATAGRAMS_PER_TICK 16
+
+#define MAX_EVENTS_PER_DATAGRAM 32
+
+// A cookie is good for the lease period it was issued in and the next.
+#define COOKIE_PERIOD_NS (SUBSCRIPTION_LEASE_S * NS_PER_SECOND)
+
+typedef enum {
+    STREAM_SAMPLES,
+    STREAM_SUMMARY,
+    STREAM_DIPS,
+    NUM_STREAMS,
+} stream_t;
+
+static const char *streamNames[NUM_STREAMS] = { "samples", "summary", "dips" };
+
+typedef struct {
+    bool active;
+    stream_t stream;
+    struct sockaddr_in addr;
+    long long periodNs;
+    long long nextDueNs;
+    long long leaseExpiryNs;
+    uint32_t seq;
+    long long dropped;
+
+    // Where this subscriber is up to.
+    long long cursor;           // next sample / dip event number
+    long long lastSamples;      // summary: totals at the last report
+    long long lastDips;
+    long long lastOverruns;
+    long long lastDiscarded;
+} subscription_t;
+
+static subscription_t subs[SUBSCRIPTIONS_MAX];
+static pthread_mutex_t subsLock = PTHREAD_MUTEX_INITIALIZER;
+
+static int sendSock = -1;
+static pthread_t senderThread;
+static atomic_bool running = false;
+static int tickTimer = -1;      // on the event loop instead of a thread
+
+// Datagrams queued this tick.
+static struct mmsghdr outMsgs[SEND_BATCH];
+static struct iovec outIovs[SEND_BATCH];
+static uint8_t outBufs[SEND_BATCH][HISTORY_MAX_DATAGRAM];
+static subscription_t *outOwners[SEND_BATCH];
+static int outItems[SEND_BATCH];
+static int outCount = 0;
+
+static atomic_llong statDatagrams;
+static atomic_llong statSendFailures;
+static atomic_llong statDropped;
+static atomic_llong statExpired;
+static atomic_llong statUnconfirmed;
+
+// Key for the subscribe cookies, random per run.
+static uint64_t cookieKey[2];
+static pthread_once_t cookieKeyOnce = PTHREAD_ONCE_INIT;
+
+static long long monotonicNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NS_PER_SECOND + ts.tv_nsec;
+}
+
+static void addDropped(subscription_t *pSub, long long n)
+{
+    pSub->dropped += n;
+    atomic_fetch_add(&statDropped, n);
+}
+
+// Send everything queued, without blocking. Whatever the socket will not
+// take is lost, and counted against the subscriber it was for.
+static void flushQueue(void)
+{
+    int sent = 0;
+    while (sent < outCount) {
+        int n = sendmmsg(sendSock, outMsgs + sent, outCount - sent, MSG_DONTWAIT);
+        if (n <= 0) {
+            break;
+        }
+        sent += n;
+    }
+    atomic_fetch_add(&statDatagrams, sent);
+    for (int i = sent; i < outCount; i++) {
+        atomic_fetch_add(&statSendFailures, 1);
+        addDropped(outOwners[i], outItems[i]);
+    }
+    outCount = 0;
+}
+
+// Reserve the next outgoing buffer for pSub.
+static uint8_t *queueBuffer(subscription_t *pSub)
+{
+    if (outCount == SEND_BATCH) {
+        flushQueue();
+    }
+    int i = outCount;
+    outOwners[i] = pSub;
+    outItems[i] = 0;
+    return outBufs[i];
+}
+
+static void queueCommit(int len, int items)
+{
+    int i = outCount++;
+    outItems[i] = items;
+    outIovs[i].iov_base = outBufs[i];
+    outIovs[i].iov_len = len;
+    memset(&outMsgs[i], 0, sizeof(outMsgs[i]));
+    outMsgs[i].msg_hdr.msg_name = &outOwners[i]->addr;
+    outMsgs[i].msg_hdr.msg_namelen = sizeof(outOwners[i]->addr);
+    outMsgs[i].msg_hdr.msg_iov = &outIovs[i];
+    outMsgs[i].msg_hdr.msg_iovlen = 1;
+}
+
+// Returns true if the subscriber was left with data still to send.
+static bool serviceSamples(subscription_t *pSub)
+{
+    uint16_t samples[HISTORY_MAX_DATAGRAM];
+    int rate = Sampler_getSampleRateHz();
+
+    for (int d = 0; d < MAX_DATAGRAMS_PER_TICK; d++) {
+        long long lost = 0;
+        int got = Sampler_readLiveSamples(&pSub->cursor, samples, HISTORY_MAX_DATAGRAM, &lost);
+        if (lost > 0) {
+            addDropped(pSub, lost);
+        }
+        if (got == 0) {
+            return false;
+        }
+
+        long long first = pSub->cursor - got;
+        History_stream_t header = {
+            .seq = pSub->seq++,
+            .dropped = (uint32_t)pSub->dropped,
+            .firstSample = (uint64_t)first,
+            .sampleRateHz = (uint32_t)rate,
+        };
+        int consumed = 0;
+        uint8_t *out = queueBuffer(pSub);
+        int len = History_encodeStreamDatagram(&header, samples, got, out, HISTORY_MAX_DATAGRAM,
+                                               &consumed);
+        queueCommit(len, consumed);
+
+        // Whatever did not fit goes in the next datagram.
+        pSub->cursor = first + consumed;
+    }
+    return pSub->cursor < Sampler_getLiveHead();
+}
+
+static void serviceSummary(subscription_t *pSub)
+{
+    long long samples = Sampler_getNumSamplesTaken();
+    long long dips = Sampler_getDipEventHead();
+    long long overruns = Sampler_getNumOverruns();
+    long long discarded = Sampler_getNumSamplesDiscarded();
+
+    char *out = (char *)queueBuffer(pSub);
+    int len = snprintf(out, HISTORY_MAX_DATAGRAM,
+                       "# summary seq %u dropped %lld\n"
+                       "samples %lld avg %.3f dips %lld overruns %lld discarded %lld\n",
+                       pSub->seq++, pSub->dropped,
+                       samples - pSub->lastSamples, Sampler_getAverageReading(),
+                       dips - pSub->lastDips, overruns - pSub->lastOverruns,
+                       discarded - pSub->lastDiscarded);
+    queueCommit(len, 1);
+
+    pSub->lastSamples = samples;
+    pSub->lastDips = dips;
+    pSub->lastOverruns = overruns;
+    pSub->lastDiscarded = discarded;
+}
+
+static bool serviceDips(subscription_t *pSub)
+{
+    Sampler_dipEvent_t events[MAX_EVENTS_PER_DATAGRAM];
+
+    for (int d = 0; d < MAX_DATAGRAMS_PER_TICK; d++) {
+        long long lost = 0;
+        int got = Sampler_readDipEvents(&pSub->cursor, events, MAX_EVENTS_PER_DATAGRAM, &lost);
+        if (lost > 0) {
+            addDropped(pSub, lost);
+        }
+        if (got == 0) {
+            return false;
+        }
+
+        char *out = (char *)queueBuffer(pSub);
+        int len = snprintf(out, HISTORY_MAX_DATAGRAM, "# dips seq %u dropped %lld\n",
+                           pSub->seq++, pSub->dropped);
+        for (int i = 0; i < got; i++) {
+            // At most ~50 bytes a line, so MAX_EVENTS_PER_DATAGRAM lines always fit.
+            len += snprintf(out + len, HISTORY_MAX_DATAGRAM - len, "dip %lld %.6f\n",
+                            events[i].sampleNumber, events[i].timeNs / (double)NS_PER_SECOND);
+        }
+        queueCommit(len, got);
+    }
+    return pSub->cursor < Sampler_getDipEventHead();
+}
+
+static void serviceAll(void* arg)
+{
+    (void)arg;
+    long long now = monotonicNs();
+
+    pthread_mutex_lock(&subsLock);
+    for (int i = 0; i < SUBSCRIPTIONS_MAX; i++) {
+        subscription_t *pSub = &subs[i];
+        if (!pSub->active) {
+            continue;
+        }
+        if (now >= pSub->leaseExpiryNs) {
+            pSub->active = false;
+            atomic_fetch_add(&statExpired, 1);
+            continue;
+        }
+        if (now < pSub->nextDueNs) {
+            continue;
+        }
+
+        bool behind = false;
+        switch (pSub->stream) {
+        case STREAM_SAMPLES: behind = serviceSamples(pSub); break;
+        case STREAM_SUMMARY: serviceSummary(pSub); break;
+        case STREAM_DIPS:    behind = serviceDips(pSub); break;
+        default: break;
+        }
+
+        // Catch up on the next tick if behind; never try to make up
+        // for missed periods with a burst.
+        pSub->nextDueNs = behind ? now : pSub->nextDueNs + pSub->periodNs;
+        if (pSub->nextDueNs < now) {
+            pSub->nextDueNs = now + pSub->periodNs;
+        }
+    }
+    flushQueue();
+    pthread_mutex_unlock(&subsLock);
+}
+
+static void* senderFunc(void* arg)
+{
+    (void)arg;
+    struct timespec tick = { .tv_sec = 0, .tv_nsec = TICK_NS };
+
+    while (atomic_load(&running)) {
+        serviceAll(NULL);
+        nanosleep(&tick, NULL);
+    }
+    return NULL;
+}
+
+static bool sameClient(const struct sockaddr_in *a, const struct sockaddr_in *b)
+{
+    return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+#define ROTL64(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+#define SIP_ROUND(v0, v1, v2, v3) do {                                          \
+        v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; v0 = ROTL64(v0, 32);          \
+        v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2;                                \
+        v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0;                                \
+        v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; v2 = ROTL64(v2, 32);          \
+    } while (0)
+
+// SipHash-2-4 of two 64-bit words: a keyed hash whose output says
+// nothing useful about the key, so cookies can't be forged.
+static uint64_t sipHash(const uint64_t key[2], uint64_t m0, uint64_t m1)
+{
+    uint64_t v0 = key[0] ^ 0x736f6d6570736575ULL;
+    uint64_t v1 = key[1] ^ 0x646f72616e646f6dULL;
+    uint64_t v2 = key[0] ^ 0x6c7967656e657261ULL;
+    uint64_t v3 = key[1] ^ 0x7465646279746573ULL;
+    uint64_t words[3] = { m0, m1, (uint64_t)16 << 56 };
+    for (int i = 0; i < 3; i++) {
+        v3 ^= words[i];
+        SIP_ROUND(v0, v1, v2, v3);
+        SIP_ROUND(v0, v1, v2, v3);
+        v0 ^= words[i];
+    }
+    v2 ^= 0xff;
+    for (int i = 0; i < 4; i++) {
+        SIP_ROUND(v0, v1, v2, v3);
+    }
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+static void makeCookieKey(void)
+{
+    if (getrandom(cookieKey, sizeof(cookieKey), 0) != sizeof(cookieKey)) {
+        perror("Subscriptions: getrandom");
+        cookieKey[0] = (uint64_t)monotonicNs() ^ ((uint64_t)getpid() << 32);
+        cookieKey[1] = (uint64_t)time(NULL) * 0x9E3779B97F4A7C15ULL;
+    }
+}
+
+// The cookie for this client address and stream, in the given cookie
+// period. Only the client at that address ever sees it.
+static uint64_t makeCookie(const struct sockaddr_in *cli, stream_t stream, long long period)
+{
+    pthread_once(&cookieKeyOnce, makeCookieKey);
+    uint64_t where = (uint64_t)cli->sin_addr.s_addr << 32 | (uint64_t)cli->sin_port << 16 | stream;
+    return sipHash(cookieKey, where, (uint64_t)period);
+}
+
+static bool cookieValid(const struct sockaddr_in *cli, stream_t stream, uint64_t cookie, long long now)
+{
+    long long period = now / COOKIE_PERIOD_NS;
+    return cookie == makeCookie(cli, stream, period) || cookie == makeCookie(cli, stream, period - 1);
+}
+
+static int findStream(const char *name)
+{
+    for (int s = 0; s < NUM_STREAMS; s++) {
+        if (strcmp(name, streamNames[s]) == 0) {
+            return s;
+        }
+    }
+    return -1;
+}
+
+void Subscriptions_subscribe(const struct sockaddr_in *cli, const char *args, char *buf, int cap)
+{
+    char name[16] = "";
+    int periodMs = SUBSCRIPTION_DEFAULT_PERIOD_MS;
+    unsigned long long cookie = 0;
+    bool hasCookie = false;
+    int n = 0;
+    bool ok = (sscanf(args, "%15s %n", name, &n) == 1 && findStream(name) >= 0);
+    args += n;
+    if (ok && sscanf(args, "%d %n", &periodMs, &n) == 1) {
+        args += n;
+    }
+    if (ok && sscanf(args, "cookie %llx %n", &cookie, &n) == 1) {
+        hasCookie = true;
+        args += n;
+    }
+    if (!ok || args[0] != '\0') {
+        snprintf(buf, cap, "Usage: subscribe <samples|summary|dips> [period_ms] [cookie <c>]\n");
+        return;
+    }
+    stream_t stream = findStream(name);
+    if (periodMs < SUBSCRIPTION_MIN_PERIOD_MS) periodMs = SUBSCRIPTION_MIN_PERIOD_MS;
+    if (periodMs > SUBSCRIPTION_MAX_PERIOD_MS) periodMs = SUBSCRIPTION_MAX_PERIOD_MS;
+    long long now = monotonicNs();
+    uint64_t newCookie = makeCookie(cli, stream, now / COOKIE_PERIOD_NS);
+
+    // Nothing is pushed to an address until it echoes the cookie sent to
+    // it, so a spoofed source address can't start (or renew) a stream.
+    if (!hasCookie || !cookieValid(cli, stream, cookie, now)) {
+        atomic_fetch_add(&statUnconfirmed, 1);
+        snprintf(buf, cap, "# confirm with: subscribe %s %d cookie %016llx\n",
+                 name, periodMs, (unsigned long long)newCookie);
+        return;
+    }
+
+    pthread_mutex_lock(&subsLock);
+
+    // Subscribing again renews the lease (and may change the period).
+    subscription_t *pSub = NULL;
+    for (int i = 0; i < SUBSCRIPTIONS_MAX && !pSub; i++) {
+        if (subs[i].active && subs[i].stream == stream && sameClient(&subs[i].addr, cli)) {
+            pSub = &subs[i];
+        }
+    }
+    bool renewed = (pSub != NULL);
+    for (int i = 0; i < SUBSCRIPTIONS_MAX && !pSub; i++) {
+        if (!subs[i].active) {
+            pSub = &subs[i];
+            memset(pSub, 0, sizeof(*pSub));
+            pSub->stream = stream;
+            pSub->addr = *cli;
+            pSub->nextDueNs = now;
+            pSub->cursor = (stream == STREAM_DIPS) ? Sampler_getDipEventHead() : Sampler_getLiveHead();
+            pSub->lastSamples = Sampler_getNumSamplesTaken();
+            pSub->lastDips = Sampler_getDipEventHead();
+            pSub->lastOverruns = Sampler_getNumOverruns();
+            pSub->lastDiscarded = Sampler_getNumSamplesDiscarded();
+            pSub->active = true;
+        }
+    }
+    if (pSub) {
+        pSub->periodNs = periodMs * NS_PER_MS;
+        pSub->leaseExpiryNs = now + SUBSCRIPTION_LEASE_S * NS_PER_SECOND;
+    }
+
+    pthread_mutex_unlock(&subsLock);
+
+    if (!pSub) {
+        snprintf(buf, cap, "# too many subscriptions (max %d)\n", SUBSCRIPTIONS_MAX);
+    } else {
+        snprintf(buf, cap, "# %s %s every %d ms for %d s (renew with: subscribe %s %d cookie %016llx)\n",
+                 renewed ? "renewed" : "subscribed to", name, periodMs, SUBSCRIPTION_LEASE_S,
+                 name, periodMs, (unsigned long long)newCookie);
+    }
+}
+
+void Subscriptions_unsubscribe(const struct sockaddr_in *cli, const char *args, char *buf, int cap)
+{
+    char name[16] = "";
+    int stream = -1;
+    if (sscanf(args, "%15s", name) == 1) {
+        stream = findStream(name);
+        if (stream < 0) {
+            snprintf(buf, cap, "Usage: unsubscribe [samples|summary|dips]\n");
+            return;
+        }
+    }
+
+    int removed = 0;
+    pthread_mutex_lock(&subsLock);
+    for (int i = 0; i < SUBSCRIPTIONS_MAX; i++) {
+        if (subs[i].active && sameClient(&subs[i].addr, cli) &&
+                (stream < 0 || (int)subs[i].stream == stream)) {
+            subs[i].active = false;
+            removed++;
+        }
+    }
+    pthread_mutex_unlock(&subsLock);
+
+    snprintf(buf, cap, "# unsubscribed from %d stream(s)\n", removed);
+}
+
+void Subscriptions_getStats(Subscriptions_stats_t *pStats)
+{
+    pStats->active = 0;
+    pthread_mutex_lock(&subsLock);
+    for (int i = 0; i < SUBSCRIPTIONS_MAX; i++) {
+        pStats->active += subs[i].active;
+    }
+    pthread_mutex_unlock(&subsLock);
+    pStats->datagramsSent = atomic_load(&statDatagrams);
+    pStats->sendFailures = atomic_load(&statSendFailures);
+    pStats->itemsDropped = atomic_load(&statDropped);
+    pStats->expired = atomic_load(&statExpired);
+    pStats->unconfirmed = atomic_load(&statUnconfirmed);
+}
+
+void Subscriptions_init(int sock)
+{
+    sendSock = sock;
+    if (EventLoop_isActive()) {
+        tickTimer = EventLoop_addTimer(TICK_NS, serviceAll, NULL);
+        return;
+    }
+    atomic_store(&running, true);
+    pthread_create(&senderThread, NULL, senderFunc, NULL);
+}
+
+void Subscriptions_cleanup(void)
+{
+    if (tickTimer >= 0) {
+        EventLoop_removeTimer(tickTimer);
+        tickTimer = -1;
+    } else if (atomic_load(&running)) {
+        atomic_store(&running, false);
+        pthread_join(senderThread, NULL);
+    }
+
+    pthread_mutex_lock(&subsLock);
+    for (int i = 0; i < SUBSCRIPTIONS_MAX; i++) {
+        subs[i].active = false;
+    }
+    pthread_mutex_unlock(&subsLock);
+}
@@ -0,0 +1,175 @@
+#include "hal/timestamp.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+#define NS_PER_SECOND 1000000000LL
+#define CALIBRATION_NS (20 * 1000 * 1000LL)
+#define CALIBRATION_TRIES 5
+#define MAX_RATE_ERROR 1e-3         // reported vs measured counter rate
+#define MIN_COUNTER_HZ 1e6
+
+#if defined(__aarch64__) || defined(__x86_64__)
+#define HAVE_COUNTER 1
+__extension__ typedef __int128 int128_t;
+#else
+#define HAVE_COUNTER 0
+#endif
+
+typedef enum {
+    SOURCE_CLOCK,
+    SOURCE_CNTVCT,
+    SOURCE_TSC,
+} source_t;
+
+static pthread_once_t calibrateOnce = PTHREAD_ONCE_INIT;
+static atomic_bool calibrated = false;
+
+// Set once by calibrate(), read-only after.
+static source_t source = SOURCE_CLOCK;
+static double counterHz = 0;
+static uint64_t baseTicks = 0;
+static long long baseNs = 0;
+static long long nsPerTickQ32 = 0;  // ns per tick, << 32
+
+static long long clockNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NS_PER_SECOND + ts.tv_nsec;
+}
+
+static inline uint64_t readCounter(void)
+{
+#if defined(__aarch64__)
+    uint64_t ticks;
+    // The isb keeps the read from being speculated ahead of earlier code.
+    __asm__ volatile("isb\n\tmrs %0, cntvct_el0" : "=r"(ticks) : : "memory");
+    return ticks;
+#elif defined(__x86_64__)
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return (uint64_t)hi << 32 | lo;
+#else
+    return 0;
+#endif
+}
+
+// The counter's rate as the hardware reports it: 0 if it has to be
+// measured, -1 if there is no counter fit to use.
+static double reportedHz(source_t *pSource)
+{
+#if defined(__aarch64__)
+    uint64_t hz;
+    __asm__ volatile("mrs %0, cntfrq_el0" : "=r"(hz));
+    *pSource = SOURCE_CNTVCT;
+    return (double)hz;
+#elif defined(__x86_64__)
+    // Only an invariant TSC ticks at one rate, in every power state.
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1u << 8))) {
+        return -1;
+    }
+    *pSource = SOURCE_TSC;
+    return 0;
+#else
+    (void)pSource;
+    return -1;
+#endif
+}
+
+// A counter reading and the CLOCK_MONOTONIC time at the same moment:
+// the closest bracketed pair of a few tries.
+static void readPair(uint64_t *pTicks, long long *pNs)
+{
+    uint64_t bestWidth = UINT64_MAX;
+    for (int i = 0; i < CALIBRATION_TRIES; i++) {
+        uint64_t before = readCounter();
+        long long ns = clockNs();
+        uint64_t after = readCounter();
+        if (after - before < bestWidth) {
+            bestWidth = after - before;
+            *pTicks = before + (after - before) / 2;
+            *pNs = ns;
+        }
+    }
+}
+
+static void calibrate(void)
+{
+    const char *forced = getenv(TIMESTAMP_ENV);
+    source_t counter = SOURCE_CLOCK;
+    double hz = (forced && strcmp(forced, "clock") == 0) ? -1 : reportedHz(&counter);
+    if (HAVE_COUNTER && hz >= 0) {
+        uint64_t ticks0, ticks1;
+        long long ns0, ns1;
+        readPair(&ticks0, &ns0);
+        struct timespec wait = { 0, CALIBRATION_NS };
+        while (nanosleep(&wait, &wait) != 0) {
+            // interrupted by a signal: sleep the rest
+        }
+        readPair(&ticks1, &ns1);
+
+        double measuredHz = (double)(ticks1 - ticks0) * NS_PER_SECOND / (double)(ns1 - ns0);
+        double error = (hz > 0) ? (measuredHz - hz) / hz : 0;
+        if (error > MAX_RATE_ERROR || error < -MAX_RATE_ERROR) {
+            fprintf(stderr, "Timestamp: counter runs at %.0f Hz, not the %.0f Hz it reports\n",
+                    measuredHz, hz);
+            hz = measuredHz;
+        } else if (hz == 0) {
+            hz = measuredHz;
+        }
+
+        if (hz >= MIN_COUNTER_HZ) {
+            counterHz = hz;
+            nsPerTickQ32 = (long long)((double)NS_PER_SECOND * 4294967296.0 / hz + 0.5);
+            baseTicks = ticks1;
+            baseNs = ns1;
+            source = counter;
+        }
+    }
+    atomic_store_explicit(&calibrated, true, memory_order_release);
+}
+
+void Timestamp_init(void)
+{
+    pthread_once(&calibrateOnce, calibrate);
+}
+
+long long Timestamp_nowNs(void)
+{
+    if (!atomic_load_explicit(&calibrated, memory_order_acquire)) {
+        Timestamp_init();
+    }
+#if HAVE_COUNTER
+    if (source != SOURCE_CLOCK) {
+        long long ticks = (long long)(readCounter() - baseTicks);
+        return baseNs + (long long)(((int128_t)ticks * nsPerTickQ32) >> 32);
+    }
+#endif
+    return clockNs();
+}
+
+const char *Timestamp_getSourceName(void)
+{
+    Timestamp_init();
+    switch (source) {
+    case SOURCE_CNTVCT: return "cntvct";
+    case SOURCE_TSC:    return "tsc";
+    default:            return "clock_gettime";
+    }
+}
+
+double Timestamp_getCounterHz(void)
+{
+    Timestamp_init();
+    return counterHz;
+}
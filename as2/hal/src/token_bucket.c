@@ -0,0 +1,40 @@
+#include "hal/token_bucket.h"
+
+#define NS_PER_MILLI_TOKEN_AT_1HZ 1000000LL   // 1 token/s: a thousandth every ms
+
+void TokenBucket_refill(TokenBucket_t *pBucket, long long nowNs, int ratePerSecond, int burst)
+{
+    long long full = burst * TOKEN_BUCKET_MILLI;
+    if (pBucket->lastNs == 0 || ratePerSecond <= 0) {
+        if (pBucket->lastNs == 0) {
+            pBucket->milliTokens = full;
+        }
+        pBucket->lastNs = nowNs;
+        return;
+    }
+
+    long long added = (nowNs - pBucket->lastNs) * ratePerSecond / NS_PER_MILLI_TOKEN_AT_1HZ;
+    if (added <= 0) {
+        return;     // less than a thousandth so far: keep the time for later
+    }
+    pBucket->milliTokens += added;
+    pBucket->lastNs += added * NS_PER_MILLI_TOKEN_AT_1HZ / ratePerSecond;
+    if (pBucket->milliTokens >= full) {
+        pBucket->milliTokens = full;
+        pBucket->lastNs = nowNs;
+    }
+}
+
+bool TokenBucket_has(const TokenBucket_t *pBucket, int tokens)
+{
+    return pBucket->milliTokens >= tokens * TOKEN_BUCKET_MILLI;
+}
+
+bool TokenBucket_take(TokenBucket_t *pBucket, int tokens)
+{
+    if (!TokenBucket_has(pBucket, tokens)) {
+        return false;
+    }
+    pBucket->milliTokens -= tokens * TOKEN_BUCKET_MILLI;
+    return true;
+}
@@ -1,89 +1,1090 @@
+#define _GNU_SOURCE  // recvmmsg()/sendmmsg()
+
 #include "hal/udp_listener.h"
 #include "hal/sampler.h"
+#include "hal/adc_hal.h"
+#include "hal/history_codec.h"
+#include "hal/decimate.h"
+#include "hal/subscriptions.h"
+#include "hal/broadcast.h"
+#include "hal/periodTimer.h"
+#include "hal/probe.h"
+#include "hal/timestamp.h"
+#include "hal/eventloop.h"
+#include "hal/token_bucket.h"
 #include <stdio.h>
+#include <stdarg.h>
+#include <math.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <sys/socket.h>
 #include <pthread.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <time.h>
 
 #define BUF_SIZE 1500
 #define UDP_PORT 12345
 
+// "trace" dumps at most this many seconds of probe records.
+#define TRACE_DEFAULT_SECONDS 5
+#define TRACE_MAX_SECONDS 60
+
 static int udp_sock = -1;
 static pthread_t udp_thread;
 static volatile bool stop_requested = false;
 
-// Keep track of last command for empty line handling
-static char last_command[BUF_SIZE] = "";
+// Without the event loop: the listener's own thread, and an eventfd
+// that wakes it to exit (so cleanup never waits for a datagram).
+static bool own_thread = false;
+static int wake_fd = -1;
+
+static int probeCommand = -1;   // spans each command's handler
+
+// "trace" is written on the probes' worker thread; when it is done, this
+// eventfd wakes the listener to reply to the client who asked.
+static int trace_done_fd = -1;
+static struct sockaddr_in trace_client;
+static double trace_seconds;
+static atomic_long trace_events;
+
+// ---- Command registry ----
+// Commands by name (open addressing; entries are never removed).
+#define COMMAND_BUCKETS (2 * UDP_MAX_COMMANDS)
+#define NUM_LATENCY_BUCKETS 20      // log2 microseconds: <1us .. >=2^18us
+
+typedef struct {
+    char name[UDP_MAX_COMMAND_NAME];
+    UDP_commandHandler_t handler;
+    const char *help;
+    int cost;                   // tokens per call (see rate limiting)
+    // Totals are atomic so metrics can read them from another thread.
+    atomic_llong calls;
+    atomic_llong totalNs;
+    atomic_llong maxNs;
+    long long latency[NUM_LATENCY_BUCKETS];
+} command_t;
+
+static command_t commands[UDP_MAX_COMMANDS];     // in registration order
+// Commands are added before UDP_init() or by a handler, one at a time:
+// the entry is filled in, then the new count published (release), so
+// another thread that loads the count (acquire) sees whole entries.
+static atomic_int num_commands = 0;
+static int command_index[COMMAND_BUCKETS];      // index + 1, 0 = empty
+static bool builtins_registered = false;
+static atomic_llong stat_unknown_commands;
+
+// ---- Client sessions ----
+// One per client address, so "<enter> repeats last command" is per
+// client. At most UDP_MAX_SESSIONS; the least recently heard from is
+// dropped to make room.
+#define SESSION_BUCKETS 128
+#define SESSION_CMD_LEN 128
+
+typedef struct {
+    struct sockaddr_in addr;
+    char last_command[SESSION_CMD_LEN];
+    int lru_prev, lru_next;     // most recently used at lru_head
+    int chain;                  // next session in the same bucket
+} session_t;
+
+static session_t sessions[UDP_MAX_SESSIONS];
+static int session_buckets[SESSION_BUCKETS];    // index + 1, 0 = empty
+static int lru_head = -1, lru_tail = -1;
+static int num_sessions = 0;
+static atomic_llong stat_sessions_evicted;
+
+// ---- Rate limiting ----
+// Token buckets (hal/token_bucket.h). Each source IP address (not port:
+// changing ports must not buy a fresh budget) hashes to one of
+// SOURCE_BUCKETS buckets; sources that collide share one, which errs on
+// the side of limiting. A global bucket caps the total. When the global
+// bucket is below half, heavy commands (cost > 1) are shed first so
+// cheap ones keep working.
+#define SOURCE_BUCKETS 256
+
+static TokenBucket_t source_buckets[SOURCE_BUCKETS];
+static TokenBucket_t global_bucket;
+static bool rate_limiting = true;
+
+// Seconds sent for one "history N/since/from" request; the reply says
+// where to resume. One, like plain "history": the request carries no
+// proof of its source address, so a bigger reply would let a spoofed
+// datagram aim many times its size at someone else (see the subscribe
+// cookie). Clients page through with "history from <next>".
+#define HISTORY_SECONDS_PER_REQUEST 1
+#define PLOT_MAX_SECONDS 10         // one datagram whatever the span
+#define PLOT_MAX_TEXT_POINTS 100    // a text line per point, still one datagram
+
+// "history since <t>" times are clamped to this many seconds, so the
+// time in ns fits a long long (converting a larger double is undefined).
+#define HISTORY_MAX_SINCE_SECONDS 9.0e9
+
+// Incoming batch, filled by one recvmmsg()
+static struct mmsghdr in_msgs[UDP_BATCH];
+static struct iovec in_iovs[UDP_BATCH];
+static char in_bufs[UDP_BATCH][BUF_SIZE];
+static struct sockaddr_in in_addrs[UDP_BATCH];
+
+// Outgoing replies, queued while a batch is processed and sent with
+// one sendmmsg() (or earlier, if a long reply fills the queue)
+static struct mmsghdr out_msgs[UDP_BATCH];
+static struct iovec out_iovs[UDP_BATCH];
+static char out_bufs[UDP_BATCH][BUF_SIZE];
+static struct sockaddr_in out_addrs[UDP_BATCH];
+static int out_count = 0;
+
+static int batch_size = UDP_BATCH;  // datagrams per syscall, each way
+
+// Counters (written by the UDP thread, readable from any thread)
+static atomic_llong stat_packets_in;
+static atomic_llong stat_packets_out;
+static atomic_llong stat_recv_calls;
+static atomic_llong stat_send_calls;
+static atomic_int stat_max_recv_batch;
+static atomic_int stat_max_send_batch;
+static atomic_llong stat_accepted;
+static atomic_llong stat_shed_source;
+static atomic_llong stat_shed_global;
+static atomic_llong stat_shed_heavy;
+
+static void flushReplies(int sock) {
+    int sent = 0;
+    while (sent < out_count) {
+        int n = sendmmsg(sock, out_msgs + sent, out_count - sent, 0);
+        atomic_fetch_add(&stat_send_calls, 1);
+        if (n <= 0) {
+            perror("sendmmsg");
+            break;
+        }
+        sent += n;
+    }
+    atomic_fetch_add(&stat_packets_out, sent);
+    if (out_count > atomic_load(&stat_max_send_batch)) {
+        atomic_store(&stat_max_send_batch, out_count);
+    }
+    out_count = 0;
+}
+
+static void sendReply(int sock, const struct sockaddr_in* cli, const void* data, size_t len) {
+    if (out_count == batch_size) {
+        flushReplies(sock);
+    }
+    if (len > BUF_SIZE) {
+        len = BUF_SIZE;
+    }
+
+    int i = out_count++;
+    memcpy(out_bufs[i], data, len);
+    out_addrs[i] = *cli;
+    out_iovs[i].iov_base = out_bufs[i];
+    out_iovs[i].iov_len = len;
+    memset(&out_msgs[i], 0, sizeof(out_msgs[i]));
+    out_msgs[i].msg_hdr.msg_name = &out_addrs[i];
+    out_msgs[i].msg_hdr.msg_namelen = sizeof(out_addrs[i]);
+    out_msgs[i].msg_hdr.msg_iov = &out_iovs[i];
+    out_msgs[i].msg_hdr.msg_iovlen = 1;
+}
+
+void UDP_getStats(UDP_stats_t* pStats) {
+    pStats->packetsIn = atomic_load(&stat_packets_in);
+    pStats->packetsOut = atomic_load(&stat_packets_out);
+    pStats->recvCalls = atomic_load(&stat_recv_calls);
+    pStats->sendCalls = atomic_load(&stat_send_calls);
+    pStats->maxRecvBatch = atomic_load(&stat_max_recv_batch);
+    pStats->maxSendBatch = atomic_load(&stat_max_send_batch);
+    pStats->accepted = atomic_load(&stat_accepted);
+    pStats->shedSource = atomic_load(&stat_shed_source);
+    pStats->shedGlobal = atomic_load(&stat_shed_global);
+    pStats->shedHeavy = atomic_load(&stat_shed_heavy);
+    pStats->unknownCommands = atomic_load(&stat_unknown_commands);
+    pStats->sessionsEvicted = atomic_load(&stat_sessions_evicted);
+}
+
+int UDP_getCommandStats(UDP_commandStats_t* pStats, int max) {
+    int numCommands = atomic_load_explicit(&num_commands, memory_order_acquire);
+    int n = (numCommands < max) ? numCommands : max;
+    for (int i = 0; i < n; i++) {
+        pStats[i].name = commands[i].name;
+        pStats[i].calls = atomic_load_explicit(&commands[i].calls, memory_order_relaxed);
+        pStats[i].totalNs = atomic_load_explicit(&commands[i].totalNs, memory_order_relaxed);
+        pStats[i].maxNs = atomic_load_explicit(&commands[i].maxNs, memory_order_relaxed);
+    }
+    return n;
+}
+
+// Send the previous second as text, split on line boundaries across as
+// many datagrams as it takes.
+static void sendHistoryText(const Sampler_historyView_t* pHist, const struct sockaddr_in* cli, int sock) {
+    char buf[HISTORY_MAX_DATAGRAM];
+    int first = 0;
+    if (pHist->size == 0) {
+        sendReply(sock, cli, "\n", 1);
+        return;
+    }
+    while (first < pHist->size) {
+        int consumed = 0;
+        int len = History_formatText(pHist->samples, pHist->size, first, buf, sizeof(buf), &consumed);
+        if (consumed == 0) {
+            break;
+        }
+        sendReply(sock, cli, buf, len);
+        first += consumed;
+    }
+}
+
+// Send the previous second in protocol version 2 (see hal/history_codec.h).
+static void sendHistoryBinary(const Sampler_historyView_t* pHist, History_encoding_t encoding,
+                              const struct sockaddr_in* cli, int sock) {
+    uint8_t buf[HISTORY_MAX_DATAGRAM];
+    History_reply_t reply = {
+        .samples = pHist->samples,
+        .totalSamples = pHist->size,
+        .sampleRateHz = Sampler_getSampleRateHz(),
+        .startTimeNs = pHist->startTimeNs,
+        .replyId = (uint32_t)pHist->second,
+        .encoding = encoding,
+    };
+
+    int first = 0;
+    uint16_t seq = 0;
+    do {
+        int consumed = 0;
+        int len = History_encodeDatagram(&reply, seq++, first, buf, sizeof(buf), &consumed);
+        sendReply(sock, cli, buf, len);
+        first += consumed;
+    } while (first < reply.totalSamples);
+}
+
+static long long monotonicNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// FNV-1a over the first `len` bytes
+static uint32_t hashBytes(const void* data, size_t len) {
+    const uint8_t* p = data;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+}
+
+static command_t* findCommand(const char* name, size_t len) {
+    uint32_t slot = hashBytes(name, len) % COMMAND_BUCKETS;
+    while (command_index[slot] != 0) {
+        command_t* pCmd = &commands[command_index[slot] - 1];
+        if (strlen(pCmd->name) == len && memcmp(pCmd->name, name, len) == 0) {
+            return pCmd;
+        }
+        slot = (slot + 1) % COMMAND_BUCKETS;
+    }
+    return NULL;
+}
+
+static void registerBuiltins(void);
+
+int UDP_registerCommand(const char* name, UDP_commandHandler_t handler, const char* help) {
+    if (!builtins_registered) {
+        builtins_registered = true;
+        registerBuiltins();
+    }
+
+    size_t len = strlen(name);
+    if (len == 0 || len >= UDP_MAX_COMMAND_NAME || strchr(name, ' ')) {
+        fprintf(stderr, "UDP_registerCommand: bad name '%s'\n", name);
+        return -1;
+    }
+    int n = atomic_load_explicit(&num_commands, memory_order_relaxed);
+    if (n == UDP_MAX_COMMANDS || findCommand(name, len)) {
+        fprintf(stderr, "UDP_registerCommand: cannot add '%s'\n", name);
+        return -1;
+    }
+
+    command_t* pCmd = &commands[n];
+    memset(pCmd, 0, sizeof(*pCmd));
+    memcpy(pCmd->name, name, len + 1);
+    pCmd->handler = handler;
+    pCmd->help = help;
+    pCmd->cost = 1;
+
+    uint32_t slot = hashBytes(name, len) % COMMAND_BUCKETS;
+    while (command_index[slot] != 0) {
+        slot = (slot + 1) % COMMAND_BUCKETS;
+    }
+    command_index[slot] = n + 1;
+    atomic_store_explicit(&num_commands, n + 1, memory_order_release);
+    return 0;
+}
+
+int UDP_setCommandCost(const char* name, int cost) {
+    command_t* pCmd = findCommand(name, strlen(name));
+    if (!pCmd || cost < 1 || cost > UDP_SOURCE_BURST) {
+        return -1;
+    }
+    pCmd->cost = cost;
+    return 0;
+}
 
-// Handle a single command
-static void handleCommand(const char* cmd, struct sockaddr_in* cli, int sock) {
+static void lruUnlink(int i) {
+    session_t* pS = &sessions[i];
+    if (pS->lru_prev >= 0) sessions[pS->lru_prev].lru_next = pS->lru_next;
+    else lru_head = pS->lru_next;
+    if (pS->lru_next >= 0) sessions[pS->lru_next].lru_prev = pS->lru_prev;
+    else lru_tail = pS->lru_prev;
+}
+
+static void lruPushFront(int i) {
+    sessions[i].lru_prev = -1;
+    sessions[i].lru_next = lru_head;
+    if (lru_head >= 0) sessions[lru_head].lru_prev = i;
+    lru_head = i;
+    if (lru_tail < 0) lru_tail = i;
+}
+
+static uint32_t sessionBucket(const struct sockaddr_in* addr) {
+    uint8_t key[6];
+    memcpy(key, &addr->sin_addr.s_addr, 4);
+    memcpy(key + 4, &addr->sin_port, 2);
+    return hashBytes(key, sizeof(key)) % SESSION_BUCKETS;
+}
+
+static void chainRemove(int i) {
+    int* pLink = &session_buckets[sessionBucket(&sessions[i].addr)];
+    while (*pLink != i + 1) {
+        pLink = &sessions[*pLink - 1].chain;
+    }
+    *pLink = sessions[i].chain;
+}
+
+// Find the client's session, creating it (evicting the least recently
+// used one if full) if need be. Marks it most recently used.
+static session_t* getSession(const struct sockaddr_in* addr) {
+    uint32_t bucket = sessionBucket(addr);
+    for (int link = session_buckets[bucket]; link != 0; link = sessions[link - 1].chain) {
+        session_t* pS = &sessions[link - 1];
+        if (pS->addr.sin_addr.s_addr == addr->sin_addr.s_addr && pS->addr.sin_port == addr->sin_port) {
+            lruUnlink(link - 1);
+            lruPushFront(link - 1);
+            return pS;
+        }
+    }
+
+    int i;
+    if (num_sessions < UDP_MAX_SESSIONS) {
+        i = num_sessions++;
+    } else {
+        i = lru_tail;
+        chainRemove(i);
+        lruUnlink(i);
+        atomic_fetch_add(&stat_sessions_evicted, 1);
+    }
+
+    session_t* pS = &sessions[i];
+    pS->addr = *addr;
+    pS->last_command[0] = '\0';
+    pS->chain = session_buckets[bucket];
+    session_buckets[bucket] = i + 1;
+    lruPushFront(i);
+    return pS;
+}
+
+void UDP_reply(const UDP_request_t* pReq, const void* data, size_t len) {
+    sendReply(udp_sock, pReq->client, data, len);
+}
+
+void UDP_replyf(const UDP_request_t* pReq, const char* fmt, ...) {
     char buf[BUF_SIZE];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    if (len >= (int)sizeof(buf)) {
+        len = sizeof(buf) - 1;
+    }
+    if (len > 0) {
+        UDP_reply(pReq, buf, len);
+    }
+}
+
+// Collects reply lines into datagrams of at most HISTORY_MAX_DATAGRAM
+// bytes, never splitting a line.
+typedef struct {
+    const UDP_request_t* pReq;
+    char buf[HISTORY_MAX_DATAGRAM];
+    int len;
+} lineReply_t;
+
+static void linesFlush(lineReply_t* pLines) {
+    if (pLines->len > 0) {
+        UDP_reply(pLines->pReq, pLines->buf, pLines->len);
+        pLines->len = 0;
+    }
+}
+
+__attribute__((format(printf, 2, 3)))
+static void linesAdd(lineReply_t* pLines, const char* fmt, ...) {
+    char line[256];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    if (len >= (int)sizeof(line)) {
+        len = sizeof(line) - 1;
+    }
+    if (pLines->len + len > (int)sizeof(pLines->buf)) {
+        linesFlush(pLines);
+    }
+    memcpy(pLines->buf + pLines->len, line, len);
+    pLines->len += len;
+}
+
+static TokenBucket_t* sourceBucket(const struct sockaddr_in* addr) {
+    return &source_buckets[hashBytes(&addr->sin_addr.s_addr, 4) % SOURCE_BUCKETS];
+}
 
-    if (strcmp(cmd, "help") == 0 || strcmp(cmd, "?") == 0) {
-        snprintf(buf, sizeof(buf),
-                 "Accepted command examples:\n"
-                 "count -- get the total number of samples taken.\n"
-                 "length -- get the number of samples taken in the previously completed second.\n"
-                 "dips -- get the number of dips in the previously completed second.\n"
-                 "history -- get all the samples in the previously completed second.\n"
-                 "stop -- cause the server program to end.\n"
-                 "<enter> -- repeat last command.\n");
-    } else if (strcmp(cmd, "count") == 0) {
-        snprintf(buf, sizeof(buf), "# samples taken total: %lld\n", Sampler_getNumSamplesTaken());
-    } else if (strcmp(cmd, "length") == 0) {
-        snprintf(buf, sizeof(buf), "# samples taken last second: %d\n", Sampler_getHistorySize());
-    } else if (strcmp(cmd, "dips") == 0) {
-        snprintf(buf, sizeof(buf), "# Dips: %d\n", Sampler_countDips());
-    } else if (strcmp(cmd, "history") == 0) {
-        int sz;
-        double* hist = Sampler_getHistory(&sz);
-        int max_per_line = 10;
-        for (int i = 0; i < sz; i++) {
-            snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf), "%.3f%s", hist[i], (i < sz - 1) ? ", " : "\n");
-            if ((i + 1) % max_per_line == 0) {
-                strncat(buf, "\n", sizeof(buf) - strlen(buf) - 1);
+// Cheapest check, before the datagram is even parsed: is the source
+// already out of tokens?
+static bool sourceHasTokens(const struct sockaddr_in* addr, long long now) {
+    if (!rate_limiting) {
+        return true;
+    }
+    TokenBucket_t* pBucket = sourceBucket(addr);
+    TokenBucket_refill(pBucket, now, UDP_SOURCE_RATE, UDP_SOURCE_BURST);
+    return TokenBucket_has(pBucket, 1);
+}
+
+// Charge a command's cost to its source and to the global budget, or
+// say why it must be shed.
+static bool admit(const struct sockaddr_in* addr, int cost, long long now) {
+    if (!rate_limiting) {
+        atomic_fetch_add(&stat_accepted, 1);
+        return true;
+    }
+    TokenBucket_t* pSource = sourceBucket(addr);
+    if (!TokenBucket_has(pSource, cost)) {
+        atomic_fetch_add(&stat_shed_source, 1);
+        return false;
+    }
+
+    TokenBucket_refill(&global_bucket, now, UDP_GLOBAL_RATE, UDP_GLOBAL_BURST);
+    if (cost > 1 && !TokenBucket_has(&global_bucket, UDP_GLOBAL_BURST / 2)) {
+        atomic_fetch_add(&stat_shed_heavy, 1);
+        return false;
+    }
+    if (!TokenBucket_take(&global_bucket, cost)) {
+        atomic_fetch_add(&stat_shed_global, 1);
+        return false;
+    }
+
+    TokenBucket_take(pSource, cost);
+    atomic_fetch_add(&stat_accepted, 1);
+    return true;
+}
+
+// ---- Built-in commands ----
+static void cmdHelp(const UDP_request_t* pReq) {
+    lineReply_t lines = { .pReq = pReq };
+    linesAdd(&lines, "Accepted command examples:\n");
+    int numCommands = atomic_load_explicit(&num_commands, memory_order_relaxed);
+    for (int i = 0; i < numCommands; i++) {
+        if (commands[i].help) {
+            linesAdd(&lines, "%s\n", commands[i].help);
+        }
+    }
+    linesAdd(&lines, "<enter> -- repeat last command.\n");
+    linesFlush(&lines);
+}
+
+static void cmdCount(const UDP_request_t* pReq) {
+    UDP_replyf(pReq, "# samples taken total: %lld\n", Sampler_getNumSamplesTaken());
+}
+
+static void cmdLength(const UDP_request_t* pReq) {
+    UDP_replyf(pReq, "# samples taken last second: %d\n", Sampler_getHistorySize());
+}
+
+static void cmdDips(const UDP_request_t* pReq) {
+    UDP_replyf(pReq, "# Dips: %d\n", Sampler_countDips());
+}
+
+// Parse "[v2 [raw|delta]]" (the end of every history command).
+static bool parseHistoryFormat(const char* args, bool* pBinary, History_encoding_t* pEncoding) {
+    *pBinary = false;
+    *pEncoding = HISTORY_ENC_DELTA;
+    if (args[0] == '\0') {
+        return true;
+    }
+    *pBinary = true;
+    if (strcmp(args, "v2") == 0 || strcmp(args, "v2 delta") == 0) {
+        return true;
+    }
+    if (strcmp(args, "v2 raw") == 0) {
+        *pEncoding = HISTORY_ENC_RAW;
+        return true;
+    }
+    return false;
+}
+
+// Send retained seconds [first, ...], at most `max` of them, each as a
+// text block with a header line, or as a binary reply whose reply id is
+// the second's number. Ends (in text) with the cursor to resume from.
+static void sendSeconds(const UDP_request_t* pReq, long long first, int max,
+                        bool binary, History_encoding_t encoding) {
+    long long oldest, newest;
+    Sampler_getRetainedSeconds(&oldest, &newest);
+    if (first < oldest) {
+        if (!binary && newest >= 0) {
+            UDP_replyf(pReq, "# lost %lld seconds (no longer retained)\n", oldest - first);
+        }
+        first = oldest;
+    }
+
+    long long k = first;
+    for (; k <= newest && k < first + max; k++) {
+        Sampler_historyView_t hist;
+        if (!Sampler_acquireSecond(k, &hist)) {
+            Sampler_releaseHistory(&hist);
+            continue;   // aged out while we were sending
+        }
+        if (binary) {
+            sendHistoryBinary(&hist, encoding, pReq->client, udp_sock);
+        } else {
+            UDP_replyf(pReq, "# second %lld start %.6f samples %d dips %d\n",
+                       hist.second, hist.startTimeNs / 1e9, hist.size, hist.dips);
+            if (hist.size > 0) {
+                sendHistoryText(&hist, pReq->client, udp_sock);
             }
         }
-        free(hist);
-    } else if (strcmp(cmd, "stop") == 0) {
-        snprintf(buf, sizeof(buf), "Program terminating.\n");
-        stop_requested = true;
+        Sampler_releaseHistory(&hist);
+    }
+    if (!binary) {
+        UDP_replyf(pReq, "# next %lld\n", k);
+    }
+}
+
+static void cmdHistory(const UDP_request_t* pReq) {
+    const char* args = pReq->args;
+    bool binary;
+    History_encoding_t encoding;
+    long long oldest, newest;
+    Sampler_getRetainedSeconds(&oldest, &newest);
+
+    char word[16];
+    int used = 0;
+    long long first = -1;
+    int max = HISTORY_SECONDS_PER_REQUEST;
+    double since;
+    long long from;
+    int count;
+    if (sscanf(args, "since %lf %n", &since, &used) == 1) {
+        if (!isfinite(since)) {
+            used = -1;
+        } else {
+            if (since < 0) since = 0;
+            if (since > HISTORY_MAX_SINCE_SECONDS) since = HISTORY_MAX_SINCE_SECONDS;
+            first = Sampler_findSecond((long long)(since * 1e9));
+        }
+    } else if (sscanf(args, "from %lld %n", &from, &used) == 1) {
+        first = from;
+    } else if (sscanf(args, "%d %n", &count, &used) == 1 && count > 0) {
+        first = newest - count + 1;
+        if (first < oldest) first = oldest;     // what's retained, not "lost"
+    } else if (sscanf(args, "%15s", word) == 1 && strcmp(word, "v2") != 0) {
+        used = -1;
+    }
+
+    if (used < 0 || !parseHistoryFormat(args + used, &binary, &encoding)) {
+        UDP_replyf(pReq, "Usage: history [<N> | since <t> | from <second>] [v2 [raw|delta]]\n");
+        return;
+    }
+
+    if (first >= 0 || used > 0) {
+        sendSeconds(pReq, first < 0 ? 0 : first, max, binary, encoding);
+        return;
+    }
+
+    // Plain "history": just the last second, as always.
+    Sampler_historyView_t hist;
+    Sampler_acquireHistory(&hist);
+    if (binary) {
+        sendHistoryBinary(&hist, encoding, pReq->client, udp_sock);
+    } else {
+        sendHistoryText(&hist, pReq->client, udp_sock);
+    }
+    Sampler_releaseHistory(&hist);
+}
+
+// Decimate the last few seconds and send them in one datagram.
+static void cmdPlot(const UDP_request_t* pReq) {
+    const char* args = pReq->args;
+    int points, seconds = 1, n = 0;
+    History_plotMethod_t method = HISTORY_PLOT_MINMAX;
+    bool binary = false;
+    bool ok = (sscanf(args, "%d %n", &points, &n) == 1 && points > 0);
+    args += n;
+    if (ok && sscanf(args, "%d %n", &seconds, &n) == 1) {
+        ok = (seconds > 0);
+        args += n;
+    }
+    char word[16];
+    while (ok && sscanf(args, "%15s %n", word, &n) == 1) {
+        if (strcmp(word, "minmax") == 0) {
+            method = HISTORY_PLOT_MINMAX;
+        } else if (strcmp(word, "lttb") == 0) {
+            method = HISTORY_PLOT_LTTB;
+        } else if (strcmp(word, "v2") == 0) {
+            binary = true;
+        } else {
+            ok = false;
+        }
+        args += n;
+    }
+    if (!ok) {
+        UDP_replyf(pReq, "Usage: plot <points> [seconds] [minmax|lttb] [v2]\n");
+        return;
+    }
+
+    int maxPoints = (method == HISTORY_PLOT_MINMAX) ? HISTORY_PLOT_MAX_MINMAX : HISTORY_PLOT_MAX_LTTB;
+    if (!binary) maxPoints = PLOT_MAX_TEXT_POINTS;
+    if (points > maxPoints) points = maxPoints;
+    if (seconds > PLOT_MAX_SECONDS) seconds = PLOT_MAX_SECONDS;
+
+    // Pin the seconds and decimate them in place, as one series.
+    long long oldest, newest;
+    Sampler_getRetainedSeconds(&oldest, &newest);
+    long long first = newest - seconds + 1;
+    if (first < oldest) first = oldest;
+    Sampler_historyView_t views[PLOT_MAX_SECONDS];
+    Decimate_segment_t segs[PLOT_MAX_SECONDS];
+    int numViews = 0;
+    for (long long k = first; k <= newest; k++) {
+        if (Sampler_acquireSecond(k, &views[numViews])) {
+            segs[numViews].samples = views[numViews].samples;
+            segs[numViews].count = views[numViews].size;
+            numViews++;
+        } else {
+            Sampler_releaseHistory(&views[numViews]);
+        }
+    }
+
+    uint16_t mins[HISTORY_PLOT_MAX_MINMAX], maxs[HISTORY_PLOT_MAX_MINMAX];
+    uint32_t indices[HISTORY_PLOT_MAX_LTTB];
+    uint16_t values[HISTORY_PLOT_MAX_LTTB];
+    History_plot_t plot = {
+        .method = method,
+        .mins = mins,
+        .maxs = maxs,
+        .indices = indices,
+        .values = values,
+        .firstSecond = numViews ? (uint32_t)views[0].second : 0,
+        .seconds = numViews,
+        .totalSamples = (uint32_t)Decimate_countSamples(segs, numViews),
+        .sampleRateHz = Sampler_getSampleRateHz(),
+        .startTimeNs = numViews ? views[0].startTimeNs : 0,
+    };
+    if (method == HISTORY_PLOT_MINMAX) {
+        plot.points = Decimate_minMax(segs, numViews, points, mins, maxs);
     } else {
-        snprintf(buf, sizeof(buf), "Unknown command: %.1480s\n", cmd);
+        plot.points = Decimate_lttb(segs, numViews, points, indices, values);
+    }
+    for (int i = 0; i < numViews; i++) {
+        Sampler_releaseHistory(&views[i]);
+    }
+
+    if (binary) {
+        uint8_t buf[HISTORY_MAX_DATAGRAM];
+        UDP_reply(pReq, buf, History_encodePlot(&plot, buf));
+        return;
     }
 
-    sendto(sock, buf, strlen(buf), 0, (struct sockaddr*)cli, sizeof(*cli));
+    if (numViews == 0) {
+        UDP_replyf(pReq, "# plot: no completed seconds yet\n");
+        return;
+    }
+    char buf[HISTORY_MAX_DATAGRAM];
+    int len = snprintf(buf, sizeof(buf), "# plot %s seconds %u..%u start %.6f samples %u points %d\n",
+                       method == HISTORY_PLOT_MINMAX ? "minmax" : "lttb",
+                       plot.firstSecond, plot.firstSecond + plot.seconds - 1,
+                       plot.startTimeNs / 1e9, plot.totalSamples, plot.points);
+    for (int i = 0; i < plot.points && len < (int)sizeof(buf); i++) {
+        if (method == HISTORY_PLOT_MINMAX) {
+            len += snprintf(buf + len, sizeof(buf) - len, "%.3f %.3f\n",
+                            ADC_rawToVolts(mins[i]), ADC_rawToVolts(maxs[i]));
+        } else {
+            len += snprintf(buf + len, sizeof(buf) - len, "%u %.3f\n",
+                            indices[i], ADC_rawToVolts(values[i]));
+        }
+    }
+    if (len >= (int)sizeof(buf)) len = sizeof(buf) - 1;
+    UDP_reply(pReq, buf, len);
 }
 
-void* udpFunc(void* arg) {
-    (void)arg;
-    struct sockaddr_in cli;
-    socklen_t cli_len = sizeof(cli);
+static void cmdSubscribe(const UDP_request_t* pReq) {
     char buf[BUF_SIZE];
+    Subscriptions_subscribe(pReq->client, pReq->args, buf, sizeof(buf));
+    UDP_reply(pReq, buf, strlen(buf));
+}
 
-    while (!stop_requested) {
-        int n = recvfrom(udp_sock, buf, sizeof(buf) - 1, 0, (struct sockaddr*)&cli, &cli_len);
-        if (n > 0) {
-            buf[n] = '\0';
+static void cmdUnsubscribe(const UDP_request_t* pReq) {
+    char buf[BUF_SIZE];
+    Subscriptions_unsubscribe(pReq->client, pReq->args, buf, sizeof(buf));
+    UDP_reply(pReq, buf, strlen(buf));
+}
+
+static void cmdNetstats(const UDP_request_t* pReq) {
+    UDP_stats_t st;
+    Subscriptions_stats_t subSt;
+    UDP_getStats(&st);
+    Subscriptions_getStats(&subSt);
+    UDP_replyf(pReq,
+               "# packets in: %lld (%.2f per recv), out: %lld (%.2f per send), "
+               "max batch in/out: %d/%d\n"
+               "# subscriptions: %d active, %lld expired, %lld unconfirmed, %lld datagrams pushed, "
+               "%lld send failures, %lld items dropped\n"
+               "# commands accepted: %lld, shed: %lld (source over rate), "
+               "%lld (global budget), %lld (heavy, under load)\n",
+               st.packetsIn, st.recvCalls ? (double)st.packetsIn / st.recvCalls : 0.0,
+               st.packetsOut, st.sendCalls ? (double)st.packetsOut / st.sendCalls : 0.0,
+               st.maxRecvBatch, st.maxSendBatch,
+               subSt.active, subSt.expired, subSt.unconfirmed, subSt.datagramsSent,
+               subSt.sendFailures, subSt.itemsDropped,
+               st.accepted, st.shedSource, st.shedGlobal, st.shedHeavy);
+    if (Broadcast_isActive()) {
+        Broadcast_stats_t bcSt;
+        Broadcast_getStats(&bcSt);
+        UDP_replyf(pReq, "# summary broadcast: %d targets, %lld sent, %lld send failures\n",
+                   bcSt.targets, bcSt.summariesSent, bcSt.sendFailures);
+    }
+}
+
+// Upper bound (us) of the bucket holding the given fraction of calls
+static long long latencyPercentile(const command_t* pCmd, double fraction) {
+    long long target = (long long)(pCmd->calls * fraction + 0.5);
+    long long seen = 0;
+    for (int b = 0; b < NUM_LATENCY_BUCKETS; b++) {
+        seen += pCmd->latency[b];
+        if (seen >= target && seen > 0) {
+            return 1LL << b;
+        }
+    }
+    return 1LL << NUM_LATENCY_BUCKETS;
+}
+
+static void cmdStats(const UDP_request_t* pReq) {
+    lineReply_t lines = { .pReq = pReq };
+    linesAdd(&lines, "# command: calls, avg, p50, p99, max (time to handle, incl. queuing replies)\n");
+    int numCommands = atomic_load_explicit(&num_commands, memory_order_relaxed);
+    for (int i = 0; i < numCommands; i++) {
+        const command_t* pCmd = &commands[i];
+        if (pCmd->calls == 0) {
+            continue;
+        }
+        linesAdd(&lines, "# %s: %lld, %.1fus, <%lldus, <%lldus, %.1fus\n",
+                 pCmd->name, pCmd->calls, pCmd->totalNs / 1000.0 / pCmd->calls,
+                 latencyPercentile(pCmd, 0.50), latencyPercentile(pCmd, 0.99),
+                 pCmd->maxNs / 1000.0);
+    }
+    linesAdd(&lines, "# unknown commands: %lld\n", atomic_load(&stat_unknown_commands));
+    linesAdd(&lines, "# sessions: %d of %d, %lld evicted\n",
+             num_sessions, UDP_MAX_SESSIONS, atomic_load(&stat_sessions_evicted));
+    linesAdd(&lines, "# history: %lld seconds dropped (%lld dips), %lld samples discarded, "
+             "%lld overruns\n", Sampler_getNumSecondsDropped(), Sampler_getNumDipsDropped(),
+             Sampler_getNumSamplesDiscarded(), Sampler_getNumOverruns());
+    linesFlush(&lines);
+}
+
+// Period percentiles for the last reporting interval and since start;
+// "jitter deadline <event> <ms>" sets the deadline misses are counted against.
+static void cmdJitter(const UDP_request_t* pReq) {
+    char name[32];
+    double deadlineMs;
+    if (sscanf(pReq->args, "deadline %31s %lf", name, &deadlineMs) == 2) {
+        for (int e = 0; e < NUM_PERIOD_EVENTS; e++) {
+            if (strcmp(name, Period_getEventName(e)) == 0) {
+                Period_setDeadline(e, deadlineMs);
+                UDP_replyf(pReq, "# %s deadline: %.3f ms\n", name, deadlineMs);
+                return;
+            }
+        }
+        UDP_replyf(pReq, "Unknown event: %s\n", name);
+        return;
+    }
+    if (pReq->args[0] != '\0') {
+        UDP_replyf(pReq, "Usage: jitter [deadline <event> <ms>]\n");
+        return;
+    }
+
+    static Histogram_t sinceStart;     // too big for comfort on the stack
+    lineReply_t lines = { .pReq = pReq };
+    if (Timestamp_getCounterHz() > 0) {
+        linesAdd(&lines, "# timestamps: %s at %.3f MHz\n",
+                 Timestamp_getSourceName(), Timestamp_getCounterHz() / 1e6);
+    } else {
+        linesAdd(&lines, "# timestamps: %s\n", Timestamp_getSourceName());
+    }
+    for (int e = 0; e < NUM_PERIOD_EVENTS; e++) {
+        Period_statistics_t st;
+        Period_getLastStatistics(e, &st);
+        Period_getHistograms(e, NULL, &sinceStart);
+        linesAdd(&lines, "# %s last interval: %d periods, ms min %.3f p50 %.3f p90 %.3f "
+                 "p99 %.3f p99.9 %.3f max %.3f avg %.3f sd %.3f, %d over deadline, %lld dropped\n",
+                 Period_getEventName(e), st.numSamples, st.minPeriodInMs, st.p50PeriodInMs,
+                 st.p90PeriodInMs, st.p99PeriodInMs, st.p999PeriodInMs, st.maxPeriodInMs,
+                 st.avgPeriodInMs, st.stdDevPeriodInMs, st.numDeadlineMisses, st.numDropped);
+        linesAdd(&lines, "# %s since start: %llu periods, ms p50 %.3f p90 %.3f p99 %.3f "
+                 "p99.9 %.3f max %.3f\n",
+                 Period_getEventName(e), (unsigned long long)sinceStart.total,
+                 Histogram_percentile(&sinceStart, 50) / 1e6,
+                 Histogram_percentile(&sinceStart, 90) / 1e6,
+                 Histogram_percentile(&sinceStart, 99) / 1e6,
+                 Histogram_percentile(&sinceStart, 99.9) / 1e6,
+                 sinceStart.max / 1e6);
+    }
+    linesFlush(&lines);
+}
+
+// On the probes' worker thread: the trace is written.
+static void onTraceWritten(long events, void* arg) {
+    (void)arg;
+    atomic_store(&trace_events, events);
+    uint64_t one = 1;
+    if (write(trace_done_fd, &one, sizeof(one)) < 0) {
+        perror("UDP: trace eventfd");
+    }
+}
+
+// Back on the listener: tell the client who asked for the trace.
+static void replyTraceWritten(void* arg) {
+    (void)arg;
+    uint64_t count;
+    if (read(trace_done_fd, &count, sizeof(count)) < 0) {
+        return;
+    }
+    UDP_request_t req = { .client = &trace_client, .args = "" };
+    long events = atomic_load(&trace_events);
+    if (events < 0) {
+        UDP_replyf(&req, "# trace: could not write %s\n", PROBE_TRACE_PATH);
+    } else {
+        UDP_replyf(&req, "# trace: %ld events, last %.3g s -> %s\n",
+                   events, trace_seconds, PROBE_TRACE_PATH);
+    }
+    flushReplies(udp_sock);
+}
+
+// Dump the probe records of the last seconds to PROBE_TRACE_PATH, to be
+// fetched and opened in Perfetto. The path is fixed: a client never gets
+// to choose where the program writes. The dump takes a while, so it is
+// written on a worker and the reply is sent when it is done.
+static void cmdTrace(const UDP_request_t* pReq) {
+    double seconds = TRACE_DEFAULT_SECONDS;
+    if (pReq->args[0] != '\0'
+        && (sscanf(pReq->args, "%lf", &seconds) != 1 || seconds <= 0 || seconds > TRACE_MAX_SECONDS)) {
+        UDP_replyf(pReq, "Usage: trace [seconds] (up to %d)\n", TRACE_MAX_SECONDS);
+        return;
+    }
+    if (Probe_startChromeTrace(PROBE_TRACE_PATH, seconds, onTraceWritten, NULL) != 0) {
+        UDP_replyf(pReq, "# trace: busy writing another trace, try again\n");
+        return;
+    }
+    // Only this thread reads these, after the worker signals it is done.
+    trace_client = *pReq->client;
+    trace_seconds = seconds;
+}
+
+static void cmdStop(const UDP_request_t* pReq) {
+    UDP_replyf(pReq, "Program terminating.\n");
+    stop_requested = true;
+    request_program_stop();
+    if (EventLoop_isActive()) {
+        EventLoop_stop();
+    }
+}
+
+static void registerBuiltins(void) {
+    UDP_registerCommand("help", cmdHelp, NULL);
+    UDP_registerCommand("?", cmdHelp, NULL);
+    UDP_registerCommand("count", cmdCount,
+        "count -- get the total number of samples taken.");
+    UDP_registerCommand("length", cmdLength,
+        "length -- get the number of samples taken in the previously completed second.");
+    UDP_registerCommand("dips", cmdDips,
+        "dips -- get the number of dips in the previously completed second.");
+    UDP_registerCommand("history", cmdHistory,
+        "history -- get all the samples in the previously completed second.\n"
+        "history v2 [raw|delta] -- same, in binary datagrams (default delta).\n"
+        "history <N> -- the oldest of the last N seconds, headed by its number and start time.\n"
+        "history since <t> -- the second holding CLOCK_MONOTONIC time t (as in the headers).\n"
+        "history from <second> -- resume from the \"# next\" cursor of an earlier reply.\n"
+        "  (one second per reply; these take v2 [raw|delta] too, the reply id then\n"
+        "  being the second's number: resume from the next one)");
+    UDP_registerCommand("plot", cmdPlot,
+        "plot <points> [seconds] [minmax|lttb] [v2] -- the last seconds (default 1),\n"
+        "  downsampled to min/max per bucket (default) or LTTB points, in one datagram.");
+    UDP_registerCommand("subscribe", cmdSubscribe,
+        "subscribe <samples|summary|dips> [ms] -- push a stream every ms (lease 60s);\n"
+        "  the reply gives the cookie to confirm (and renew) with.");
+    UDP_registerCommand("unsubscribe", cmdUnsubscribe,
+        "unsubscribe [stream] -- stop one or all of your streams.");
+    UDP_registerCommand("netstats", cmdNetstats,
+        "netstats -- get packet and syscall batching counters.");
+    UDP_registerCommand("stats", cmdStats,
+        "stats -- get per-command call counts and handling times, and history losses.");
+    UDP_registerCommand("jitter", cmdJitter,
+        "jitter [deadline <event> <ms>] -- get timing percentiles (or set a deadline).");
+    UDP_registerCommand("trace", cmdTrace,
+        "trace [seconds] -- write the last seconds (default 5) of timing probes\n"
+        "  to " PROBE_TRACE_PATH " as Chrome trace JSON (for ui.perfetto.dev).");
+    UDP_registerCommand("stop", cmdStop,
+        "stop -- cause the server program to end.");
+
+    // Replies of several datagrams, or (history) a pass over a second of samples.
+    UDP_setCommandCost("history", 8);
+    UDP_setCommandCost("plot", 8);
+    UDP_setCommandCost("trace", 8);
+    UDP_setCommandCost("help", 2);
+    UDP_setCommandCost("?", 2);
+    UDP_setCommandCost("stats", 2);
+}
+
+// Handle a single command: look up its first word, time the handler.
+static void handleCommand(const char* cmd, const struct sockaddr_in* cli) {
+    size_t nameLen = strcspn(cmd, " ");
+    const char* args = cmd + nameLen;
+    while (*args == ' ') {
+        args++;
+    }
+
+    command_t* pCmd = findCommand(cmd, nameLen);
+    UDP_request_t req = { .client = cli, .args = args };
+    long long start = monotonicNs();
+    if (!admit(cli, pCmd ? pCmd->cost : 1, start)) {
+        return;     // no reply: a flood must not be answered
+    }
+    if (!pCmd) {
+        atomic_fetch_add(&stat_unknown_commands, 1);
+        UDP_replyf(&req, "Unknown command: %.1480s\n", cmd);
+        return;
+    }
+
+    Probe_begin(probeCommand);
+    pCmd->handler(&req);
+    Probe_end(probeCommand);
+    long long ns = monotonicNs() - start;
+
+    atomic_fetch_add_explicit(&pCmd->calls, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&pCmd->totalNs, ns, memory_order_relaxed);
+    if (ns > atomic_load_explicit(&pCmd->maxNs, memory_order_relaxed)) {
+        atomic_store_explicit(&pCmd->maxNs, ns, memory_order_relaxed);
+    }
+    int bucket = 0;
+    for (long long us = ns / 1000; us > 0 && bucket < NUM_LATENCY_BUCKETS - 1; us >>= 1) {
+        bucket++;
+    }
+    pCmd->latency[bucket]++;
+}
+
+static void prepareReceive(void) {
+    for (int i = 0; i < UDP_BATCH; i++) {
+        in_iovs[i].iov_base = in_bufs[i];
+        in_iovs[i].iov_len = BUF_SIZE - 1;
+        memset(&in_msgs[i], 0, sizeof(in_msgs[i]));
+        in_msgs[i].msg_hdr.msg_name = &in_addrs[i];
+        in_msgs[i].msg_hdr.msg_namelen = sizeof(in_addrs[i]);
+        in_msgs[i].msg_hdr.msg_iov = &in_iovs[i];
+        in_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+}
 
-            // Remove trailing newline/carriage return
-            buf[strcspn(buf, "\r\n")] = '\0';
+// Take one batch of queued datagrams (without waiting) and answer them.
+static void serviceSocket(void* arg) {
+    (void)arg;
 
-            // Use last command if user pressed enter
-            char* cmd_to_process = (strlen(buf) == 0) ? last_command : buf;
-            strncpy(last_command, cmd_to_process, sizeof(last_command) - 1);
-            last_command[sizeof(last_command) - 1] = '\0';
+    prepareReceive();
+    int n = recvmmsg(udp_sock, in_msgs, batch_size, MSG_DONTWAIT, NULL);
+    if (n <= 0) {
+        return;
+    }
+    atomic_fetch_add(&stat_recv_calls, 1);
+    atomic_fetch_add(&stat_packets_in, n);
+    if (n > atomic_load(&stat_max_recv_batch)) {
+        atomic_store(&stat_max_recv_batch, n);
+    }
 
-            handleCommand(cmd_to_process, &cli, udp_sock);
+    long long now = monotonicNs();
+    for (int i = 0; i < n; i++) {
+        if (!sourceHasTokens(&in_addrs[i], now)) {
+            atomic_fetch_add(&stat_shed_source, 1);
+            continue;
+        }
+
+        char* buf = in_bufs[i];
+        buf[in_msgs[i].msg_len] = '\0';
+
+        // Remove trailing newline/carriage return
+        buf[strcspn(buf, "\r\n")] = '\0';
+
+        // Use this client's last command if the user pressed enter
+        session_t* pSession = getSession(&in_addrs[i]);
+        char* cmd_to_process = (strlen(buf) == 0) ? pSession->last_command : buf;
+        if (cmd_to_process != pSession->last_command) {
+            size_t len = strlen(cmd_to_process);
+            if (len >= sizeof(pSession->last_command)) {
+                len = 0;    // too long to be a command: nothing to repeat
+            }
+            memcpy(pSession->last_command, cmd_to_process, len);
+            pSession->last_command[len] = '\0';
+        }
+
+        handleCommand(cmd_to_process, &in_addrs[i]);
+    }
+
+    flushReplies(udp_sock);
+}
+
+void* udpFunc(void* arg) {
+    (void)arg;
+    pthread_setname_np(pthread_self(), "as2-udp");
+    struct pollfd fds[3] = {
+        { .fd = udp_sock, .events = POLLIN },
+        { .fd = wake_fd, .events = POLLIN },
+        { .fd = trace_done_fd, .events = POLLIN },
+    };
+
+    while (!stop_requested) {
+        if (poll(fds, 3, -1) <= 0) {
+            continue;
+        }
+        if (fds[1].revents) {
+            break;
+        }
+        if (fds[0].revents) {
+            serviceSocket(NULL);
+        }
+        if (fds[2].revents) {
+            replyTraceWritten(NULL);
         }
     }
 
     return NULL;
 }
 
+void UDP_setBatchSize(int batch) {
+    if (batch < 1) batch = 1;
+    if (batch > UDP_BATCH) batch = UDP_BATCH;
+    batch_size = batch;
+}
+
+void UDP_setRateLimiting(bool enabled) {
+    rate_limiting = enabled;
+}
+
 void UDP_init(void) {
     udp_sock = socket(AF_INET, SOCK_DGRAM, 0);
     if (udp_sock < 0) {
@@ -102,12 +1103,47 @@ void UDP_init(void) {
         exit(1);
     }
 
+    if (!builtins_registered) {
+        builtins_registered = true;
+        registerBuiltins();
+    }
+    probeCommand = Probe_register("udp_command");
+
+    trace_done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (trace_done_fd < 0) {
+        perror("UDP_init: eventfd");
+        exit(1);
+    }
+
     stop_requested = false;
-    pthread_create(&udp_thread, NULL, udpFunc, NULL);
+    own_thread = !EventLoop_isActive();
+    if (own_thread) {
+        wake_fd = eventfd(0, EFD_CLOEXEC);
+        pthread_create(&udp_thread, NULL, udpFunc, NULL);
+    } else if (EventLoop_addFd(udp_sock, serviceSocket, NULL) < 0
+               || EventLoop_addFd(trace_done_fd, replyTraceWritten, NULL) < 0) {
+        exit(1);
+    }
+    Subscriptions_init(udp_sock);
 }
 
 void UDP_cleanup(void) {
+    Probe_waitChromeTrace();    // its callback writes trace_done_fd
+    Subscriptions_cleanup();
     stop_requested = true;
-    pthread_join(udp_thread, NULL);
+    if (own_thread) {
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0) {
+            perror("UDP_cleanup: eventfd");
+        }
+        pthread_join(udp_thread, NULL);
+        close(wake_fd);
+        wake_fd = -1;
+    } else {
+        EventLoop_removeFd(udp_sock);
+        EventLoop_removeFd(trace_done_fd);
+    }
+    close(trace_done_fd);
+    trace_done_fd = -1;
     close(udp_sock);
 }
@@ -0,0 +1,45 @@
+// The synthetic ADC dips at the rate it is configured with, fractional
+// rates included: hz=2.5 for just under 2 s is 5 dips (a phase that
+// restarted every second would give 6, cutting one short at 1 s).
+#include "hal/adc_hal.h"
+#include "check.h"
+#include <stdbool.h>
+#include <time.h>
+
+#define RUN_SECONDS 1.95
+#define DIP_HZ 2.5
+
+static double secondsSince(const struct timespec *pStart)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - pStart->tv_sec) + (now.tv_nsec - pStart->tv_nsec) * 1e-9;
+}
+
+int main(void)
+{
+    struct timespec start;
+    struct timespec pause = { 0, 1000000 };
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CHECK(ADC_setBackend("synth:hz=2.5,duty=40,noise=0,dc=1.5,depth=0.5") == 0);
+    ADC_init();
+
+    // Count the samples that fall below half the dip as dip starts.
+    double threshold = 1.25 / ADC_VREF_VOLTS * ADC_MAX_CODE;
+    int dips = 0;
+    bool low = false;
+    while (secondsSince(&start) < RUN_SECONDS) {
+        bool nowLow = ADC_readRaw(0) < threshold;
+        if (nowLow && !low) {
+            dips++;
+        }
+        low = nowLow;
+        nanosleep(&pause, NULL);
+    }
+    ADC_cleanup();
+
+    int expected = (int)(RUN_SECONDS * DIP_HZ);
+    CHECKF(dips >= expected && dips <= expected + 1, "%d dips in %.2f s at %.1f Hz",
+           dips, RUN_SECONDS, DIP_HZ);
+    return CHECK_RESULT();
+}
@@ -0,0 +1,141 @@
+// Capture files (hal/capture.h), written and read back:
+//  - enough samples that the mapped file has to grow (mremap) at least
+//    once, ending in a partly filled block;
+//  - the header, every code and every block's timestamp match what was
+//    written, and Capture_read() reports each chunk's first sample time
+//    from its block's timestamp;
+//  - a file cut off partway through a block reads as the complete
+//    blocks before it; a file that isn't a capture doesn't open.
+#include "hal/capture.h"
+#include "check.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SAMPLE_RATE_HZ 1000
+#define GROW_BYTES (4 * 1024 * 1024)    // as in capture.c
+#define BLOCK_BYTES (sizeof(Capture_blockHeader_t) + CAPTURE_BLOCK_SAMPLES * sizeof(uint16_t))
+#define NUM_BLOCKS ((int)(GROW_BYTES / BLOCK_BYTES) + 10)
+#define NUM_SAMPLES ((long)(NUM_BLOCKS - 1) * CAPTURE_BLOCK_SAMPLES + 300)
+#define READ_CHUNK 1000                 // not a divisor of the block size
+#define CUT_BLOCKS 3
+
+static char path[] = "/tmp/capture_XXXXXX";
+static uint64_t blockTimes[NUM_BLOCKS];
+static uint16_t readBack[READ_CHUNK];
+
+static uint16_t codeAt(long i) { return (uint16_t)((i * 7 + i / 5000) & 0xFFF); }
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Walk the file by hand, as the layout in capture.h describes it.
+static void checkLayout(uint64_t before, uint64_t after)
+{
+    FILE *pFile = fopen(path, "rb");
+    Capture_header_t header;
+    CHECK(pFile && fread(&header, sizeof(header), 1, pFile) == 1);
+    CHECK(strcmp(header.magic, CAPTURE_MAGIC) == 0 && header.version == CAPTURE_VERSION);
+    CHECK(header.sampleRateHz == SAMPLE_RATE_HZ && header.blockSamples == CAPTURE_BLOCK_SAMPLES);
+    CHECK(header.startTimeNs >= before && header.startTimeNs <= after);
+
+    static uint16_t codes[CAPTURE_BLOCK_SAMPLES];
+    long sample = 0;
+    for (int b = 0; b < NUM_BLOCKS; b++) {
+        Capture_blockHeader_t block;
+        CHECK(fread(&block, sizeof(block), 1, pFile) == 1);
+        uint32_t expected = (b < NUM_BLOCKS - 1) ? CAPTURE_BLOCK_SAMPLES : NUM_SAMPLES % CAPTURE_BLOCK_SAMPLES;
+        CHECKF(block.count == expected, "block %d holds %u", b, block.count);
+        CHECK(block.timestampNs >= (b ? blockTimes[b - 1] : header.startTimeNs) && block.timestampNs <= after);
+        blockTimes[b] = block.timestampNs;
+        CHECK(fread(codes, sizeof(uint16_t), block.count, pFile) == block.count);
+        for (uint32_t i = 0; i < block.count; i++, sample++) {
+            if (codes[i] != codeAt(sample)) {
+                CHECKF(false, "sample %ld is %u", sample, codes[i]);
+                break;
+            }
+        }
+    }
+    CHECK(sample == NUM_SAMPLES && fgetc(pFile) == EOF);   // trimmed to the last sample
+    fclose(pFile);
+}
+
+// Read through Capture_read() in odd-sized chunks; returns the samples read.
+static long readAll(void)
+{
+    Capture_reader_t *pReader = Capture_openReader(path);
+    CHECK(pReader != NULL);
+    if (!pReader) {
+        return 0;
+    }
+    CHECK(Capture_getHeader(pReader)->sampleRateHz == SAMPLE_RATE_HZ);
+    const uint64_t periodNs = 1000000000ULL / SAMPLE_RATE_HZ;
+    long sample = 0;
+    bool codesOk = true, timesOk = true;
+    uint64_t timeNs;
+    int n;
+    while ((n = Capture_read(pReader, readBack, READ_CHUNK, &timeNs)) > 0) {
+        long block = sample / CAPTURE_BLOCK_SAMPLES;
+        timesOk &= (timeNs == blockTimes[block] + (sample % CAPTURE_BLOCK_SAMPLES) * periodNs);
+        for (int i = 0; i < n; i++) {
+            codesOk &= (readBack[i] == codeAt(sample + i));
+        }
+        sample += n;
+    }
+    CHECK(codesOk && timesOk);
+
+    // Rewound, it starts over.
+    Capture_rewind(pReader);
+    CHECK(Capture_read(pReader, readBack, 1, &timeNs) == 1 && readBack[0] == codeAt(0));
+    CHECK(timeNs == blockTimes[0]);
+    Capture_closeReader(pReader);
+    return sample;
+}
+
+int main(void)
+{
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+
+    uint64_t before = nowNs();
+    Capture_writer_t *pWriter = Capture_openWriter(path, SAMPLE_RATE_HZ);
+    CHECK(pWriter != NULL);
+    if (!pWriter) {
+        return CHECK_RESULT();
+    }
+    for (long i = 0; i < NUM_SAMPLES; i++) {
+        Capture_writeSample(pWriter, codeAt(i));
+    }
+    Capture_closeWriter(pWriter);
+    uint64_t after = nowNs();
+
+    checkLayout(before, after);
+    long samples = readAll();
+    CHECKF(samples == NUM_SAMPLES, "read %ld of %ld samples", samples, (long)NUM_SAMPLES);
+
+    // Cut off halfway through a full block: only the blocks before it.
+    CHECK(truncate(path, sizeof(Capture_header_t) + CUT_BLOCKS * BLOCK_BYTES + BLOCK_BYTES / 2) == 0);
+    samples = readAll();
+    CHECKF(samples == CUT_BLOCKS * CAPTURE_BLOCK_SAMPLES, "read %ld samples of a cut file", samples);
+
+    // Not a capture: too short, or the wrong magic.
+    CHECK(truncate(path, sizeof(Capture_header_t) - 1) == 0);
+    CHECK(Capture_openReader(path) == NULL);
+    FILE *pFile = fopen(path, "wb");
+    fputs("not a capture file, but long enough to hold a header", pFile);
+    fclose(pFile);
+    CHECK(Capture_openReader(path) == NULL);
+
+    unlink(path);
+    return CHECK_RESULT();
+}
@@ -0,0 +1,28 @@
+// check.h
+// Minimal assertions for the tests. A failed CHECK prints where and what
+// failed and the test carries on, so one run shows every failure; main()
+// returns CHECK_RESULT() for ctest.
+
+#ifndef _CHECK_H_
+#define _CHECK_H_
+
+#include <stdio.h>
+
+static int check_failures = 0;
+
+#define CHECK(cond) CHECKF(cond, "%s", #cond)
+
+#define CHECKF(cond, ...) do {                                      \
+        if (!(cond)) {                                              \
+            fprintf(stderr, "%s:%d: check failed: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__);                           \
+            fprintf(stderr, "\n");                                  \
+            check_failures++;                                       \
+        }                                                           \
+    } while (0)
+
+#define CHECK_RESULT() \
+    (check_failures == 0 ? (printf("OK\n"), 0) \
+                         : (fprintf(stderr, "%d check(s) failed\n", check_failures), 1))
+
+#endif
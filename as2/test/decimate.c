@@ -0,0 +1,117 @@
+// Plot decimation (hal/decimate.h) over a series split into uneven
+// segments, one of them empty:
+//  - min/max matches a plain scan of each bucket, bucket boundaries
+//    falling mid-segment included, and stops at one bucket per sample;
+//  - LTTB keeps the first and last samples and a lone spike, picks one
+//    increasing index per bucket, gives the same picks however the
+//    series is split, returns every sample when asked for as many, and
+//    treats fewer than 3 points as 3.
+#include "hal/decimate.h"
+#include "check.h"
+#include <stdbool.h>
+#include <string.h>
+
+#define NUM_SAMPLES 1000
+#define SPIKE_AT 617
+
+static uint16_t samples[NUM_SAMPLES];
+static uint32_t rngState = 0x85EBCA6B;
+
+static uint32_t nextRandom(void)
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+// Split `samples` as 1, 0, 333, 200, then the rest.
+static int makeSegments(Decimate_segment_t *segs, int n)
+{
+    static const int sizes[] = { 1, 0, 333, 200 };
+    int numSegs = 0, used = 0;
+    for (int i = 0; i < 4 && used + sizes[i] <= n; i++) {
+        segs[numSegs++] = (Decimate_segment_t){ samples + used, sizes[i] };
+        used += sizes[i];
+    }
+    segs[numSegs++] = (Decimate_segment_t){ samples + used, n - used };
+    return numSegs;
+}
+
+static void checkMinMax(int n, int buckets)
+{
+    Decimate_segment_t segs[5];
+    int numSegs = makeSegments(segs, n);
+    uint16_t mins[NUM_SAMPLES], maxs[NUM_SAMPLES];
+    int got = Decimate_minMax(segs, numSegs, buckets, mins, maxs);
+    int expected = buckets < n ? buckets : n;
+    CHECKF(got == expected, "%d samples in %d buckets: %d", n, buckets, got);
+
+    for (int b = 0; b < got; b++) {
+        uint16_t lo = UINT16_MAX, hi = 0;
+        for (long long i = (long long)b * n / got; i < (long long)(b + 1) * n / got; i++) {
+            if (samples[i] < lo) lo = samples[i];
+            if (samples[i] > hi) hi = samples[i];
+        }
+        CHECKF(mins[b] == lo && maxs[b] == hi, "%d buckets, bucket %d: %u..%u, not %u..%u",
+               buckets, b, mins[b], maxs[b], lo, hi);
+    }
+}
+
+static void checkLttb(int points)
+{
+    Decimate_segment_t segs[5];
+    int numSegs = makeSegments(segs, NUM_SAMPLES);
+    uint32_t indices[NUM_SAMPLES], wholeIndices[NUM_SAMPLES];
+    uint16_t values[NUM_SAMPLES], wholeValues[NUM_SAMPLES];
+    int got = Decimate_lttb(segs, numSegs, points, indices, values);
+    CHECKF(got == points, "%d points: %d", points, got);
+    CHECK(indices[0] == 0 && indices[got - 1] == NUM_SAMPLES - 1);
+
+    bool spike = false;
+    for (int i = 0; i < got; i++) {
+        CHECK(i == 0 || indices[i] > indices[i - 1]);
+        CHECK(values[i] == samples[indices[i]]);
+        spike |= (indices[i] == SPIKE_AT);
+    }
+    CHECKF(spike, "%d points lost the spike", points);
+
+    // Split or whole, the same picks.
+    Decimate_segment_t whole = { samples, NUM_SAMPLES };
+    CHECK(Decimate_lttb(&whole, 1, points, wholeIndices, wholeValues) == got);
+    CHECK(memcmp(indices, wholeIndices, got * sizeof(indices[0])) == 0);
+}
+
+int main(void)
+{
+    // Noise around mid-scale, with one spike that any plot must show.
+    for (int i = 0; i < NUM_SAMPLES; i++) {
+        samples[i] = 2048 + nextRandom() % 100;
+    }
+    samples[SPIKE_AT] = 4000;
+
+    checkMinMax(NUM_SAMPLES, 1);
+    checkMinMax(NUM_SAMPLES, 7);        // boundaries inside segments
+    checkMinMax(NUM_SAMPLES, 300);
+    checkMinMax(NUM_SAMPLES, NUM_SAMPLES);
+    checkMinMax(10, 50);                // fewer samples than buckets
+    checkMinMax(0, 5);
+
+    checkLttb(3);
+    checkLttb(50);
+    checkLttb(NUM_SAMPLES - 1);
+
+    // Asked for as many points as there are samples (or more): all of them.
+    Decimate_segment_t segs[5];
+    int numSegs = makeSegments(segs, NUM_SAMPLES);
+    uint32_t indices[NUM_SAMPLES];
+    uint16_t values[NUM_SAMPLES];
+    CHECK(Decimate_lttb(segs, numSegs, NUM_SAMPLES, indices, values) == NUM_SAMPLES);
+    CHECK(indices[SPIKE_AT] == SPIKE_AT && memcmp(values, samples, sizeof(samples)) == 0);
+
+    // Fewer than 3 points is 3: the ends and the spike.
+    CHECK(Decimate_lttb(segs, numSegs, 1, indices, values) == 3);
+    CHECK(indices[0] == 0 && indices[1] == SPIKE_AT && indices[2] == NUM_SAMPLES - 1);
+
+    return CHECK_RESULT();
+}
@@ -0,0 +1,134 @@
+// Throughput of the dip counters over a long synthetic capture (the
+// sampler's own 1 kHz light level: noise and a 25 Hz flicker):
+//   dips_bench [seconds]       default 3600 (one hour at 1 kHz)
+// Prints ns per sample and the speedup over the double-precision
+// Dips_count(), and fails if any variant counts differently.
+//
+// A native build has AddressSanitizer on (see the top-level
+// CMakeLists.txt), which slows every variant: for real figures, build
+// for the target or without the sanitizer.
+#include "hal/dips.h"
+#include "hal/adc_hal.h"
+#include "check.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#define RATE_HZ 1000
+#define DEFAULT_SECONDS 3600
+#define FLICKER_HZ 25
+#define REPEATS 5               // best of
+
+static uint32_t rngState = 0x9E3779B9;
+
+static uint32_t nextRandom(void)
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+static long long nowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+typedef struct {
+    const char *name;
+    int dips;
+    double nsPerSample;
+} result_t;
+
+static const uint16_t *g_samples, *g_avgs;
+static const double *g_samplesV, *g_avgsV;
+static int g_n;
+static DipConfig g_cfg;
+static DipConfigRaw g_cfgRaw;
+
+static int runDouble(void) { return Dips_count(g_samplesV, g_avgsV, g_n, g_cfg); }
+static int runScalar(void) { return Dips_countRawScalar(g_samples, g_avgs, g_n, g_cfgRaw); }
+static int runRaw(void)    { return Dips_countRaw(g_samples, g_avgs, g_n, g_cfgRaw); }
+
+static result_t measure(const char *name, int (*run)(void))
+{
+    result_t r = { name, 0, 0 };
+    long long best = -1;
+    for (int i = 0; i < REPEATS; i++) {
+        long long start = nowNs();
+        r.dips = run();
+        long long ns = nowNs() - start;
+        if (best < 0 || ns < best) best = ns;
+    }
+    r.nsPerSample = (double)best / g_n;
+    return r;
+}
+
+int main(int argc, char **argv)
+{
+    long long seconds = (argc > 1) ? atoll(argv[1]) : DEFAULT_SECONDS;
+    if (seconds <= 0) {
+        fprintf(stderr, "Usage: %s [seconds]\n", argv[0]);
+        return 1;
+    }
+    g_n = (int)(seconds * RATE_HZ);
+
+    uint16_t *samples = malloc(g_n * sizeof(uint16_t));
+    uint16_t *avgs = malloc(g_n * sizeof(uint16_t));
+    double *samplesV = malloc(g_n * sizeof(double));
+    double *avgsV = malloc(g_n * sizeof(double));
+    if (!samples || !avgs || !samplesV || !avgsV) {
+        perror("dips_bench");
+        return 1;
+    }
+
+    // 1.5 V with 10 mV of noise, dipping 0.3 V for half of each flicker
+    // period; the average is the sampler's EMA (0.999 per sample).
+    const double codesPerVolt = ADC_MAX_CODE / ADC_VREF_VOLTS;
+    double avg = 1.5 * codesPerVolt;
+    for (int i = 0; i < g_n; i++) {
+        double volts = 1.5 + ((nextRandom() % 2001) / 1000.0 - 1.0) * 0.01;
+        if ((i * FLICKER_HZ / (RATE_HZ / 2)) % 2) {
+            volts -= 0.3;
+        }
+        int code = (int)(volts * codesPerVolt + 0.5);
+        samples[i] = (uint16_t)code;
+        avg = 0.999 * avg + 0.001 * code;
+        avgs[i] = (uint16_t)(avg * (1 << DIPS_Q4_SHIFT) + 0.5);
+        samplesV[i] = ADC_rawToVolts(samples[i]);
+        avgsV[i] = ADC_rawToVolts(avgs[i] / (double)(1 << DIPS_Q4_SHIFT));
+    }
+    g_samples = samples;
+    g_avgs = avgs;
+    g_samplesV = samplesV;
+    g_avgsV = avgsV;
+    g_cfg = DipConfig_make(0.1, 0.07);
+    g_cfgRaw = DipConfig_toRaw(g_cfg);
+
+    result_t results[] = {
+        measure("Dips_count (double)", runDouble),
+        measure("Dips_countRawScalar", runScalar),
+        measure("Dips_countRaw", runRaw),
+    };
+    int numResults = sizeof(results) / sizeof(results[0]);
+
+    printf("%d samples (%lld s at %d Hz), best of %d:\n", g_n, seconds, RATE_HZ, REPEATS);
+    for (int i = 0; i < numResults; i++) {
+        printf("  %-22s %8d dips  %7.3f ns/sample  %6.1f Msamples/s  x%.1f\n",
+               results[i].name, results[i].dips, results[i].nsPerSample,
+               1e3 / results[i].nsPerSample, results[0].nsPerSample / results[i].nsPerSample);
+    }
+    // The raw variants must agree exactly; the double one may differ only
+    // where volts round differently from Q4 codes at a threshold.
+    CHECK(results[2].dips == results[1].dips);
+    CHECKF(abs(results[0].dips - results[1].dips) <= g_n / 10000,
+           "double %d vs raw %d dips", results[0].dips, results[1].dips);
+
+    free(samples);
+    free(avgs);
+    free(samplesV);
+    free(avgsV);
+    return CHECK_RESULT();
+}
@@ -0,0 +1,168 @@
+// Randomized equivalence of the dip counters. Every variant must agree
+// with the scalar reference, Dips_countRawScalar(), on every input:
+//  - Dips_countRaw() (NEON, AVX2 or SSE2 masks and the ctz scan);
+//  - DipDetector_pushBlock() fed in random block sizes, and
+//    DipDetector_push() one sample at a time (state across calls);
+//  - Dips_count() on the same data as doubles. Its values are in units
+//    of codes, so every threshold is exact and no rounding can differ.
+// Inputs mix uniform noise with samples placed exactly on, and one Q4
+// step either side of, both thresholds, and with averages near the top
+// of the range where the kernels' saturating adds kick in. Lengths and
+// starting offsets vary so partial blocks and unaligned loads are hit.
+#include "hal/dips.h"
+#include "hal/adc_hal.h"
+#include "check.h"
+#include <stdlib.h>
+#include <stdint.h>
+
+#define NUM_CASES 20000
+#define MAX_LEN 700             // several 64-sample blocks and a partial one
+#define MAX_OFFSET 15
+#define MAX_AVG_Q4 (ADC_MAX_CODE << DIPS_Q4_SHIFT)
+
+// Exit code ctest reads as "skipped" (see SKIP_RETURN_CODE).
+#define SKIPPED 77
+
+static uint32_t rngState = 0x2545F491;
+
+// xorshift32: reproducible from the seed above.
+static uint32_t nextRandom(void)
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+static int randomBelow(int limit)
+{
+    return (int)(nextRandom() % (uint32_t)limit);
+}
+
+static uint16_t clampCode(int code)
+{
+    return (uint16_t)(code < 0 ? 0 : (code > ADC_MAX_CODE ? ADC_MAX_CODE : code));
+}
+
+static DipConfigRaw randomConfig(void)
+{
+    DipConfigRaw cfg;
+    switch (randomBelow(4)) {
+    case 0:     // what the sampler uses
+        cfg = DipConfig_toRaw(DipConfig_make(0.1, 0.07));
+        break;
+    case 1:     // no hysteresis
+        cfg.trigger_q4 = (uint16_t)randomBelow(4096);
+        cfg.reset_q4 = cfg.trigger_q4;
+        break;
+    case 2:     // zero thresholds: every sample on the average matters
+        cfg.trigger_q4 = 0;
+        cfg.reset_q4 = 0;
+        break;
+    default:    // anything, even reset above trigger
+        cfg.trigger_q4 = (uint16_t)randomBelow(MAX_AVG_Q4 + 1);
+        cfg.reset_q4 = (uint16_t)randomBelow(MAX_AVG_Q4 + 1);
+        break;
+    }
+    return cfg;
+}
+
+// Averages wander slowly; samples are noise around them, or sit exactly
+// on (or one step either side of) a threshold.
+static void fillCase(uint16_t *samples, uint16_t *avgs, int n, DipConfigRaw cfg)
+{
+    bool nearTop = randomBelow(4) == 0;
+    int avg = nearTop ? MAX_AVG_Q4 - randomBelow(64) : randomBelow(MAX_AVG_Q4 + 1);
+    for (int i = 0; i < n; i++) {
+        avg += randomBelow(33) - 16;
+        if (avg < 0) avg = 0;
+        if (avg > MAX_AVG_Q4) avg = MAX_AVG_Q4;
+        avgs[i] = (uint16_t)avg;
+
+        int code;
+        int kind = randomBelow(8);
+        if (kind < 3) {
+            int threshold = avg - ((kind == 0) ? cfg.trigger_q4 : cfg.reset_q4);
+            code = (threshold >> DIPS_Q4_SHIFT) + randomBelow(3) - 1;
+        } else if (kind < 6) {
+            code = (avg >> DIPS_Q4_SHIFT) + randomBelow(41) - 20;
+        } else {
+            code = randomBelow(ADC_MAX_CODE + 1);
+        }
+        samples[i] = clampCode(code);
+    }
+}
+
+static int countDoubles(const uint16_t *samples, const uint16_t *avgs, int n, DipConfigRaw cfg)
+{
+    static double samplesD[MAX_LEN], avgsD[MAX_LEN];
+    const double q4 = 1 << DIPS_Q4_SHIFT;
+    for (int i = 0; i < n; i++) {
+        samplesD[i] = samples[i];
+        avgsD[i] = avgs[i] / q4;
+    }
+    return Dips_count(samplesD, avgsD, n, DipConfig_make(cfg.trigger_q4 / q4, cfg.reset_q4 / q4));
+}
+
+static int countBlocks(const uint16_t *samples, const uint16_t *avgs, int n, DipConfigRaw cfg)
+{
+    DipDetector det;
+    DipDetector_init(&det, cfg);
+    int dips = 0;
+    for (int i = 0; i < n; ) {
+        int len = 1 + randomBelow(2 * 64 + 8);
+        if (len > n - i) len = n - i;
+        dips += DipDetector_pushBlock(&det, samples + i, avgs + i, len);
+        i += len;
+    }
+    CHECK(det.totalDips == dips && DipDetector_takeWindow(&det) == dips);
+    return dips;
+}
+
+static int countSingles(const uint16_t *samples, const uint16_t *avgs, int n, DipConfigRaw cfg)
+{
+    DipDetector det;
+    DipDetector_init(&det, cfg);
+    int dips = 0;
+    for (int i = 0; i < n; i++) {
+        dips += DipDetector_push(&det, samples[i], avgs[i]);
+    }
+    return dips;
+}
+
+int main(void)
+{
+#ifdef DIPS_TEST_NEEDS_AVX2
+    if (!__builtin_cpu_supports("avx2")) {
+        printf("no AVX2 on this CPU: skipped\n");
+        return SKIPPED;
+    }
+#endif
+    static uint16_t samples[MAX_OFFSET + MAX_LEN], avgs[MAX_OFFSET + MAX_LEN];
+    long long totalDips = 0;
+
+    for (int c = 0; c < NUM_CASES && check_failures < 10; c++) {
+        int offset = randomBelow(MAX_OFFSET + 1);
+        int n = randomBelow(MAX_LEN + 1);
+        DipConfigRaw cfg = randomConfig();
+        uint16_t *pSamples = samples + offset;
+        uint16_t *pAvgs = avgs + offset;
+        fillCase(pSamples, pAvgs, n, cfg);
+
+        int expected = Dips_countRawScalar(pSamples, pAvgs, n, cfg);
+        int simd = Dips_countRaw(pSamples, pAvgs, n, cfg);
+        int blocks = countBlocks(pSamples, pAvgs, n, cfg);
+        int singles = countSingles(pSamples, pAvgs, n, cfg);
+        int doubles = countDoubles(pSamples, pAvgs, n, cfg);
+        CHECKF(simd == expected && blocks == expected && singles == expected && doubles == expected,
+               "case %d (n %d, offset %d, trigger %u, reset %u): scalar %d, countRaw %d, "
+               "blocks %d, push %d, doubles %d", c, n, offset, cfg.trigger_q4, cfg.reset_q4,
+               expected, simd, blocks, singles, doubles);
+        totalDips += expected;
+    }
+    CHECK(totalDips > NUM_CASES);   // the inputs really do dip
+    CHECK(Dips_countRaw(NULL, avgs, 10, DipConfig_toRaw(DipConfig_make(0.1, 0.07))) == 0);
+    CHECK(Dips_countRaw(samples, avgs, 0, DipConfig_toRaw(DipConfig_make(0.1, 0.07))) == 0);
+    printf("%d cases, %lld dips\n", NUM_CASES, totalDips);
+    return CHECK_RESULT();
+}
@@ -0,0 +1,120 @@
+// Log-linear histogram (hal/histogram.h):
+//  - values below HISTOGRAM_SUB_BUCKETS are exact; above, a value's
+//    bucket tops out less than 1/HISTOGRAM_SUB_BUCKETS above it, and the
+//    next value up starts a new bucket (checked across powers of two);
+//  - percentiles pick the right rank and stay within [min, max];
+//  - negative and oversized values are clamped, empty gives 0;
+//  - merging is the same as recording everything in one.
+#include "hal/histogram.h"
+#include "check.h"
+#include <string.h>
+
+#define MAX_VALUE ((1LL << HISTOGRAM_MAX_BITS) - 1)
+
+static Histogram_t hist, other, all;
+static uint32_t rngState = 0xC2B2AE35;
+
+static uint32_t nextRandom(void)
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+// The top of `value`'s bucket, seen through the public interface: with
+// MAX_VALUE also recorded, the 50th percentile is that bucket's top.
+static long long bucketTop(long long value)
+{
+    static Histogram_t pair;
+    Histogram_clear(&pair);
+    Histogram_record(&pair, value);
+    Histogram_record(&pair, MAX_VALUE);
+    return Histogram_percentile(&pair, 50);
+}
+
+static void checkBucket(long long value)
+{
+    long long top = bucketTop(value);
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        CHECKF(top == value, "%lld reported as %lld", value, top);
+        return;
+    }
+    CHECKF(top >= value && top - value <= value / HISTOGRAM_SUB_BUCKETS,
+           "%lld reported as %lld", value, top);
+    CHECKF(bucketTop(top) == top, "%lld: bucket top %lld is in another bucket", value, top);
+    if (top < MAX_VALUE) {
+        CHECKF(bucketTop(top + 1) > top, "%lld: %lld shares its bucket", value, top + 1);
+    }
+}
+
+int main(void)
+{
+    // Every value up to a few powers of two past the exact range, the
+    // edges of every power of two, and random values of every size.
+    for (long long v = 0; v < 16 * HISTOGRAM_SUB_BUCKETS; v++) {
+        checkBucket(v);
+    }
+    for (int bit = HISTOGRAM_SUB_BITS; bit <= HISTOGRAM_MAX_BITS; bit++) {
+        checkBucket((1LL << bit) - 1);
+        if (bit < HISTOGRAM_MAX_BITS) {
+            checkBucket(1LL << bit);
+            checkBucket((1LL << bit) + 1);
+        }
+    }
+    for (int i = 0; i < 10000; i++) {
+        long long v = ((long long)nextRandom() << 32 | nextRandom()) & MAX_VALUE;
+        checkBucket(v >> (nextRandom() % HISTOGRAM_MAX_BITS));
+    }
+
+    // 1..20 are exact, so the percentiles are the ranks themselves.
+    Histogram_clear(&hist);
+    CHECK(Histogram_percentile(&hist, 50) == 0);
+    for (int v = 20; v >= 1; v--) {
+        Histogram_record(&hist, v);
+    }
+    CHECK(hist.total == 20 && hist.min == 1 && hist.max == 20);
+    CHECK(Histogram_percentile(&hist, 0) == 1);
+    CHECK(Histogram_percentile(&hist, 5) == 1);
+    CHECK(Histogram_percentile(&hist, 6) == 2);
+    CHECK(Histogram_percentile(&hist, 50) == 10);
+    CHECK(Histogram_percentile(&hist, 90) == 18);
+    CHECK(Histogram_percentile(&hist, 99.9) == 20);
+    CHECK(Histogram_percentile(&hist, 100) == 20);
+
+    // A bucket's top is never reported above the largest value.
+    CHECK(bucketTop(1000) > 1001);
+    Histogram_clear(&hist);
+    Histogram_record(&hist, 1000);
+    Histogram_record(&hist, 1001);
+    CHECK(Histogram_percentile(&hist, 50) == 1001 && Histogram_percentile(&hist, 100) == 1001);
+
+    // Out of range.
+    Histogram_clear(&hist);
+    Histogram_record(&hist, -5);
+    Histogram_record(&hist, 1LL << 50);
+    CHECK(hist.min == 0 && hist.max == MAX_VALUE);
+    CHECK(Histogram_percentile(&hist, 50) == 0 && Histogram_percentile(&hist, 100) == MAX_VALUE);
+
+    // Merged, or all recorded in one: the same. Merging nothing changes
+    // nothing, and merging into an empty histogram copies.
+    Histogram_clear(&hist);
+    Histogram_clear(&other);
+    Histogram_clear(&all);
+    for (int i = 0; i < 1000; i++) {
+        long long v = nextRandom() % 1000000;
+        Histogram_record((i % 3) ? &hist : &other, v);
+        Histogram_record(&all, v);
+    }
+    Histogram_record(&other, 7);
+    Histogram_record(&all, 7);
+    Histogram_merge(&hist, &other);
+    CHECK(memcmp(&hist, &all, sizeof(all)) == 0);
+    Histogram_clear(&other);
+    Histogram_merge(&hist, &other);
+    CHECK(memcmp(&hist, &all, sizeof(all)) == 0);
+    Histogram_merge(&other, &all);
+    CHECK(memcmp(&other, &all, sizeof(all)) == 0);
+
+    return CHECK_RESULT();
+}
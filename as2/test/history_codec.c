@@ -0,0 +1,173 @@
+// Wire formats of hal/history_codec.h, checked field by field against
+// the layouts documented there, with the sample payloads decoded again.
+#include "hal/history_codec.h"
+#include "hal/decimate.h"
+#include "hal/adc_hal.h"
+#include "check.h"
+#include <string.h>
+
+#define NUM_SAMPLES 1000
+
+static uint16_t samples[NUM_SAMPLES];
+static uint32_t rngState = 0x1B873593;
+
+static uint32_t nextRandom(void)
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+static uint32_t get16(const uint8_t *p) { return p[0] | p[1] << 8; }
+static uint32_t get32(const uint8_t *p) { return get16(p) | get16(p + 2) << 16; }
+static uint64_t get64(const uint8_t *p) { return get32(p) | (uint64_t)get32(p + 4) << 32; }
+
+// Decode `count` zigzag delta varints; returns the bytes read, or -1 if
+// they run past `len`.
+static int decodeDelta(const uint8_t *p, int len, int count, uint16_t *out)
+{
+    int used = 0;
+    int32_t prev = 0;
+    for (int i = 0; i < count; i++) {
+        uint32_t v = 0;
+        for (int shift = 0; ; shift += 7) {
+            if (used >= len) return -1;
+            uint8_t b = p[used++];
+            v |= (uint32_t)(b & 0x7F) << shift;
+            if (!(b & 0x80)) break;
+        }
+        prev += (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+        out[i] = (uint16_t)prev;
+    }
+    return used;
+}
+
+// Noise, big jumps (full-scale deltas need the longest varints) and flat runs.
+static void fillSamples(void)
+{
+    for (int i = 0; i < NUM_SAMPLES; i++) {
+        switch (i / 100 % 3) {
+        case 0:  samples[i] = 2048 + nextRandom() % 64 - 32; break;
+        case 1:  samples[i] = (i % 2) ? ADC_MAX_CODE : 0; break;
+        default: samples[i] = 1234; break;
+        }
+    }
+}
+
+static void checkStream(void)
+{
+    uint8_t buf[HISTORY_MAX_DATAGRAM];
+    uint16_t decoded[NUM_SAMPLES];
+    History_stream_t header = {
+        .seq = 7, .dropped = 3, .firstSample = 0x123456789AULL, .sampleRateHz = 1000,
+    };
+
+    // Split over as many datagrams as it takes, each decoding on its own.
+    int first = 0;
+    while (first < NUM_SAMPLES) {
+        int consumed = 0;
+        int len = History_encodeStreamDatagram(&header, samples + first, NUM_SAMPLES - first,
+                                               buf, sizeof(buf), &consumed);
+        CHECK(len <= (int)sizeof(buf) && consumed > 0);
+        CHECK(memcmp(buf, HISTORY_STREAM_MAGIC, 4) == 0);
+        CHECK(buf[4] == HISTORY_STREAM_VERSION && buf[5] == HISTORY_ENC_DELTA && get16(buf + 6) == 0);
+        CHECK(get32(buf + 8) == header.seq && get32(buf + 12) == header.dropped);
+        CHECK(get64(buf + 16) == header.firstSample);
+        CHECK((int)get32(buf + 24) == consumed && get32(buf + 28) == header.sampleRateHz);
+        int used = decodeDelta(buf + HISTORY_STREAM_HEADER_SIZE, len - HISTORY_STREAM_HEADER_SIZE,
+                               consumed, decoded + first);
+        CHECKF(used == len - HISTORY_STREAM_HEADER_SIZE, "payload %d of %d bytes", used,
+               len - HISTORY_STREAM_HEADER_SIZE);
+        first += consumed;
+        header.seq++;
+        header.firstSample += consumed;
+    }
+    CHECK(first == NUM_SAMPLES && memcmp(decoded, samples, sizeof(samples)) == 0);
+
+    // A small buffer still takes what fits, and nothing at all is no samples.
+    int consumed = -1;
+    int len = History_encodeStreamDatagram(&header, samples, NUM_SAMPLES, buf,
+                                           HISTORY_STREAM_HEADER_SIZE + 7, &consumed);
+    CHECK(consumed >= 2 && len <= HISTORY_STREAM_HEADER_SIZE + 7);
+    len = History_encodeStreamDatagram(&header, samples, 0, buf, sizeof(buf), &consumed);
+    CHECK(consumed == 0 && len == HISTORY_STREAM_HEADER_SIZE && get32(buf + 24) == 0);
+}
+
+// Both plot methods, with more points asked for than fit: the payload
+// stops at the method's maximum and the header says so.
+static void checkPlot(void)
+{
+    uint8_t buf[HISTORY_MAX_DATAGRAM];
+    uint16_t mins[NUM_SAMPLES], maxs[NUM_SAMPLES], values[NUM_SAMPLES];
+    uint32_t indices[NUM_SAMPLES];
+    Decimate_segment_t seg = { samples, NUM_SAMPLES };
+    History_plot_t plot = {
+        .method = HISTORY_PLOT_MINMAX, .mins = mins, .maxs = maxs,
+        .firstSecond = 41, .seconds = 1, .totalSamples = NUM_SAMPLES,
+        .sampleRateHz = 1000, .startTimeNs = 0x0102030405060708ULL,
+    };
+
+    plot.points = Decimate_minMax(&seg, 1, NUM_SAMPLES, mins, maxs);
+    int len = History_encodePlot(&plot, buf);
+    CHECK(len == HISTORY_PLOT_HEADER_SIZE + 4 * HISTORY_PLOT_MAX_MINMAX);
+    CHECK(memcmp(buf, HISTORY_PLOT_MAGIC, 4) == 0);
+    CHECK(buf[4] == HISTORY_PLOT_VERSION && buf[5] == HISTORY_PLOT_MINMAX);
+    CHECK(get16(buf + 6) == HISTORY_PLOT_MAX_MINMAX);
+    CHECK(get32(buf + 8) == 41 && get32(buf + 12) == 1 && get32(buf + 16) == NUM_SAMPLES);
+    CHECK(get32(buf + 20) == 1000 && get64(buf + 24) == plot.startTimeNs);
+    for (int i = 0; i < HISTORY_PLOT_MAX_MINMAX; i++) {
+        const uint8_t *p = buf + HISTORY_PLOT_HEADER_SIZE + 4 * i;
+        CHECKF(get16(p) == mins[i] && get16(p + 2) == maxs[i], "min/max bucket %d", i);
+    }
+
+    plot.method = HISTORY_PLOT_LTTB;
+    plot.indices = indices;
+    plot.values = values;
+    plot.points = Decimate_lttb(&seg, 1, NUM_SAMPLES - 1, indices, values);
+    len = History_encodePlot(&plot, buf);
+    CHECK(len == HISTORY_PLOT_HEADER_SIZE + 6 * HISTORY_PLOT_MAX_LTTB);
+    CHECK(buf[5] == HISTORY_PLOT_LTTB && get16(buf + 6) == HISTORY_PLOT_MAX_LTTB);
+    for (int i = 0; i < HISTORY_PLOT_MAX_LTTB; i++) {
+        const uint8_t *p = buf + HISTORY_PLOT_HEADER_SIZE + 6 * i;
+        CHECKF(get32(p) == indices[i] && get16(p + 4) == samples[indices[i]], "LTTB point %d", i);
+    }
+
+    plot.points = 0;
+    CHECK(History_encodePlot(&plot, buf) == HISTORY_PLOT_HEADER_SIZE && get16(buf + 6) == 0);
+}
+
+// Every field distinct, so one written to the wrong offset shows; and
+// nothing written past the end.
+static void checkSummary(void)
+{
+    uint8_t buf[HISTORY_SUMMARY_SIZE + 8];
+    memset(buf, 0xAA, sizeof(buf));
+    History_summary_t summary = {
+        .seq = 0x01010101, .second = 0x02020202, .startTimeNs = 0x0303030304040404ULL,
+        .samples = 0x05050505, .pwmFrequencyHz = 0x06060606, .averageMicrovolts = 0x07070707,
+        .dips = 0x08080808, .minPeriodUs = 0x09090909, .maxPeriodUs = 0x0A0A0A0A,
+        .avgPeriodUs = 0x0B0B0B0B, .overruns = 0x0C0C0C0C,
+    };
+    CHECK(History_encodeSummary(&summary, buf) == HISTORY_SUMMARY_SIZE);
+    CHECK(memcmp(buf, HISTORY_SUMMARY_MAGIC, 4) == 0);
+    CHECK(buf[4] == HISTORY_SUMMARY_VERSION && buf[5] == 0 && get16(buf + 6) == HISTORY_SUMMARY_SIZE);
+    CHECK(get32(buf + 8) == summary.seq && get32(buf + 12) == summary.second);
+    CHECK(get64(buf + 16) == summary.startTimeNs && get32(buf + 24) == summary.samples);
+    CHECK(get32(buf + 28) == summary.pwmFrequencyHz && get32(buf + 32) == summary.averageMicrovolts);
+    CHECK(get32(buf + 36) == summary.dips && get32(buf + 40) == summary.minPeriodUs);
+    CHECK(get32(buf + 44) == summary.maxPeriodUs && get32(buf + 48) == summary.avgPeriodUs);
+    CHECK(get32(buf + 52) == summary.overruns);
+    for (size_t i = HISTORY_SUMMARY_SIZE; i < sizeof(buf); i++) {
+        CHECK(buf[i] == 0xAA);
+    }
+}
+
+int main(void)
+{
+    fillSamples();
+    checkStream();
+    checkPlot();
+    checkSummary();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,163 @@
+// Period statistics (hal/periodTimer.h) from marks on several threads:
+//  - PERIOD_RECORD_LOCKFREE: every mark is one period, merged across the
+//    threads' rings in time order (so no period is negative and they add
+//    up to no more than the time the marks took), a later interval
+//    carries on from the last mark, and marks that find their ring full,
+//    or no ring left for their thread, are counted as dropped;
+//  - PERIOD_RECORD_STREAMING: periods are between one thread's own marks,
+//    and known sleeps between marks come back as the count, min, max,
+//    average and deadline misses, with the histograms agreeing.
+#include "hal/periodTimer.h"
+#include "hal/timestamp.h"
+#include "check.h"
+#include <pthread.h>
+#include <time.h>
+
+#define EVENT PERIOD_EVENT_SAMPLE_LIGHT
+#define NS_PER_MS 1000000.0
+#define MAX_THREADS (PERIOD_MAX_THREADS + 1)
+
+typedef struct {
+    int marks;
+    int pauseEvery;         // sleep briefly after this many marks (0: never)
+} markJob_t;
+
+static pthread_barrier_t start, done;
+
+static void *markThread(void *arg)
+{
+    const markJob_t *pJob = arg;
+    struct timespec pause = { 0, 20000 };
+    pthread_barrier_wait(&start);
+    for (int i = 1; i <= pJob->marks; i++) {
+        Period_markEvent(EVENT);
+        if (pJob->pauseEvery && i % pJob->pauseEvery == 0) {
+            nanosleep(&pause, NULL);
+        }
+    }
+    // Nobody exits (and gives back its rings) until everyone has marked.
+    pthread_barrier_wait(&done);
+    return NULL;
+}
+
+// Run `numThreads` threads marking at once; returns how long they took (ns).
+static long long runThreads(int numThreads, int marks, int pauseEvery)
+{
+    pthread_t threads[MAX_THREADS];
+    markJob_t job = { marks, pauseEvery };
+    pthread_barrier_init(&start, NULL, numThreads + 1);
+    pthread_barrier_init(&done, NULL, numThreads);
+    for (int t = 0; t < numThreads; t++) {
+        pthread_create(&threads[t], NULL, markThread, &job);
+    }
+    long long begin = Timestamp_nowNs();
+    pthread_barrier_wait(&start);
+    for (int t = 0; t < numThreads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    long long took = Timestamp_nowNs() - begin;
+    pthread_barrier_destroy(&start);
+    pthread_barrier_destroy(&done);
+    return took;
+}
+
+static void checkLockFree(void)
+{
+    Period_statistics_t stats;
+    Period_setRecordingMode(PERIOD_RECORD_LOCKFREE);
+    Period_init();
+
+    // Interleaved marks from four threads.
+    long long took = runThreads(4, 1000, 10);
+    Period_getStatisticsAndClear(EVENT, &stats);
+    CHECKF(stats.numSamples == 4000 && stats.numDropped == 0, "%d periods, %lld dropped",
+           stats.numSamples, stats.numDropped);
+    CHECKF(stats.minPeriodInMs >= 0, "min period %f ms", stats.minPeriodInMs);
+    CHECKF(stats.maxPeriodInMs <= took / NS_PER_MS, "max period %f ms", stats.maxPeriodInMs);
+    CHECKF(stats.avgPeriodInMs * stats.numSamples <= took / NS_PER_MS,
+           "periods add up to %f ms of %f", stats.avgPeriodInMs * stats.numSamples, took / NS_PER_MS);
+
+    // Nothing new; then one more thread carries on from the last mark.
+    Period_getStatisticsAndClear(EVENT, &stats);
+    CHECK(stats.numSamples == 0);
+    runThreads(1, 100, 0);
+    Period_getStatisticsAndClear(EVENT, &stats);
+    CHECK(stats.numSamples == 100 && stats.minPeriodInMs >= 0);
+
+    // One thread too many: its marks are dropped.
+    runThreads(PERIOD_MAX_THREADS + 1, 100, 0);
+    Period_getStatisticsAndClear(EVENT, &stats);
+    CHECKF(stats.numSamples == PERIOD_MAX_THREADS * 100 && stats.numDropped == 100,
+           "%d periods, %lld dropped", stats.numSamples, stats.numDropped);
+
+    // More marks than a ring holds between reads.
+    runThreads(1, MAX_EVENT_TIMESTAMPS + 10, 0);
+    Period_getStatisticsAndClear(EVENT, &stats);
+    CHECKF(stats.numSamples == MAX_EVENT_TIMESTAMPS && stats.numDropped == 10,
+           "%d periods, %lld dropped", stats.numSamples, stats.numDropped);
+
+    Period_cleanup();
+}
+
+static void sleepMs(long ms)
+{
+    struct timespec ts = { 0, ms * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+static void checkStreaming(void)
+{
+    Period_statistics_t stats;
+    Period_setRecordingMode(PERIOD_RECORD_STREAMING);
+    Period_init();
+
+    // Each thread's first mark starts its own periods.
+    runThreads(4, 100, 10);
+    Period_getStatisticsAndClear(EVENT, &stats);
+    CHECKF(stats.numSamples == 4 * 99 && stats.numDropped == 0, "%d periods, %lld dropped",
+           stats.numSamples, stats.numDropped);
+    CHECK(stats.minPeriodInMs >= 0 && stats.numDeadlineMisses == 0);
+
+    // Ten periods of at least 2 ms, then two of at least 30 ms. Sleeps
+    // only ever run long, so the bounds are one-sided (with a little
+    // slack for the counter's calibration against the clock).
+    Period_setDeadline(EVENT, 20);
+    long long begin = Timestamp_nowNs();
+    Period_markEvent(EVENT);
+    for (int i = 0; i < 12; i++) {
+        sleepMs(i < 10 ? 2 : 30);
+        Period_markEvent(EVENT);
+    }
+    double tookMs = (Timestamp_nowNs() - begin) / NS_PER_MS;
+    Period_getStatisticsAndClear(EVENT, &stats);
+    CHECKF(stats.numSamples == 12, "%d periods", stats.numSamples);
+    CHECKF(stats.minPeriodInMs >= 1.99 && stats.maxPeriodInMs >= 29.9, "periods %f..%f ms",
+           stats.minPeriodInMs, stats.maxPeriodInMs);
+    CHECKF(stats.avgPeriodInMs * 12 >= 79.9 && stats.avgPeriodInMs * 12 <= tookMs,
+           "periods add up to %f ms of %f", stats.avgPeriodInMs * 12, tookMs);
+    CHECKF(stats.numDeadlineMisses >= 2, "%d deadline misses", stats.numDeadlineMisses);
+    CHECK(stats.p50PeriodInMs >= stats.minPeriodInMs && stats.p999PeriodInMs <= stats.maxPeriodInMs);
+
+    Histogram_t last, total;
+    Period_getHistograms(EVENT, &last, &total);
+    CHECK(last.total == 12 && total.total == 4 * 99 + 12);
+    CHECK(last.min == (long long)(stats.minPeriodInMs * NS_PER_MS + 0.5));
+    CHECK(last.max == (long long)(stats.maxPeriodInMs * NS_PER_MS + 0.5));
+
+    // The next interval carries on from this thread's last mark; with
+    // the deadline off, nothing is a miss.
+    Period_setDeadline(EVENT, 0);
+    sleepMs(30);
+    Period_markEvent(EVENT);
+    Period_getStatisticsAndClear(EVENT, &stats);
+    CHECK(stats.numSamples == 1 && stats.minPeriodInMs >= 29.9 && stats.numDeadlineMisses == 0);
+
+    Period_cleanup();
+}
+
+int main(void)
+{
+    checkLockFree();
+    checkStreaming();
+    return CHECK_RESULT();
+}
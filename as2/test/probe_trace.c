@@ -0,0 +1,133 @@
+// Trace export of the timing probes, into a private temporary directory:
+//  - the trace is valid-looking JSON with the recorded events, mode 0600;
+//  - a symlink at the trace's path is replaced, not written through;
+//  - a directory that others can write to is refused, and a missing one
+//    is created private;
+//  - Probe_startChromeTrace() writes on a worker and reports when done;
+//  - a thread that reuses an exited thread's slot starts with an empty
+//    ring, so the old records aren't exported under the new tid.
+#include "hal/probe.h"
+#include "check.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define NUM_MARKS 100
+#define THREAD_MARKS 10
+
+static char dir[] = "/tmp/probe_trace_XXXXXX";
+static char tracePath[64], victimPath[64], subDir[64], subTracePath[96];
+
+static atomic_long doneEvents = -2;
+
+static void onDone(long events, void *arg)
+{
+    (void)arg;
+    atomic_store(&doneEvents, events);
+}
+
+static void *markThread(void *arg)
+{
+    int marks = *(int *)arg;
+    int id = Probe_register("test_thread");
+    for (int i = 0; i < marks; i++) {
+        Probe_mark(id);
+    }
+    return NULL;
+}
+
+static void runMarkThread(int marks)
+{
+    pthread_t thread;
+    pthread_create(&thread, NULL, markThread, &marks);
+    pthread_join(thread, NULL);
+}
+
+static bool fileStartsWith(const char *path, const char *prefix)
+{
+    char buf[64] = "";
+    FILE *pFile = fopen(path, "r");
+    if (!pFile) {
+        return false;
+    }
+    size_t n = fread(buf, 1, sizeof(buf) - 1, pFile);
+    buf[n] = '\0';
+    fclose(pFile);
+    return strncmp(buf, prefix, strlen(prefix)) == 0;
+}
+
+int main(void)
+{
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    snprintf(tracePath, sizeof(tracePath), "%s/trace.json", dir);
+    snprintf(victimPath, sizeof(victimPath), "%s/victim", dir);
+    snprintf(subDir, sizeof(subDir), "%s/sub", dir);
+    snprintf(subTracePath, sizeof(subTracePath), "%s/trace.json", subDir);
+
+    int span = Probe_register("test_span");
+    int mark = Probe_register("test_mark");
+    CHECK(span >= 0 && mark >= 0 && Probe_register("test_span") == span);
+    for (int i = 0; i < NUM_MARKS; i++) {
+        Probe_begin(span);
+        Probe_mark(mark);
+        Probe_end(span);
+    }
+
+    // Written in full, readable by the owner only.
+    long events = Probe_writeChromeTrace(tracePath, 10);
+    CHECKF(events == 3 * NUM_MARKS, "%ld events", events);
+    struct stat st;
+    CHECK(lstat(tracePath, &st) == 0 && S_ISREG(st.st_mode) && (st.st_mode & 0777) == 0600);
+    CHECK(fileStartsWith(tracePath, "{\"displayTimeUnit\""));
+
+    // A symlink planted at the path is replaced; its target is untouched.
+    FILE *pVictim = fopen(victimPath, "w");
+    fputs("keep", pVictim);
+    fclose(pVictim);
+    unlink(tracePath);
+    CHECK(symlink(victimPath, tracePath) == 0);
+    CHECK(Probe_writeChromeTrace(tracePath, 10) == events);
+    CHECK(lstat(tracePath, &st) == 0 && S_ISREG(st.st_mode));
+    CHECK(fileStartsWith(victimPath, "keep"));
+
+    // Someone else could write to the directory: refused.
+    chmod(dir, 0777);
+    CHECK(Probe_writeChromeTrace(tracePath, 10) == -1);
+    chmod(dir, 0700);
+
+    // A missing directory is created, for the owner only.
+    CHECK(Probe_writeChromeTrace(subTracePath, 10) == events);
+    CHECK(stat(subDir, &st) == 0 && S_ISDIR(st.st_mode) && (st.st_mode & 0777) == 0700);
+
+    // On the worker, reporting back through the callback.
+    CHECK(Probe_startChromeTrace(tracePath, 10, onDone, NULL) == 0);
+    Probe_waitChromeTrace();
+    CHECKF(atomic_load(&doneEvents) == events, "worker wrote %ld events", atomic_load(&doneEvents));
+    CHECK(Probe_startChromeTrace(tracePath, 10, NULL, NULL) == 0);
+    Probe_waitChromeTrace();
+
+    // Fill every other slot with a thread that has exited; one more
+    // thread then takes over one of those slots.
+    for (int t = 1; t < PROBE_MAX_THREADS; t++) {
+        runMarkThread(THREAD_MARKS);
+    }
+    CHECK(Probe_writeChromeTrace(tracePath, 10) == events + (PROBE_MAX_THREADS - 1) * THREAD_MARKS);
+    runMarkThread(1);
+    long reused = Probe_writeChromeTrace(tracePath, 10);
+    CHECKF(reused == events + (PROBE_MAX_THREADS - 2) * THREAD_MARKS + 1,
+           "%ld events after reusing a slot", reused);
+
+    unlink(subTracePath);
+    rmdir(subDir);
+    unlink(tracePath);
+    unlink(victimPath);
+    rmdir(dir);
+    return CHECK_RESULT();
+}
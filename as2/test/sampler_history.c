@@ -0,0 +1,132 @@
+// Rollover bookkeeping, driven by hand (short "seconds") while the
+// sampler runs on the synthetic ADC:
+//  - retained seconds are numbered in order and age out after
+//    historySeconds;
+//  - a time maps to the retained second holding it (the oldest if it is
+//    older still, newest + 1 if it is newer, -1 with nothing retained);
+//  - when readers hold every spare buffer, the second is dropped and
+//    counted, with its dips;
+//  - every dip the sampler detected is in exactly one retained second or
+//    in the dropped count.
+#include "hal/sampler.h"
+#include "hal/adc_hal.h"
+#include "hal/periodTimer.h"
+#include "check.h"
+#include <time.h>
+
+#define HISTORY_SECONDS 3
+#define SPARE_BUFFERS 3         // matches the sampler's spare slots
+#define SECOND_MS 200           // a "second", shortened for the test
+
+static void sleepMs(long ms)
+{
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+static long long dipsSeen = 0;
+
+// Roll over and add up the dips of the second it publishes (if any).
+static void rollover(void)
+{
+    sleepMs(SECOND_MS);
+    long long newestBefore, newestAfter, oldest;
+    Sampler_getRetainedSeconds(&oldest, &newestBefore);
+    Sampler_moveCurrentDataToHistory();
+    Sampler_getRetainedSeconds(&oldest, &newestAfter);
+    if (newestAfter != newestBefore) {
+        CHECK(newestAfter == newestBefore + 1);
+        Sampler_historyView_t view;
+        CHECK(Sampler_acquireSecond(newestAfter, &view));
+        CHECK(view.second == newestAfter && view.size > 0);
+        dipsSeen += view.dips;
+        Sampler_releaseHistory(&view);
+    }
+}
+
+// A retained second covers its first sample's time to that plus its
+// samples at the nominal rate (the sampler can run late, so that may
+// overlap the next one, which then starts where this one ends). Each is
+// found from either end; times outside the range clamp to its ends.
+static void checkFindSecond(long long oldest, long long newest)
+{
+    Sampler_historyView_t view;
+    long long end = 0;
+    for (long long k = oldest; k <= newest; k++) {
+        CHECK(Sampler_acquireSecond(k, &view));
+        long long from = (k > oldest && end > view.startTimeNs) ? end : view.startTimeNs;
+        end = view.startTimeNs +
+              (long long)view.size * 1000000000LL / Sampler_defaultConfig().sampleRateHz;
+        Sampler_releaseHistory(&view);
+        CHECKF(from < end, "second %lld is empty", k);
+        CHECKF(Sampler_findSecond(from) == k, "second %lld from its start", k);
+        CHECKF(Sampler_findSecond(end - 1) == k, "second %lld from its end", k);
+    }
+    CHECK(Sampler_findSecond(0) == oldest);
+    CHECK(Sampler_findSecond(end) == newest + 1);
+    CHECK(Sampler_findSecond(end + 1000000000LL) == newest + 1);
+
+    // Aged out, or not there yet: an empty view, still released.
+    CHECK(!Sampler_acquireSecond(oldest - 1, &view) && view.size == 0);
+    Sampler_releaseHistory(&view);
+    CHECK(!Sampler_acquireSecond(newest + 1, &view) && view.size == 0);
+    Sampler_releaseHistory(&view);
+}
+
+int main(void)
+{
+    ADC_setBackend("synth:hz=25");
+    Period_init();
+    Sampler_config_t config = Sampler_defaultConfig();
+    config.historySeconds = HISTORY_SECONDS;
+    Sampler_init(&config);
+
+    // Nothing retained yet.
+    Sampler_historyView_t view;
+    CHECK(Sampler_findSecond(0) == -1);
+    CHECK(!Sampler_acquireSecond(0, &view) && view.size == 0);
+    Sampler_releaseHistory(&view);
+
+    // Fill the history, and one more so the first second ages out.
+    for (int i = 0; i <= HISTORY_SECONDS; i++) {
+        rollover();
+    }
+    long long oldest, newest;
+    Sampler_getRetainedSeconds(&oldest, &newest);
+    CHECKF(oldest == 1 && newest == HISTORY_SECONDS, "retained %lld..%lld", oldest, newest);
+    CHECK(Sampler_getNumSecondsDropped() == 0);
+    checkFindSecond(oldest, newest);
+
+    // Hold the retained seconds: as they age out, their buffers can't be
+    // reused, and once the spares are gone a completed second is dropped.
+    Sampler_historyView_t held[HISTORY_SECONDS];
+    for (int i = 0; i < HISTORY_SECONDS; i++) {
+        CHECK(Sampler_acquireSecond(oldest + i, &held[i]));
+    }
+    for (int i = 0; i < SPARE_BUFFERS - 1; i++) {
+        rollover();
+    }
+    CHECK(Sampler_getNumSecondsDropped() == 0);
+    long long dipsBefore = Sampler_getDipEventHead();
+    rollover();
+    long long dipsAfter = Sampler_getDipEventHead();
+    CHECKF(Sampler_getNumSecondsDropped() == 1, "%lld seconds dropped", Sampler_getNumSecondsDropped());
+
+    // Every dip up to the last rollover is in a second or dropped.
+    long long accounted = dipsSeen + Sampler_getNumDipsDropped();
+    CHECKF(accounted >= dipsBefore && accounted <= dipsAfter,
+           "%lld dips in seconds + %lld dropped, %lld..%lld detected",
+           dipsSeen, Sampler_getNumDipsDropped(), dipsBefore, dipsAfter);
+    CHECK(Sampler_getNumDipsDropped() > 0);
+
+    // Released, the buffers come back and seconds are kept again.
+    for (int i = 0; i < HISTORY_SECONDS; i++) {
+        Sampler_releaseHistory(&held[i]);
+    }
+    rollover();
+    CHECK(Sampler_getNumSecondsDropped() == 1);
+
+    Sampler_cleanup();
+    Period_cleanup();
+    return CHECK_RESULT();
+}
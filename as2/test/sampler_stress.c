@@ -0,0 +1,228 @@
+// Hammer the sampler's getters from several threads while it samples
+// (synthetic ADC) and rolls over every ROLLOVER_MS:
+//  - no reader ever sees a torn or moving value: live snapshots stay in
+//    range and counters never go backwards, borrowed history views don't
+//    change while held (even across rollovers), and ring cursors account
+//    for every sample as either copied or dropped;
+//  - the sampling period doesn't get worse under that load than it was
+//    without it (Period_statistics_t p99 period: the max is a single
+//    period, which the host's scheduler alone can stretch). Only checked
+//    with a core to spare for each reader: otherwise the readers simply
+//    take the sampler's CPU time;
+//  - samples that miss the history because a rollover was late are
+//    counted.
+#include "hal/sampler.h"
+#include "hal/adc_hal.h"
+#include "hal/periodTimer.h"
+#include "check.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NUM_READERS 4
+#define PHASE_MS 2000
+#define ROLLOVER_MS 50
+#define HOLD_EVERY 64           // every so many loops, hold a view across rollovers
+#define LIVE_BATCH 256
+#define DIP_BATCH 16
+
+// The loaded p99 period may exceed the quiet one by this much (scheduler
+// noise on a shared build machine), but not by more.
+#define P99_PERIOD_SLACK_MS 2.0
+#define P99_PERIOD_RATIO 2.0
+
+// Long enough without a rollover to fill a second's buffer (rate + 25%).
+#define LATE_ROLLOVER_MS 1600
+
+static atomic_bool stopReaders = false;
+static atomic_bool stopRollover = false;
+static atomic_int readerFailures = 0;
+static atomic_llong readerLoops = 0;
+
+static void sleepMs(long ms)
+{
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+static void *rolloverFunc(void *arg)
+{
+    (void)arg;
+    while (!atomic_load(&stopRollover)) {
+        sleepMs(ROLLOVER_MS);
+        Sampler_moveCurrentDataToHistory();
+    }
+    return NULL;
+}
+
+// Readers run without CHECK (it isn't thread-safe): they count failures.
+static void fail(const char *what)
+{
+    fprintf(stderr, "reader: %s\n", what);
+    atomic_fetch_add(&readerFailures, 1);
+}
+
+static void checkView(const Sampler_historyView_t *pView, bool hold)
+{
+    if (pView->size < 0 || (pView->size > 0 && (!pView->samples || !pView->avgs))) {
+        fail("bad history view");
+        return;
+    }
+    if (pView->size == 0) {
+        return;
+    }
+    uint16_t *copy = malloc(pView->size * sizeof(uint16_t));
+    memcpy(copy, pView->samples, pView->size * sizeof(uint16_t));
+    for (int i = 0; i < pView->size; i++) {
+        if (copy[i] > ADC_MAX_CODE) {
+            fail("sample out of range");
+            break;
+        }
+    }
+    if (hold) {
+        sleepMs(2 * ROLLOVER_MS);   // a rollover or two must not touch it
+    }
+    if (memcmp(copy, pView->samples, pView->size * sizeof(uint16_t)) != 0) {
+        fail("borrowed history changed while held");
+    }
+    free(copy);
+}
+
+static void *readerFunc(void *arg)
+{
+    (void)arg;
+    uint16_t live[LIVE_BATCH];
+    Sampler_dipEvent_t dips[DIP_BATCH];
+    long long liveNext = Sampler_getLiveHead();
+    long long dipNext = Sampler_getDipEventHead();
+    long long lastCount = 0;
+    long long lastDipSample = -1;
+
+    for (long long loop = 0; !atomic_load(&stopReaders); loop++) {
+        double avg = Sampler_getAverageReading();
+        if (!(avg >= 0 && avg <= ADC_VREF_VOLTS)) {
+            fail("average out of range");
+        }
+        long long count = Sampler_getNumSamplesTaken();
+        if (count < lastCount) {
+            fail("sample count went backwards");
+        }
+        lastCount = count;
+
+        Sampler_historyView_t view;
+        Sampler_acquireHistory(&view);
+        checkView(&view, loop % HOLD_EVERY == 0);
+        Sampler_releaseHistory(&view);
+
+        long long oldest, newest;
+        Sampler_getRetainedSeconds(&oldest, &newest);
+        if (newest >= 0) {
+            Sampler_acquireSecond(oldest, &view);   // may have aged out meanwhile
+            checkView(&view, false);
+            Sampler_releaseHistory(&view);
+        }
+
+        int size;
+        double *history = Sampler_getHistory(&size);
+        for (int i = 0; i < size; i++) {
+            if (!(history[i] >= 0 && history[i] <= ADC_VREF_VOLTS)) {
+                fail("history copy out of range");
+                break;
+            }
+        }
+        free(history);
+        (void)Sampler_countDips();
+        (void)Sampler_getHistorySize();
+
+        // Every sample between two reads is either copied or dropped.
+        long long before = liveNext;
+        long long dropped = 0;
+        int copied = Sampler_readLiveSamples(&liveNext, live, LIVE_BATCH, &dropped);
+        if (copied < 0 || copied + dropped != liveNext - before) {
+            fail("live samples not accounted for");
+        }
+        for (int i = 0; i < copied; i++) {
+            if (live[i] > ADC_MAX_CODE) {
+                fail("live sample out of range");
+                break;
+            }
+        }
+
+        dropped = 0;
+        int numDips = Sampler_readDipEvents(&dipNext, dips, DIP_BATCH, &dropped);
+        for (int i = 0; i < numDips; i++) {
+            if (dips[i].sampleNumber <= lastDipSample) {
+                fail("dip events out of order");
+            }
+            lastDipSample = dips[i].sampleNumber;
+        }
+        atomic_fetch_add(&readerLoops, 1);
+    }
+    return NULL;
+}
+
+int main(void)
+{
+    ADC_setBackend("synth:hz=25");
+    Period_init();
+    Sampler_init(NULL);
+
+    pthread_t rolloverThread;
+    pthread_create(&rolloverThread, NULL, rolloverFunc, NULL);
+
+    // Quiet: only the rollover runs.
+    Period_statistics_t quiet, loaded;
+    sleepMs(PHASE_MS / 4);
+    Period_getStatisticsAndClear(PERIOD_EVENT_SAMPLE_LIGHT, &quiet);
+    sleepMs(PHASE_MS);
+    Period_getStatisticsAndClear(PERIOD_EVENT_SAMPLE_LIGHT, &quiet);
+
+    pthread_t readers[NUM_READERS];
+    for (int i = 0; i < NUM_READERS; i++) {
+        pthread_create(&readers[i], NULL, readerFunc, NULL);
+    }
+    sleepMs(PHASE_MS);
+    Period_getStatisticsAndClear(PERIOD_EVENT_SAMPLE_LIGHT, &loaded);
+
+    atomic_store(&stopReaders, true);
+    for (int i = 0; i < NUM_READERS; i++) {
+        pthread_join(readers[i], NULL);
+    }
+    atomic_store(&stopRollover, true);
+    pthread_join(rolloverThread, NULL);
+
+    // Rolled over in time so far; then a late rollover discards samples
+    // from the history, and counts them.
+    CHECK(Sampler_getNumSamplesDiscarded() == 0);
+    sleepMs(LATE_ROLLOVER_MS);
+    long long discarded = Sampler_getNumSamplesDiscarded();
+    Sampler_moveCurrentDataToHistory();
+    CHECKF(discarded > 0, "%lld samples discarded", discarded);
+    Sampler_cleanup();
+    Period_cleanup();
+
+    printf("quiet:  %d periods, max %.3f ms, p99 %.3f ms\n",
+           quiet.numSamples, quiet.maxPeriodInMs, quiet.p99PeriodInMs);
+    printf("loaded: %d periods, max %.3f ms, p99 %.3f ms (%lld reader loops)\n",
+           loaded.numSamples, loaded.maxPeriodInMs, loaded.p99PeriodInMs,
+           atomic_load(&readerLoops));
+
+    CHECKF(atomic_load(&readerFailures) == 0, "%d reader failures", atomic_load(&readerFailures));
+    CHECK(atomic_load(&readerLoops) > 0);
+    CHECK(quiet.numSamples > 0 && loaded.numSamples > 0);
+    if (sysconf(_SC_NPROCESSORS_ONLN) <= NUM_READERS) {
+        printf("too few cores for %d readers: period not checked\n", NUM_READERS);
+        return CHECK_RESULT();
+    }
+    double allowedMs = quiet.p99PeriodInMs * P99_PERIOD_RATIO;
+    if (allowedMs < quiet.p99PeriodInMs + P99_PERIOD_SLACK_MS) {
+        allowedMs = quiet.p99PeriodInMs + P99_PERIOD_SLACK_MS;
+    }
+    CHECKF(loaded.p99PeriodInMs <= allowedMs, "p99 period %.3f ms under load, %.3f ms quiet",
+           loaded.p99PeriodInMs, quiet.p99PeriodInMs);
+    return CHECK_RESULT();
+}
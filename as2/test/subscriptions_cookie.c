@@ -0,0 +1,100 @@
+// The subscribe cookie round trip: no stream starts (or renews) until
+// the client echoes the cookie sent to its address, and a cookie only
+// works for the address and stream it was issued for.
+#include "hal/subscriptions.h"
+#include "hal/sampler.h"
+#include "hal/adc_hal.h"
+#include "hal/periodTimer.h"
+#include "check.h"
+#include <string.h>
+#include <arpa/inet.h>
+
+#define REPLY_SIZE 256
+
+static char reply[REPLY_SIZE];
+
+static struct sockaddr_in makeAddr(const char *ip, int port)
+{
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+    inet_pton(AF_INET, ip, &addr.sin_addr);
+    return addr;
+}
+
+static const char *subscribe(const struct sockaddr_in *pAddr, const char *args)
+{
+    Subscriptions_subscribe(pAddr, args, reply, sizeof(reply));
+    return reply;
+}
+
+// The cookie in the last reply (0 if none).
+static unsigned long long replyCookie(void)
+{
+    unsigned long long cookie = 0;
+    const char *p = strstr(reply, "cookie ");
+    if (p) {
+        sscanf(p, "cookie %llx", &cookie);
+    }
+    return cookie;
+}
+
+static bool startsWith(const char *s, const char *prefix)
+{
+    return strncmp(s, prefix, strlen(prefix)) == 0;
+}
+
+static int numActive(void)
+{
+    Subscriptions_stats_t st;
+    Subscriptions_getStats(&st);
+    return st.active;
+}
+
+int main(void)
+{
+    ADC_setBackend("synth");
+    Period_init();
+    Sampler_init(NULL);
+
+    struct sockaddr_in client = makeAddr("192.0.2.1", 5000);
+    struct sockaddr_in otherPort = makeAddr("192.0.2.1", 5001);
+    struct sockaddr_in otherHost = makeAddr("192.0.2.2", 5000);
+    char args[96];
+
+    // The first subscribe only gets a cookie back.
+    CHECKF(startsWith(subscribe(&client, "samples 100"), "# confirm with: subscribe samples 100 cookie "),
+           "%s", reply);
+    unsigned long long cookie = replyCookie();
+    CHECK(cookie != 0 && numActive() == 0);
+
+    // Wrong cookie, or the right one from elsewhere or for another stream.
+    CHECK(startsWith(subscribe(&client, "samples 100 cookie 1234"), "# confirm with:"));
+    snprintf(args, sizeof(args), "samples 100 cookie %llx", cookie);
+    CHECK(startsWith(subscribe(&otherPort, args), "# confirm with:"));
+    CHECK(startsWith(subscribe(&otherHost, args), "# confirm with:"));
+    snprintf(args, sizeof(args), "dips 100 cookie %llx", cookie);
+    CHECK(startsWith(subscribe(&client, args), "# confirm with:"));
+    CHECK(numActive() == 0);
+
+    // Echoed from the right address: subscribed, then renewed.
+    snprintf(args, sizeof(args), "samples 100 cookie %016llx", cookie);
+    CHECKF(startsWith(subscribe(&client, args), "# subscribed to samples every 100 ms"), "%s", reply);
+    CHECK(numActive() == 1);
+    snprintf(args, sizeof(args), "samples 50 cookie %llx", replyCookie());
+    CHECKF(startsWith(subscribe(&client, args), "# renewed samples every 50 ms"), "%s", reply);
+    CHECK(numActive() == 1);
+
+    CHECK(startsWith(subscribe(&client, "samples 100 cookie"), "Usage:"));
+    CHECK(startsWith(subscribe(&client, "samples 100 junk"), "Usage:"));
+    CHECK(startsWith(subscribe(&client, "nothing"), "Usage:"));
+
+    Subscriptions_stats_t st;
+    Subscriptions_getStats(&st);
+    CHECK(st.unconfirmed == 5);
+
+    Subscriptions_unsubscribe(&client, "", reply, sizeof(reply));
+    CHECK(numActive() == 0);
+
+    Sampler_cleanup();
+    Period_cleanup();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,51 @@
+// Token bucket arithmetic, on made-up times:
+//  - a new bucket starts full, and a take it can't cover changes nothing;
+//  - refills stop at the burst;
+//  - a slow rate refilled far more often than it earns a thousandth
+//    still earns every token;
+//  - a zero rate never refills.
+#include "hal/token_bucket.h"
+#include "check.h"
+
+#define NS_PER_SEC 1000000000LL
+#define BURST 10
+
+int main(void)
+{
+    TokenBucket_t bucket = {0};
+    long long now = NS_PER_SEC;
+
+    // New: full. Emptied, a take fails and leaves the bucket as it was.
+    TokenBucket_refill(&bucket, now, 100, BURST);
+    CHECK(TokenBucket_has(&bucket, BURST) && !TokenBucket_has(&bucket, BURST + 1));
+    CHECK(!TokenBucket_take(&bucket, BURST + 1) && bucket.milliTokens == BURST * TOKEN_BUCKET_MILLI);
+    CHECK(TokenBucket_take(&bucket, BURST - 1) && TokenBucket_take(&bucket, 1));
+    CHECK(!TokenBucket_take(&bucket, 1) && bucket.milliTokens == 0);
+
+    // 100/s for 50 ms is 5 tokens; another minute stops at the burst.
+    now += NS_PER_SEC / 20;
+    TokenBucket_refill(&bucket, now, 100, BURST);
+    CHECKF(bucket.milliTokens == 5 * TOKEN_BUCKET_MILLI, "%lld thousandths", bucket.milliTokens);
+    now += 60 * NS_PER_SEC;
+    TokenBucket_refill(&bucket, now, 100, BURST);
+    CHECK(bucket.milliTokens == BURST * TOKEN_BUCKET_MILLI);
+
+    // 20/s earns a thousandth every 50 us; refilled every 10 us for a
+    // second, it must still come to 20 tokens.
+    CHECK(TokenBucket_take(&bucket, BURST));
+    for (int i = 0; i < 100000; i++) {
+        now += 10000;
+        TokenBucket_refill(&bucket, now, 20, 2 * BURST);
+    }
+    CHECKF(bucket.milliTokens == 2 * BURST * TOKEN_BUCKET_MILLI, "%lld thousandths", bucket.milliTokens);
+
+    // Rate 0: what's there can be taken, and nothing comes back.
+    TokenBucket_t fixed = {0};
+    TokenBucket_refill(&fixed, now, 0, 2);
+    CHECK(TokenBucket_take(&fixed, 2));
+    now += 60 * NS_PER_SEC;
+    TokenBucket_refill(&fixed, now, 0, 2);
+    CHECK(!TokenBucket_has(&fixed, 1) && fixed.milliTokens == 0);
+
+    return CHECK_RESULT();
+}